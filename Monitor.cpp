@@ -52,290 +52,731 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
 #include <time.h>
+#include <signal.h>
+
+#include "sample.h"
+#include "sensors.h"
+#include "record.h"
+#include "rollup.h"
+#include "alarm.h"
+#include "dosing.h"
+#include "adaptive.h"
+#include "deadband.h"
+#include "metrics.h"
+#include "i2cbus.h"
+#include "config.h"
+#include "probe.h"
+#include "health.h"
+#include "broker.h"
+#include "burst.h"
+#include "reactor.h"
+#include "poller.h"
+#include "schedule.h"
+#include "segment.h"
+
+// The reporting interval, report file, sensors and so on come from the
+// config file (see config.h), with the defaults there.
+
+// How much a channel has to change between samples before adaptive mode
+// treats it as active.  Zero means the channel is ignored; the Fahrenheit
+// channels just follow the Celsius ones.
+
+static const float channelActivity[NUM_CHANNELS] =
+{
+	0.2, 0, 0.1, 0.2, 0, 1.0, 0.2, 0.2
+};
 
+// In deadband mode a channel is only written to the report when it has
+// moved by more than this since the last value written for it.
 
-// How often, in minutes, betweeen each reporting interval.  This can be
-// changed on the command line.
+static const float channelDeadband[NUM_CHANNELS] =
+{
+	0.1, 0.2, 0.1, 0.1, 0.2, 0.5, 0.1, 0.1
+};
+
+// The acquisition thread's priority in real time mode.  It stays below the
+// kernel's interrupt threads (50), which the I2C transfers wait on.
+
+#define REALTIME_PRIORITY	40
+
+// Settings given on the command line.  These win over the config file, so
+// they are kept to be applied again after a reload.
+
+static const char *configFilename = DEFAULT_CONFIG_FILENAME;
+static const char *reportOption = NULL;
+static const char *statsOption = NULL;
+static int intervalOption = 0;
+static int metricsOption = 0;
+
+static Config config;
+
+// The sample cycle.  Everything happens from the event loop (see
+// reactor.h): a timer starts a cycle, the poller reads the sensors without
+// blocking, and when it is done the sample is written and the next cycle's
+// timer is set.  A cycle that comes due while the broker has the bus, or a
+// reload asked for in the middle of a cycle, waits until the bus is free.
+
+static bool adaptive;
+static bool deadband;
+static time_t due[NUM_SENSORS];		// when each sensor is next due
+static time_t lastCycle;
+static SensorPoll cycle;
+static struct timespec cycleStart;
+static int cycleTimer = -1;
+static bool cycleWanted = false;
+static bool reloadWanted = false;
+
+static void usage(const char *name);
+static void startCycle(void *arg);
+static void endCycle(SensorPoll *poll);
+static void scheduleCycle(void);
+static void busIdle(void);
+static void statsSignal(void);
+static void reloadSignal(void);
+static void stopSignal(void);
+static void applyOptions(Config *settings);
+static void driverSettings(const Config *settings);
+static void reload(void);
+static void prepareReport(const char *filename);
+static void writeStats(const char *filename);
+static double elapsed(const struct timespec *start, const struct timespec *end);
 
-#define DEFAULT_REPORTING_INTERVAL	15
 
-// This is the default report file.  Can be changed on the command line.
 
-#define	DEFAULT_REPORT_FILENAME		"/home/pi/Jason/report.csv"
 
-// This is the I2C address of the PCT2075 sensor.  Do not change this unless
-// the device is moved to a different address via the address selection bits.
+//****************************************************************************
+int main(int argc, char **argv)
+{
+	int adaptiveMinimum = 0;	// seconds, zero means adaptive mode is off
+	int heartbeat = 0;		// minutes, zero means deadband mode is off
+	int realtimeCpu = -1;		// -1 means real time mode is off
 
-#define PCT2075_ADDR	0x37
+	int option;
+	while ((option = getopt(argc, argv, "c:f:i:a:d:p:s:r:")) != -1)
+	{
+		switch (option)
+		{
+			case 'c':
+				configFilename = optarg;
+				break;
+
+			case 'f':
+				reportOption = optarg;
+				break;
+
+			case 'i':
+				intervalOption = atoi(optarg);
+				if (intervalOption < 1)
+				{
+					usage(argv[0]);
+				}
+				break;
+
+			case 'a':
+				adaptiveMinimum = atoi(optarg);
+				break;
+
+			case 'd':
+				heartbeat = atoi(optarg);
+				break;
+
+			case 'p':
+				metricsOption = atoi(optarg);
+				break;
+
+			case 's':
+				statsOption = optarg;
+				break;
+
+			case 'r':
+				realtimeCpu = atoi(optarg);
+				if (realtimeCpu < 0)
+				{
+					usage(argv[0]);
+				}
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
 
-// This is the I2C address of the PCF8591 ADC.  Do not change this unless
-// the device is moved to a different address via the address selection bits.
+	if (adaptiveMinimum < 0 || heartbeat < 0 || metricsOption < 0)
+	{
+		usage(argv[0]);
+	}
 
-#define ADC_ADDR	0x48
+	// Read the config and open the I2C buses it uses
 
-// This is the I2C address of the SHT30 sensor.  Do not change this unless
-// the device is moved to a different address via the address selection bits.
+	if (!configLoad(configFilename, &config))
+	{
+		exit(1);
+	}
+	applyOptions(&config);
+	if (!configOpen(&config, NULL))
+	{
+		exit(1);
+	}
+	driverSettings(&config);
+	if (config.probe)
+	{
+		probeSensors(&config);
+	}
+	if (!scheduleCheck(&config))
+	{
+		exit(1);
+	}
+	scheduleStart(&config, time(NULL));
+	healthInit();
 
-#define SHT30_ADDR	0x44
+	// SIGUSR1 writes the I2C statistics, SIGHUP reads the config again,
+	// SIGTERM and SIGINT stop Monitor.  They come in through the event
+	// loop, so they are dealt with between other things, never in the
+	// middle of one.
 
-// Microseconds in a millisecond
+	i2cStatsInit();
 
-#define US_IN_MS	1000
+	if (!reactorInit() || !reactorSignal(SIGUSR1, statsSignal) || !reactorSignal(SIGHUP, reloadSignal) ||
+		!reactorSignal(SIGTERM, stopSignal) || !reactorSignal(SIGINT, stopSignal))
+	{
+		exit(1);
+	}
 
-// The maximum voltage that the pH sensor provides.  It is always 3.3 volts.
+	prepareReport(config.report);
 
-#define SENSOR_VOLTAGE	3.3
+	// Keep the 1 minute/hour/day rollups next to the report.
 
-// Constants for converting voltage into pH.  Beats me what the values mean.
+	rollupInit(config.report, NUM_CHANNELS, channelNames);
+	alarmInit(config.alarms, NUM_CHANNELS, channelNames);
+	dosingInit(config.dosing, NUM_CHANNELS, channelNames);
 
-#define CONSTANT	-19.18518519
-#define OFFSET		41.02740741		//deviation compensate
+	adaptive = adaptiveMinimum > 0 &&
+		adaptiveInit(NUM_CHANNELS, channelNames, channelActivity, adaptiveMinimum, config.interval);
+	deadband = heartbeat > 0 &&
+		deadbandInit(NUM_CHANNELS, channelDeadband, heartbeat * 60);
 
-static void pollTemp(int fd, FILE *report);
-static void pollPH(int fd, FILE *report);
-static void pollSHT30(int fd, FILE *report);
+	if (config.metricsPort > 0)
+	{
+		metricsInit(config.metricsPort, NUM_CHANNELS, channelNames);
+	}
 
+	// The programs ask Monitor for readings rather than use the bus behind
+	// its back.
 
+	if (config.broker[0] != '\0')
+	{
+		brokerInit(config.broker, &config);
+	}
 
+	// Burst mode reads the sensors whenever nothing else wants the bus.
 
-//****************************************************************************
-int main(int argc, char **argv)
-{
-	int reportingInterval = DEFAULT_REPORTING_INTERVAL;
-	char *reportFilename = (char *)DEFAULT_REPORT_FILENAME;
+	if (config.burstBefore > 0 || config.burstAfter > 0)
+	{
+		burstInit(config.captures, config.burstBefore, config.burstAfter, &config);
+	}
 
-	// Open the I2C interface
+	if (config.segments[0] != '\0' &&
+		segmentInit(config.segments, config.segmentRecords, config.segmentSync))
+	{
+		printf("Writing samples to segments in %s, %d records each\n", config.segments, config.segmentRecords);
+	}
 
-	int i2cfd = open("/dev/i2c-1", O_RDWR);
-	if (i2cfd <= 0)
+	if (!pollerIdle(busIdle))
 	{
-		printf("Error opening I2C device: %s\n", strerror(errno));
 		exit(1);
 	}
 
-	FILE *report = fopen(reportFilename, "a");
-	if (report == NULL)
+	if (realtimeCpu >= 0 && pollerRealtime(realtimeCpu, REALTIME_PRIORITY))
 	{
-		printf("Error opening report file %s: %s\n", reportFilename, strerror(errno));
+		printf("Reading the sensors from CPU %d at real time priority %d\n", realtimeCpu, REALTIME_PRIORITY);
 	}
-	else
+
+	// Everything is due right away.
+
+	for (int i = 0; i < NUM_SENSORS; i++)
 	{
-		// If the offset is zero then the file is empty and needs the headers
-		// written, otherwise do not write the headers again.
+		due[i] = 0;
+	}
+	startCycle(NULL);
 
-		if (ftell(report) == 0)		// zero means empty file
-		{
-			fprintf(report, "Date,Time,epoch,");
+	reactorRun();
+	exit(0);
+}
 
-			// Call each reporting function a negative FD; this tells them to
-			// write their column headers to the output file.
 
-			pollTemp(-1, report);
-			fprintf(report, ",");		// comma between fields
-			pollPH(-1, report);
-			fprintf(report, ",");		// comma between fields
-			pollSHT30(-1, report);
-			fprintf(report, "\n");
-			fclose(report);
-		}
+
+
+//****************************************************************************
+// Explains the command line and exits.
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-c config file] [-f report file] [-i minutes] [-a seconds]\n", name);
+	printf("          [-d minutes] [-p port] [-s stats file] [-r cpu]\n");
+	printf("   -c  config file, default %s, read again on SIGHUP\n", DEFAULT_CONFIG_FILENAME);
+	printf("   -f  report file, default %s\n", DEFAULT_REPORT_FILENAME);
+	printf("   -i  reporting interval in minutes, default %d\n", DEFAULT_REPORTING_INTERVAL);
+	printf("   -a  adaptive sampling: read a sensor as often as every this many\n");
+	printf("       seconds while it is changing, backing off to the reporting\n");
+	printf("       interval while it is stable\n");
+	printf("   -d  deadband mode: only write a channel when it moves, or at least\n");
+	printf("       this many minutes after it was last written\n");
+	printf("   -p  serve Prometheus metrics on this TCP port at /metrics\n");
+	printf("   -s  file the I2C statistics are written to on SIGUSR1, default\n");
+	printf("       %s\n", DEFAULT_STATS_FILENAME);
+	printf("   -r  real time mode: read the sensors from a SCHED_FIFO thread pinned\n");
+	printf("       to this CPU, with Monitor locked in memory (needs root)\n");
+	exit(1);
+}
+
+
+
+
+//****************************************************************************
+// Starts a sample cycle: works out which sensors are due and has the poller
+// read them.  endCycle() takes it from there.
+
+static void startCycle(void *arg)
+{
+	cycleTimer = -1;
+
+	if (pollerBusy())
+	{
+		cycleWanted = true;		// busIdle() starts it
+		return;
+	}
+
+	lastCycle = time(NULL);
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		cycle.due[i] = config.enabled[i] && due[i] <= lastCycle && healthReady(i, lastCycle);
 	}
+	cycle.done = endCycle;
+
+	clock_gettime(CLOCK_MONOTONIC, &cycleStart);
+	i2cCycleBegin();
+	pollerStart(config.slot, &cycle);
+}
 
-	// The main loop...
 
-	for (;;)
+
+
+//****************************************************************************
+// The sensors have been read: writes the sample out, passes it to everything
+// that wants it and sets the timer for the next cycle.
+
+static void endCycle(SensorPoll *poll)
+{
+	struct timespec cycleEnd;
+	clock_gettime(CLOCK_MONOTONIC, &cycleEnd);
+	i2cCycleEnd();
+
+	Sample *sample = &poll->sample;
+	time_t now = lastCycle;
+
+	healthResults(&config, poll->due, poll->failed, now);
+	scheduleResults(poll->due, poll->failed, due, now);
+	brokerUpdate(poll->readings, poll->due);
+
+	dosingSample(sample, &poll->readings[SENSOR_PH].fetched);	// react before anything else
+	burstSample(sample);
+	alarmSample(sample);
+	rollupSample(sample);
+	segmentSample(sample);
+
+	// In deadband mode only the channels that moved get written, and
+	// nothing at all if none of them did.
+
+	Sample row = *sample;
+	if (!deadband || deadbandFilter(&row) > 0)
 	{
-		FILE *report = fopen(reportFilename, "a");
+		FILE *report = fopen(config.report, "a");
 		if (report == NULL)
 		{
-			printf("Error opening report file %s: %s\n", reportFilename, strerror(errno));
+			printf("Error opening report file %s: %s\n", config.report, strerror(errno));
 		}
 		else
 		{
-			time_t now = time(NULL);	// get current time... this is Unix magic
-			struct tm *tp = localtime(&now);	// convert to local time
+			writeRow(report, &row);
+			fclose(report);
+		}
+	}
 
-			fprintf(report, "%02d/%02d/%04d,%02d:%02d:%02d,%lu,",
-				tp->tm_mon + 1, tp->tm_mday, tp->tm_year + 1900,
-				tp->tm_hour, tp->tm_min, tp->tm_sec,
-				now);
+	double expectedHz[NUM_CHANNELS];
+	double achievedHz[NUM_CHANNELS];
+	unsigned long missed[NUM_CHANNELS];
+	scheduleRates(expectedHz, achievedHz, missed);
+	metricsRates(expectedHz, achievedHz, missed);
 
-			pollTemp(i2cfd, report);	// get and display value
-			fprintf(report, ",");		// comma between fields
+	struct timespec written;
+	clock_gettime(CLOCK_REALTIME, &written);
+	metricsUpdate(sample, elapsed(&cycleStart, &cycleEnd), elapsed(&sample->when, &written));
 
-			pollPH(i2cfd, NULL);		// throw out first
-			usleep(100 * US_IN_MS);		// delay 100ms
-			pollPH(i2cfd, report);		// get actual value
-			fprintf(report, ",");		// comma between fields
+	// Work out when each sensor that was just read is due again.  In
+	// adaptive mode that is the shortest interval of its channels.
 
-			pollSHT30(i2cfd, report);
-			fprintf(report, "\n");
-			fclose(report);
+	if (adaptive)
+	{
+		adaptiveSample(sample);
+	}
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (!config.enabled[i] || due[i] > now)
+		{
+			continue;
+		}
+
+		int interval = config.every[i];
+		for (int ch = BoardSensors::FIRST[i]; adaptive &&
+			ch < BoardSensors::FIRST[i] + BoardSensors::VALUES_OF[i]; ch++)
+		{
+			if (adaptiveInterval(ch) < interval)
+			{
+				interval = adaptiveInterval(ch);
+			}
 		}
+		due[i] = now + interval;
+	}
 
-		// Now sleep a while.
+	scheduleCycle();
+}
+
+
+
+
+//****************************************************************************
+// Sets the timer for the next cycle: when the soonest sensor is due, or a
+// reporting interval after the last cycle, whichever comes first.
 
-//printf("About to sleep %d seconds\n", reportingInterval * 60);
-		sleep(reportingInterval * 60);
+static void scheduleCycle(void)
+{
+	time_t next = lastCycle + config.interval;
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (config.enabled[i] && due[i] < next)
+		{
+			next = due[i];
+		}
 	}
 
-	exit(0);
+	reactorCancel(cycleTimer);
+	cycleTimer = reactorAfter(next - time(NULL), startCycle, NULL);
 }
 
 
 
 
 //****************************************************************************
-// This polls the PCT2075 temperatue sensor and prints the value.
+// The poller calls this whenever the bus comes free.  Whatever was held
+// back because it was busy goes now: a reload, then a cycle, then the
+// broker's requests.  If none of them wants it, burst mode has it.
+//
+// The cycle and the broker go earliest deadline first.  The cycle's is
+// when its soonest sensor is due again, a request's is when the program
+// asking gives up on it.  Usually that puts the cycle first, but a request
+// that has been waiting out a long cycle can be nearer its end.
 
-static void pollTemp(int fd, FILE *report)
+static void busIdle(void)
 {
-	// See if this is a request to write column headers to the output file
+	if (reloadWanted)
+	{
+		reloadWanted = false;
+		reload();
+	}
 
-	if (fd < 0)
+	if (cycleWanted)
 	{
-		fprintf(report, "PCT_C,PCT_F");
-		return;
+		time_t brokerDue = brokerDeadline();
+		if (brokerDue != 0 && brokerDue < scheduleDeadline(&config, due, time(NULL)))
+		{
+			brokerService();
+			if (pollerBusy())
+			{
+				return;		// back here when that read is done
+			}
+		}
+
+		cycleWanted = false;
+		startCycle(NULL);
 	}
 
-	if (ioctl(fd, I2C_SLAVE, PCT2075_ADDR) < 0)
+	brokerService();
+	burstService();
+}
+
+
+
+
+//****************************************************************************
+// SIGUSR1: writes the I2C statistics.
+
+static void statsSignal(void)
+{
+	writeStats(config.stats);
+}
+
+
+
+
+//****************************************************************************
+// SIGHUP: reads the config again, once the bus is free.
+
+static void reloadSignal(void)
+{
+	if (pollerBusy())
 	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
+		reloadWanted = true;
 		return;
 	}
 
-	int got;
+	reload();
+}
+
 
-	unsigned char buffer[8];
 
-	// Send over a request to read from the data register, address 0
 
-	buffer[0] = 0x00;
-	if ((got = write(fd, buffer, 1)) != 1)
+//****************************************************************************
+// SIGTERM, SIGINT: saves what is only kept in memory and stops.
+
+static void stopSignal(void)
+{
+	dosingFinish();
+	rollupFinish();
+	segmentFinish();
+	printf("Stopping\n");
+	exit(0);
+}
+
+
+
+
+//****************************************************************************
+// Puts the command line settings over the ones from the config file.
+
+static void applyOptions(Config *settings)
+{
+	if (reportOption != NULL)
 	{
-		printf("%d Error writing sensor command: %s\n", got, strerror(errno));
-		return;
+		snprintf(settings->report, sizeof(settings->report), "%s", reportOption);
 	}
 
-	if ((got = read(fd, buffer, 2)) != 2)
+	if (statsOption != NULL)
 	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
-		return;
+		snprintf(settings->stats, sizeof(settings->stats), "%s", statsOption);
 	}
 
-	// Okay, so I had to play around a bit to get reasonable values, although
-	// it does not seem to jive with the datasheet.  Whatever, it works.
+	if (intervalOption > 0)
+	{
+		settings->interval = intervalOption * 60;
+	}
 
-	unsigned raw = (buffer[0] << 8) | buffer[1];
-	float cTemp = raw / 256.0;
-	float fTemp = (cTemp * 9.0 / 5.0) + 32;
-	fprintf(report, "%1.1f,%1.1f", cTemp, fTemp);
+	if (metricsOption > 0)
+	{
+		settings->metricsPort = metricsOption;
+	}
 }
 
 
 
 
 //****************************************************************************
-// This polls the ADC and returns the value.  Note that the initial read
-// will always be 128 (0x80).  Each poll actually returns the previous poll
-// value and starts another conversion.
+// Reads the config file again.  This runs between samples, and the new
+// config is completely loaded (buses and all) before it replaces the old
+// one, so no sample is lost.  If anything is wrong with it the old config
+// just stays.
+//
+// Sensors keep their schedule, except that one whose interval got shorter
+// is brought forward and one that was just turned on is due right away.
 
-static void pollPH(int fd, FILE *report)
+static void reload(void)
 {
-	// See if this is a request to write column headers to the output file
+	static Config fresh;
+	time_t now = time(NULL);
+
+	printf("Reloading %s\n", configFilename);
 
-	if (fd < 0)
+	if (!configLoad(configFilename, &fresh))
 	{
-		fprintf(report, "pH");
+		printf("Keeping the old config\n");
 		return;
 	}
+	applyOptions(&fresh);
 
-	if (ioctl(fd, I2C_SLAVE, ADC_ADDR) < 0)
+	if (!configOpen(&fresh, &config))
 	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
+		printf("Keeping the old config\n");
 		return;
 	}
-
-	int got;
-
-	unsigned char buffer[8];
-
-	buffer[0] = 0x00;
-	buffer[1] = 0x00;
-	if ((got = write(fd, buffer, 2)) != 2)
+	driverSettings(&fresh);
+	if (fresh.probe)
 	{
-		printf("%d Error writing sensor command: %s\n", got, strerror(errno));
+		probeSensors(&fresh);
+	}
+	if (!scheduleCheck(&fresh))
+	{
+		driverSettings(&config);
+		configClose(&fresh, &config);
+		printf("Keeping the old config\n");
 		return;
 	}
 
-	if ((got = read(fd, buffer, 4)) != 4)
+	if (fresh.metricsPort != config.metricsPort || strcmp(fresh.alarms, config.alarms) != 0 ||
+		strcmp(fresh.broker, config.broker) != 0 || strcmp(fresh.dosing, config.dosing) != 0)
 	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
-		return;
+		printf("Alarm, dosing, metrics and broker changes take effect on restart\n");
 	}
 
-	if (report != NULL)
+	for (int i = 0; i < NUM_SENSORS; i++)
 	{
-		// Now convert the raw value into a PH
+		if (fresh.enabled[i] && !config.enabled[i])
+		{
+			due[i] = 0;
+		}
+		else if (due[i] > now + fresh.every[i])
+		{
+			due[i] = now + fresh.every[i];
+		}
+	}
 
-		float voltage = buffer[0] * (SENSOR_VOLTAGE / 255);
-		float ph = CONSTANT * voltage + OFFSET;
-		fprintf(report, "%1.1f", ph);
+	if (strcmp(fresh.report, config.report) != 0)
+	{
+		prepareReport(fresh.report);
 	}
+
+	configClose(&config, &fresh);
+	config = fresh;
+	scheduleStart(&config, now);
+
+	// The sensors may have moved, so give them all a fresh start.  A reload
+	// can make a sensor due sooner, so work out the wake up time again.
+
+	healthInit();
+	scheduleCycle();
 }
 
 
 
 
 //****************************************************************************
-// This polls the currently selected SHT30, given the FD to the i2c device.
-// Returns either 0 (good) or -1 (bad).  For good conditions this displays
-// the temp and himidity.  For bad results, displays an error message.
+// Hands the drivers their settings from a config.  Probing needs them, so
+// this comes before it.
 
-static void pollSHT30(int fd, FILE *report)
+static void driverSettings(const Config *settings)
 {
-	// See if this is a request to write column headers to the output file
+	phSettle = settings->phSettle;
+	snprintf(w1Root, sizeof(w1Root), "%s", settings->w1);
+}
+
+
 
-	if (fd < 0)
+
+//****************************************************************************
+// Makes sure the report file exists and starts with the column headers.
+// A report with some other header line was written with different columns
+// (a sensor added since, say), and readers go by the header, so new rows
+// under it would be misread.  It gets moved aside and a new report started.
+// The old one is named for when it was moved, <report>.<YYYYMMDD-HHMMSS>.old
+// (with a number on the end if that is taken), so nothing moved aside
+// before is ever written over.
+
+static void prepareReport(const char *filename)
+{
+	FILE *existing = fopen(filename, "r");
+	if (existing != NULL)
 	{
-		fprintf(report, "TempC,TempF,Humidity");
-		return;
+		char line[sizeof(BoardSensors::HEADER) + 1];
+		bool stale = fgets(line, sizeof(line), existing) != NULL &&
+			strcmp(line, BoardSensors::HEADER.data()) != 0;
+		fclose(existing);
+
+		if (stale)
+		{
+			time_t now = time(NULL);
+			struct tm local;
+			localtime_r(&now, &local);
+			char stamp[32];
+			strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+			// link() won't replace a file that is there, unlike rename()
+
+			char old[CONFIG_PATH_SIZE + 64];
+			snprintf(old, sizeof(old), "%s.%s.old", filename, stamp);
+			for (int n = 1; link(filename, old) != 0; n++)
+			{
+				if (errno != EEXIST)
+				{
+					printf("Error moving report file %s aside: %s\n", filename, strerror(errno));
+					return;
+				}
+				snprintf(old, sizeof(old), "%s.%s.%d.old", filename, stamp, n);
+			}
+			if (unlink(filename) != 0)
+			{
+				printf("Error moving report file %s aside: %s\n", filename, strerror(errno));
+				unlink(old);
+				return;
+			}
+			printf("Report %s has different columns, moved it to %s\n", filename, old);
+		}
 	}
 
-	if (ioctl(fd, I2C_SLAVE, SHT30_ADDR) < 0)
+	FILE *report = fopen(filename, "a");
+	if (report == NULL)
 	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
+		printf("Error opening report file %s: %s\n", filename, strerror(errno));
 		return;
 	}
 
-	unsigned char buffer[2];
-	buffer[0] = 0x2c;
-	buffer[1] = 0x06;
-	if (write(fd, buffer, 2) != 2)
+	// If the offset is zero then the file is empty and needs the headers
+	// written, otherwise do not write the headers again.
+
+	if (ftell(report) == 0)		// zero means empty file
 	{
-		printf("Error writing sensor command: %s\n", strerror(errno));
-		return;
+		writeHeaders(report);
 	}
+	fclose(report);
+}
+
 
-	int got;
 
-	if ((got = read(fd, buffer, 6)) != 6)
+
+//****************************************************************************
+// Writes the I2C statistics to the stats file.
+
+static void writeStats(const char *filename)
+{
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
 	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
+		printf("Error opening stats file %s: %s\n", filename, strerror(errno));
 		return;
 	}
 
-	float temp = buffer[0] * 256 + buffer[1];
-	float cTemp = -45 + (175 * temp / 65536.0);
-	float fTemp = -49 + (315 * temp / 65536.0);
-	float humidity = 100 * (buffer[3] * 256 + buffer[4]) / 65536.0;
+	i2cStatsDump(out);
+	scheduleDump(out);
 
-	fprintf(report, "%1.2f,%1.2f,%1.2f%%", cTemp, fTemp, humidity);
+	if (wakeupStats.count > 0)
+	{
+		fprintf(out, "\nReal time wake-ups: %lu, average %.1f us late, worst %.1f us\n",
+			wakeupStats.count, wakeupStats.sum / wakeupStats.count * 1e6, wakeupStats.worst * 1e6);
+	}
+	if (dosingLatency.count > 0)
+	{
+		fprintf(out, "\nDoses: %lu, average %.1f us from the reading, worst %.1f us\n",
+			dosingLatency.count, dosingLatency.sum / dosingLatency.count * 1e6, dosingLatency.worst * 1e6);
+	}
+	fclose(out);
 }
 
 
+
+
+//****************************************************************************
+// Returns the number of seconds between two times.
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,106 @@
+//****************************************************************************
+// Pumps and the like.  See actuator.h.
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include "actuator.h"
+#include "gpio.h"
+
+static bool setGpio(Actuator *a, bool on);
+static bool setSim(Actuator *a, bool on);
+
+
+
+
+//****************************************************************************
+// Sets up an actuator on a GPIO line, switched off.  An active low one (a
+// lot of relay boards are) is on when the pin is low.  Returns false after
+// printing an error if the line can't be had.
+
+bool actuatorGpio(Actuator *a, const char *chip, int line, bool activeLow)
+{
+	memset(a, 0, sizeof(*a));
+	a->set = setGpio;
+	a->activeLow = activeLow;
+	a->fd = gpioOpenOutput(chip, line, activeLow ? 1 : 0);
+	clock_gettime(CLOCK_MONOTONIC, &a->since);
+
+	return a->fd >= 0;
+}
+
+
+
+
+//****************************************************************************
+// Sets up a simulated actuator that logs to the given file.  Returns false
+// after printing an error if the file can't be opened.
+
+bool actuatorSim(Actuator *a, const char *logFilename)
+{
+	memset(a, 0, sizeof(*a));
+	a->set = setSim;
+	a->fd = -1;
+	a->log = fopen(logFilename, "a");
+	clock_gettime(CLOCK_MONOTONIC, &a->since);
+
+	if (a->log == NULL)
+	{
+		printf("Error opening actuator log %s: %s\n", logFilename, strerror(errno));
+		return false;
+	}
+
+	setvbuf(a->log, NULL, _IOLBF, 0);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Switches an actuator on or off.  Returns false if that failed, in which
+// case it is taken to be as it was.
+
+bool actuatorSet(Actuator *a, bool on)
+{
+	if (!a->set(a, on))
+	{
+		return false;
+	}
+
+	a->on = on;
+	clock_gettime(CLOCK_MONOTONIC, &a->since);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// High for on, unless the actuator is active low.
+
+static bool setGpio(Actuator *a, bool on)
+{
+	return gpioWrite(a->fd, on != a->activeLow);
+}
+
+
+
+
+//****************************************************************************
+// The log has the wall clock time, so it can be lined up with the report,
+// and how long the actuator was in the state it is leaving.
+
+static bool setSim(Actuator *a, bool on)
+{
+	struct timespec now;
+	struct timespec mono;
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+
+	double held = (mono.tv_sec - a->since.tv_sec) + (mono.tv_nsec - a->since.tv_nsec) / 1e9;
+	fprintf(a->log, "%lld.%03ld %s after %.3f s\n", (long long)now.tv_sec, now.tv_nsec / 1000000,
+		on ? "ON" : "OFF", held);
+	return true;
+}
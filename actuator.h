@@ -0,0 +1,33 @@
+//****************************************************************************
+// Something Monitor can switch on and off, like a dosing pump.  There are
+// two kinds behind the same calls:
+//
+//    gpio    a pin on the GPIO character device (see gpio.h), driven with
+//            one ioctl, for a relay or pump driver
+//    sim     nothing at all is switched; each change is written, with the
+//            time, to a log file, for trying out a controller
+//
+// Actuators start off.  Switching one is quick and never blocks, so it can
+// be done straight from the sample cycle.
+
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <stdio.h>
+#include <time.h>
+
+struct Actuator
+{
+	bool (*set)(Actuator *a, bool on);
+	bool on;
+	int fd;				// gpio
+	bool activeLow;
+	FILE *log;			// sim
+	struct timespec since;		// when it last changed, CLOCK_MONOTONIC
+};
+
+bool actuatorGpio(Actuator *a, const char *chip, int line, bool activeLow);
+bool actuatorSim(Actuator *a, const char *logFilename);
+bool actuatorSet(Actuator *a, bool on);
+
+#endif	// ACTUATOR_H
@@ -0,0 +1,127 @@
+//****************************************************************************
+// Adaptive sampling intervals.  See adaptive.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "adaptive.h"
+
+// Weight of the newest sample in the running mean and variance.  Smaller
+// values remember further back.
+
+#define ALPHA	0.25
+
+struct Channel
+{
+	float activity;			// change that counts as moving
+	bool primed;			// has seen at least one sample
+	float last;			// previous value
+	float mean;			// running mean
+	float variance;			// running variance
+	int interval;			// current interval in seconds
+};
+
+static Channel channel[MAX_CHANNELS];
+static int numChannels = 0;
+static const char **channelNames;
+static int minInterval;
+static int maxInterval;
+
+
+
+
+//****************************************************************************
+// Sets up the channels.  Every channel starts at the minimum interval and
+// backs off from there once it is seen to be stable.
+
+bool adaptiveInit(int channels, const char **names, const float *activity, int minSeconds, int maxSeconds)
+{
+	if (channels > MAX_CHANNELS || minSeconds < 1 || maxSeconds < minSeconds)
+	{
+		printf("Bad adaptive sampling settings: %d channels, %d to %d seconds\n",
+			channels, minSeconds, maxSeconds);
+		return false;
+	}
+
+	numChannels = channels;
+	channelNames = names;
+	minInterval = minSeconds;
+	maxInterval = maxSeconds;
+
+	memset(channel, 0, sizeof(channel));
+	for (int ch = 0; ch < channels; ch++)
+	{
+		channel[ch].activity = activity[ch];
+		channel[ch].interval = activity[ch] > 0 ? minSeconds : maxSeconds;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Updates the interval of every channel that was read in this sample.  Any
+// change of interval is logged.
+
+void adaptiveSample(const Sample *sample)
+{
+	for (int ch = 0; ch < numChannels && ch < sample->channels; ch++)
+	{
+		Channel *c = &channel[ch];
+		if (!sample->valid[ch] || c->activity <= 0)
+		{
+			continue;
+		}
+
+		float value = sample->value[ch];
+		if (!c->primed)
+		{
+			c->primed = true;
+			c->last = c->mean = value;
+			continue;
+		}
+
+		float delta = value - c->last;
+		float deviation = value - c->mean;
+		c->mean += ALPHA * deviation;
+		c->variance = (1 - ALPHA) * (c->variance + ALPHA * deviation * deviation);
+		c->last = value;
+
+		// Moving means go fast right now; stable means back off.
+
+		int interval;
+		if (fabsf(delta) > c->activity || sqrtf(c->variance) > c->activity)
+		{
+			interval = minInterval;
+		}
+		else
+		{
+			interval = c->interval * 2;
+			if (interval > maxInterval)
+			{
+				interval = maxInterval;
+			}
+		}
+
+		if (interval != c->interval)
+		{
+			printf("Adaptive: %s interval %d -> %d seconds (change %1.2f, spread %1.2f)\n",
+				channelNames[ch], c->interval, interval, delta, sqrtf(c->variance));
+			c->interval = interval;
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Returns how many seconds until the channel should be read again.
+
+int adaptiveInterval(int ch)
+{
+	return channel[ch].interval;
+}
@@ -0,0 +1,21 @@
+//****************************************************************************
+// Adaptive sampling.  Instead of reading every sensor on a fixed interval,
+// each channel gets its own interval that drops to the minimum as soon as
+// the channel starts moving (a nutrient dose, a misting burst) and then
+// doubles each time the channel is found to be stable, up to the maximum.
+//
+// A channel is "moving" when it changed by more than its activity level
+// since the last sample, or when its recent spread (a running standard
+// deviation) is above that level.  Channels with an activity level of zero
+// are ignored and always report the maximum interval.
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "sample.h"
+
+bool adaptiveInit(int channels, const char **names, const float *activity, int minSeconds, int maxSeconds);
+void adaptiveSample(const Sample *sample);
+int adaptiveInterval(int channel);
+
+#endif	// ADAPTIVE_H
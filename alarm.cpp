@@ -0,0 +1,517 @@
+//****************************************************************************
+// Threshold alarm engine.  See alarm.h for the rule syntax.
+//
+// The rules are compiled once into a flat array grouped by channel, with a
+// first/count index per channel.  Checking a sample only walks the rules
+// for each channel, and every action has its resources (pin, socket) set up
+// ahead of time, so nothing in alarmSample does a lookup or a blocking call.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "alarm.h"
+#include "burst.h"
+#include "gpio.h"
+
+#define MAX_RULES	64
+#define MAX_LINE	256
+
+enum
+{
+	ACTION_EXEC,
+	ACTION_GPIO,
+	ACTION_SOCKET,
+	ACTION_CAPTURE
+};
+
+struct Rule
+{
+	// From the config file
+
+	int channel;
+	bool below;			// true for <, false for >
+	float threshold;
+	float clear;			// level that turns the alarm off
+	unsigned needSamples;		// samples in a row before firing
+	unsigned needSeconds;		// or time held before firing
+	int action;
+	char text[MAX_LINE];		// the rule as written, for messages
+	char *command;			// ACTION_EXEC, points into text
+	int gpiofd;			// ACTION_GPIO
+	int gpioValue;
+	struct sockaddr_un addr;	// ACTION_SOCKET
+	char tag[32];			// ACTION_CAPTURE
+
+	// Run time state
+
+	bool active;			// alarm has fired and not cleared
+	unsigned pendingCount;		// samples the condition has held
+	time_t pendingSince;		// when the condition started to hold
+};
+
+static Rule rules[MAX_RULES];
+static int numRules = 0;
+
+// Rules are sorted by channel; these index into the rules array.
+
+static int firstRule[MAX_CHANNELS];
+static int ruleCount[MAX_CHANNELS];
+
+static const char **channelNames;
+static int alarmSocket = -1;		// datagram socket for ACTION_SOCKET
+
+extern char **environ;
+
+static void checkRules(const Sample *sample, bool captureOnly);
+static bool parseRule(char *line, int lineNumber, int channels, const char **names, Rule *rule);
+static void fire(Rule *rule, bool alarm, float value);
+
+
+
+
+//****************************************************************************
+// Reads the rules from the config file.  A missing file just means there
+// are no alarms.  Bad rules are reported and skipped.
+
+bool alarmInit(const char *configFilename, int channels, const char **names)
+{
+	channelNames = names;
+	numRules = 0;
+
+	FILE *in = fopen(configFilename, "r");
+	if (in == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			printf("Error opening alarm file %s: %s\n", configFilename, strerror(errno));
+		}
+		return false;
+	}
+
+	// Build the list in file order first, then group it by channel.
+
+	static Rule parsed[MAX_RULES];
+	int numParsed = 0;
+	char line[MAX_LINE];
+	int lineNumber = 0;
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineNumber++;
+
+		char *p = line;
+		while (isspace((unsigned char)*p))
+		{
+			p++;
+		}
+		if (*p == '\0' || *p == '#')
+		{
+			continue;
+		}
+
+		if (numParsed == MAX_RULES)
+		{
+			printf("%s:%d: too many alarm rules, only %d allowed\n", configFilename, lineNumber, MAX_RULES);
+			break;
+		}
+
+		if (parseRule(p, lineNumber, channels, names, &parsed[numParsed]))
+		{
+			numParsed++;
+		}
+	}
+	fclose(in);
+
+	for (int ch = 0; ch < channels; ch++)
+	{
+		firstRule[ch] = numRules;
+		ruleCount[ch] = 0;
+		for (int i = 0; i < numParsed; i++)
+		{
+			if (parsed[i].channel == ch)
+			{
+				rules[numRules] = parsed[i];
+				if (rules[numRules].command != NULL)
+				{
+					// Re-aim the command into the copy of the text.
+
+					rules[numRules].command = rules[numRules].text + (parsed[i].command - parsed[i].text);
+				}
+				numRules++;
+				ruleCount[ch]++;
+			}
+		}
+	}
+
+	printf("Loaded %d alarm rules from %s\n", numRules, configFilename);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Checks every rule against a freshly taken sample.
+
+void alarmSample(const Sample *sample)
+{
+	checkRules(sample, false);
+}
+
+
+
+
+//****************************************************************************
+// Checks just the capture rules against a burst sample.
+
+void alarmBurstSample(const Sample *sample)
+{
+	checkRules(sample, true);
+}
+
+
+
+
+//****************************************************************************
+// Checks the rules against a sample.  Channels that could not be read leave
+// their rules exactly as they were.
+
+static void checkRules(const Sample *sample, bool captureOnly)
+{
+	time_t now = sample->when.tv_sec;
+
+	for (int ch = 0; ch < sample->channels; ch++)
+	{
+		if (!sample->valid[ch])
+		{
+			continue;
+		}
+
+		float value = sample->value[ch];
+		Rule *rule = &rules[firstRule[ch]];
+		Rule *end = rule + ruleCount[ch];
+
+		for (; rule < end; rule++)
+		{
+			if (captureOnly && rule->action != ACTION_CAPTURE)
+			{
+				continue;
+			}
+
+			if (rule->active)
+			{
+				// Only going back past the clear level turns it off.
+
+				if (rule->below ? value >= rule->clear : value <= rule->clear)
+				{
+					rule->active = false;
+					fire(rule, false, value);
+				}
+				continue;
+			}
+
+			if (rule->below ? value < rule->threshold : value > rule->threshold)
+			{
+				if (rule->pendingCount++ == 0)
+				{
+					rule->pendingSince = now;
+				}
+
+				if (rule->pendingCount >= rule->needSamples &&
+					now - rule->pendingSince >= (time_t)rule->needSeconds)
+				{
+					rule->active = true;
+					rule->pendingCount = 0;
+					fire(rule, true, value);
+				}
+			}
+			else
+			{
+				rule->pendingCount = 0;
+			}
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Parses one rule and sets up its action.  Returns false after printing an
+// error if the rule can not be used.
+
+static bool parseRule(char *line, int lineNumber, int channels, const char **names, Rule *rule)
+{
+	memset(rule, 0, sizeof(*rule));
+	rule->gpiofd = -1;
+	rule->needSamples = 1;
+
+	// Keep a copy of the rule for messages and to hold the command line.
+
+	snprintf(rule->text, sizeof(rule->text), "%s", line);
+	rule->text[strcspn(rule->text, "\r\n")] = '\0';
+
+	char work[MAX_LINE];
+	snprintf(work, sizeof(work), "%s", rule->text);
+	char *save;
+	char *token = strtok_r(work, " \t", &save);
+
+	rule->channel = -1;
+	for (int ch = 0; ch < channels; ch++)
+	{
+		if (strcasecmp(token, names[ch]) == 0)
+		{
+			rule->channel = ch;
+		}
+	}
+	if (rule->channel < 0)
+	{
+		printf("Alarm rule line %d: unknown channel %s\n", lineNumber, token);
+		return false;
+	}
+
+	token = strtok_r(NULL, " \t", &save);
+	if (token == NULL || (strcmp(token, "<") != 0 && strcmp(token, ">") != 0))
+	{
+		printf("Alarm rule line %d: expected < or >\n", lineNumber);
+		return false;
+	}
+	rule->below = token[0] == '<';
+
+	char *end;
+	token = strtok_r(NULL, " \t", &save);
+	if (token == NULL || (rule->threshold = strtof(token, &end), end == token))
+	{
+		printf("Alarm rule line %d: expected a threshold\n", lineNumber);
+		return false;
+	}
+	rule->clear = rule->threshold;
+
+	// Now the optional parts, up to the action.
+
+	while ((token = strtok_r(NULL, " \t", &save)) != NULL)
+	{
+		if (strcmp(token, "for") == 0)
+		{
+			char *count = strtok_r(NULL, " \t", &save);
+			char *unit = strtok_r(NULL, " \t", &save);
+			if (count == NULL || unit == NULL || atoi(count) <= 0)
+			{
+				printf("Alarm rule line %d: expected for <n> samples|sec|min|hour\n", lineNumber);
+				return false;
+			}
+
+			unsigned n = atoi(count);
+			if (strncmp(unit, "sample", 6) == 0)
+			{
+				rule->needSamples = n;
+			}
+			else if (strncmp(unit, "sec", 3) == 0 || strcmp(unit, "s") == 0)
+			{
+				rule->needSeconds = n;
+			}
+			else if (strncmp(unit, "min", 3) == 0)
+			{
+				rule->needSeconds = n * 60;
+			}
+			else if (strncmp(unit, "hour", 4) == 0)
+			{
+				rule->needSeconds = n * 60 * 60;
+			}
+			else
+			{
+				printf("Alarm rule line %d: unknown unit %s\n", lineNumber, unit);
+				return false;
+			}
+		}
+		else if (strcmp(token, "clear") == 0)
+		{
+			token = strtok_r(NULL, " \t", &save);
+			if (token == NULL || (rule->clear = strtof(token, &end), end == token))
+			{
+				printf("Alarm rule line %d: expected a clear level\n", lineNumber);
+				return false;
+			}
+
+			// On the wrong side of the threshold the alarm would clear
+			// while it still holds, and flap.
+
+			if (rule->below ? rule->clear < rule->threshold : rule->clear > rule->threshold)
+			{
+				printf("Alarm rule line %d: clear level has to be %s the threshold\n",
+					lineNumber, rule->below ? "at or above" : "at or below");
+				return false;
+			}
+		}
+		else if (strcmp(token, "exec") == 0)
+		{
+			// The rest of the line is the command.
+
+			char *command = strtok_r(NULL, "", &save);
+			if (command == NULL)
+			{
+				printf("Alarm rule line %d: exec needs a command\n", lineNumber);
+				return false;
+			}
+			rule->action = ACTION_EXEC;
+			rule->command = rule->text + (command - work);
+
+			// Nobody waits for the commands, so let the kernel reap them.
+			// fire() puts it back for the commands themselves.
+
+			signal(SIGCHLD, SIG_IGN);
+			return true;
+		}
+		else if (strcmp(token, "gpio") == 0)
+		{
+			char *pin = strtok_r(NULL, " \t", &save);
+			char *value = strtok_r(NULL, " \t", &save);
+			if (pin == NULL || value == NULL)
+			{
+				printf("Alarm rule line %d: expected gpio <line> <0|1>\n", lineNumber);
+				return false;
+			}
+			rule->action = ACTION_GPIO;
+			rule->gpioValue = atoi(value) ? 1 : 0;
+			rule->gpiofd = gpioOpenOutput(DEFAULT_GPIO_CHIP, atoi(pin), !rule->gpioValue);
+			return rule->gpiofd >= 0;
+		}
+		else if (strcmp(token, "socket") == 0)
+		{
+			char *path = strtok_r(NULL, " \t\r\n", &save);
+			if (path == NULL || strlen(path) >= sizeof(rule->addr.sun_path))
+			{
+				printf("Alarm rule line %d: expected socket <path>\n", lineNumber);
+				return false;
+			}
+			rule->action = ACTION_SOCKET;
+			rule->addr.sun_family = AF_UNIX;
+			strcpy(rule->addr.sun_path, path);
+
+			if (alarmSocket < 0 && (alarmSocket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+			{
+				printf("Error creating alarm socket: %s\n", strerror(errno));
+				return false;
+			}
+			return true;
+		}
+		else if (strcmp(token, "capture") == 0)
+		{
+			char *tag = strtok_r(NULL, " \t\r\n", &save);
+			rule->action = ACTION_CAPTURE;
+			snprintf(rule->tag, sizeof(rule->tag), "%s", tag != NULL ? tag : names[rule->channel]);
+			return true;
+		}
+		else
+		{
+			printf("Alarm rule line %d: don't understand %s\n", lineNumber, token);
+			return false;
+		}
+	}
+
+	printf("Alarm rule line %d: no action given\n", lineNumber);
+	return false;
+}
+
+
+
+
+//****************************************************************************
+// Carries out the action of a rule when it fires (alarm true) or clears.
+// None of these wait: commands are spawned and left to run, the pin write is
+// a single ioctl and the socket send never blocks.
+
+static void fire(Rule *rule, bool alarm, float value)
+{
+	const char *state = alarm ? "ALARM" : "CLEAR";
+	const char *channel = channelNames[rule->channel];
+
+	printf("%s %s %1.2f: %s\n", state, channel, value, rule->text);
+
+	switch (rule->action)
+	{
+		case ACTION_EXEC:
+		{
+			char stateVar[32];
+			char channelVar[64];
+			char valueVar[32];
+			snprintf(stateVar, sizeof(stateVar), "ALARM_STATE=%s", state);
+			snprintf(channelVar, sizeof(channelVar), "ALARM_CHANNEL=%s", channel);
+			snprintf(valueVar, sizeof(valueVar), "ALARM_VALUE=%1.2f", value);
+
+			// Pass along our environment with the alarm variables added.
+
+			char *env[128];
+			int n = 0;
+			env[n++] = stateVar;
+			env[n++] = channelVar;
+			env[n++] = valueVar;
+			for (char **e = environ; *e != NULL && n < 127; e++)
+			{
+				env[n++] = *e;
+			}
+			env[n] = NULL;
+
+			// The command gets SIGCHLD back to the default, or anything it
+			// runs and waits for would get ECHILD, and none of the signals
+			// Monitor blocks for the event loop.
+
+			sigset_t none;
+			sigset_t child;
+			sigemptyset(&none);
+			sigemptyset(&child);
+			sigaddset(&child, SIGCHLD);
+
+			posix_spawnattr_t attr;
+			posix_spawnattr_init(&attr);
+			posix_spawnattr_setsigdefault(&attr, &child);
+			posix_spawnattr_setsigmask(&attr, &none);
+			posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+			char *argv[] = { (char *)"sh", (char *)"-c", rule->command, NULL };
+			pid_t pid;
+			int err = posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, env);
+			posix_spawnattr_destroy(&attr);
+			if (err != 0)
+			{
+				printf("Error running alarm command: %s\n", strerror(err));
+			}
+			break;
+		}
+
+		case ACTION_GPIO:
+			gpioWrite(rule->gpiofd, alarm ? rule->gpioValue : !rule->gpioValue);
+			break;
+
+		case ACTION_SOCKET:
+		{
+			char message[MAX_LINE + 64];
+			int len = snprintf(message, sizeof(message), "%s %s %1.2f %s\n", state, channel, value, rule->text);
+			if (len >= (int)sizeof(message))
+			{
+				len = sizeof(message) - 1;
+			}
+			if (sendto(alarmSocket, message, len, MSG_DONTWAIT,
+				(struct sockaddr *)&rule->addr, sizeof(rule->addr)) < 0)
+			{
+				printf("Error sending alarm to %s: %s\n", rule->addr.sun_path, strerror(errno));
+			}
+			break;
+		}
+
+		case ACTION_CAPTURE:
+			if (alarm)
+			{
+				burstTrigger(rule->tag);
+			}
+			break;
+	}
+}
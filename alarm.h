@@ -0,0 +1,45 @@
+//****************************************************************************
+// Threshold alarms.  Rules are read from a config file once at startup and
+// then checked against every sample as soon as it has been taken, so Monitor
+// can react to a pH crash right away instead of waiting for a cron job to
+// read the report.
+//
+// One rule per line, blank lines and lines starting with # are ignored:
+//
+//    <channel> < or > <value> [for <n> samples|sec|min|hour] [clear <value>] <action>
+//
+// The channel is one of the report column names (pH, Humidity...).  The
+// condition must hold for the given number of samples or length of time
+// before the alarm fires.  Once fired the alarm stays on until the value
+// goes back past the clear level (hysteresis); by default that is the
+// threshold itself.  The action is one of:
+//
+//    exec <command line>     run with ALARM_STATE=ALARM or CLEAR, ALARM_CHANNEL
+//                            and ALARM_VALUE set in the environment
+//    gpio <line> <0|1>       drive a pin to the value on alarm, the opposite
+//                            on clear
+//    socket <path>           send "ALARM <channel> <value> <rule>" (or CLEAR)
+//                            as a datagram to a Unix socket
+//    capture [<tag>]         save a burst capture around this moment (see
+//                            burst.h), tagged with the channel name if no
+//                            tag is given; nothing happens on clear
+//
+// In burst mode the capture rules are also checked against every burst
+// sample, so they can catch a spike between reports.  Count those with
+// "for <n> sec" rather than samples, since there are many more of them.
+// For example:
+//
+//    pH < 5.5 for 3 samples clear 5.7 exec /home/pi/bin/ph-low.sh
+//    Humidity > 85 for 10 min clear 80 gpio 17 1
+//    Humidity > 90 capture humidity-spike
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include "sample.h"
+
+bool alarmInit(const char *configFilename, int channels, const char **names);
+void alarmSample(const Sample *sample);
+void alarmBurstSample(const Sample *sample);
+
+#endif	// ALARM_H
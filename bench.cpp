@@ -0,0 +1,1001 @@
+//****************************************************************************
+// Microbenchmarks for the pieces of Monitor that run every cycle: the raw
+// to engineering unit conversions, a pH read, a whole poll cycle, burst
+// mode's back to back polls, encoding a sample as a CSV row or a binary
+// record, the deadband filter, writing rows out under different flush and
+// fsync policies, appending records to a memory mapped segment, and
+// parsing a report back in (a row at a time, and all at once into
+// columns).
+//
+// The sensors are simulated (see i2csim.h) so this runs anywhere.  The
+// output is CSV on stdout, one line per benchmark, so results can be saved
+// and compared from one commit to the next:
+//
+//    benchmark,iterations,ns_per_op,ops_per_sec,mb_per_sec
+//
+// mb_per_sec is 0 where bytes do not mean anything.  Anything else (notes,
+// progress) goes to stderr.  The burst benchmark is a check as well: if
+// the polls don't each go back to the event loop, it says so and bench
+// exits with 1.  So are the deadband one, if a failed channel is held
+// back, and the DS18B20 one, which runs the w1 driver against a made up
+// sysfs tree and checks what a good probe, one that reads the 85C power on
+// value and one that has gone missing each come out as.
+//
+// Usage: bench [-d dir] [report.csv ...]
+//
+// Files written by the writer benchmarks go in dir (/tmp by default); pick
+// one on the SD card to see what the real thing does.  Any report files
+// given are parsed as well as the one the benchmark generates.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "sensors.h"
+#include "record.h"
+#include "segment.h"
+#include "poller.h"
+#include "reactor.h"
+#include "reportreader.h"
+#include "reportload.h"
+#include "deadband.h"
+#include "i2csim.h"
+
+#define DEFAULT_BENCH_DIR	"/tmp"
+
+#define CONVERT_ITERATIONS	2000000
+#define ENCODE_ITERATIONS	200000
+#define DEADBAND_ITERATIONS	200000
+#define POLL_ITERATIONS		20
+#define BURST_ROUNDS		20000
+#define PH_OLD_ITERATIONS	10
+#define PH_ITERATIONS		2000
+#define W1_ITERATIONS		20000
+
+// The old pH read: a throwaway read, then this long before the real one.
+
+#define PH_OLD_SETTLE_US	(100 * 1000)
+#define GENERATED_ROWS		50000
+#define MEMORY_SIZE		(1 << 20)
+
+// The ways a row can be written.  Monitor itself leaves flushing to stdio.
+
+enum
+{
+	WRITE_BUFFERED,		// stdio buffering only
+	WRITE_FLUSH,		// fflush after every row
+	WRITE_FSYNC,		// fflush and fsync after every row
+	WRITE_FSYNC_BATCH,	// fflush and fsync every FSYNC_BATCH rows
+	WRITE_REOPEN,		// fopen, write, fclose for every row
+	NUM_WRITE_POLICIES
+};
+
+#define FSYNC_BATCH	64
+
+// Segment appends, with the msync cadence each time
+
+static const struct
+{
+	const char *name;
+	int records;
+	int sync;
+} segmentPolicies[] =
+{
+	{ "write_segment", 200000, 0 },
+	{ "write_segment_sync_64", 6400, 64 },
+	{ "write_segment_sync_1", 200, 1 },
+};
+
+static const struct
+{
+	const char *name;
+	int rows;
+} writePolicies[NUM_WRITE_POLICIES] =
+{
+	{ "write_buffered", 200000 },
+	{ "write_fflush", 50000 },
+	{ "write_fsync", 200 },
+	{ "write_fsync_64", 6400 },
+	{ "write_reopen", 5000 },
+};
+
+static volatile float sink;		// keeps results from being optimized away
+static int failures = 0;
+
+// Burst mode's polls, and how often the event loop got to an fd in between
+
+static SensorPoll burstPoll;
+static SensorSlot burstSlots[NUM_SENSORS];
+static long burstRounds;
+static long burstServed;
+static double burstStart;
+
+static double now(void);
+static void report(const char *name, long iterations, double seconds, double bytes);
+static void makeSample(Sample *sample, int i);
+static void benchConvert(void);
+static void benchPh(void);
+static void benchPoll(void);
+static void benchBurst(void);
+static void benchW1(const char *dir);
+static bool w1File(const char *root, const char *name, const char *text);
+static bool w1Expect(const char *what, const Sample *sample, int ch, float value, int status);
+static void burstDone(SensorPoll *poll);
+static void burstIdle(void);
+static void burstOther(void *arg, unsigned events);
+static void benchEncode(void);
+static void benchDeadband(void);
+static void benchWrite(const char *dir);
+static void benchSegment(const char *dir);
+static void removeSegments(const char *dir);
+static void benchParse(const char *filename, const char *name);
+static void benchLoad(const char *filename, const char *name);
+
+
+
+
+//****************************************************************************
+
+int main(int argc, char *argv[])
+{
+	const char *dir = DEFAULT_BENCH_DIR;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				dir = optarg;
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-d dir] [report.csv ...]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	printf("benchmark,iterations,ns_per_op,ops_per_sec,mb_per_sec\n");
+
+	benchConvert();
+	benchPh();
+	benchPoll();
+	benchBurst();
+	benchW1(dir);
+	benchEncode();
+	benchDeadband();
+	benchWrite(dir);
+	benchSegment(dir);
+
+	// Parse a generated report, so there is always a number to compare,
+	// then any real ones given on the command line.
+
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s/bench_report.csv", dir);
+
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error creating %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	writeHeaders(out);
+	for (int i = 0; i < GENERATED_ROWS; i++)
+	{
+		Sample sample;
+		makeSample(&sample, i);
+		writeRow(out, &sample);
+	}
+	fclose(out);
+
+	benchParse(filename, "parse_generated");
+	benchLoad(filename, "load_generated");
+	unlink(filename);
+
+	for (int i = optind; i < argc; i++)
+	{
+		benchParse(argv[i], "parse_file");
+		benchLoad(argv[i], "load_file");
+	}
+
+	return failures > 0 ? 1 : 0;
+}
+
+
+
+
+//****************************************************************************
+// Seconds on the monotonic clock.
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+//****************************************************************************
+// Prints one result line.
+
+static void report(const char *name, long iterations, double seconds, double bytes)
+{
+	if (seconds <= 0)
+	{
+		seconds = 1e-9;
+	}
+
+	printf("%s,%ld,%.1f,%.0f,%.2f\n", name, iterations,
+		seconds * 1e9 / iterations,
+		iterations / seconds,
+		bytes / seconds / 1e6);
+	fflush(stdout);
+}
+
+
+
+
+//****************************************************************************
+// Makes up a complete sample, varied a little by i.
+
+static void makeSample(Sample *sample, int i)
+{
+	memset(sample, 0, sizeof(*sample));
+	sample->when.tv_sec = 1700000000 + i * 60;
+	sample->channels = NUM_CHANNELS;
+
+	sample->value[CH_PCT_C] = 22.5 + (i % 10) * 0.1;
+	sample->value[CH_PCT_F] = 72.5 + (i % 10) * 0.2;
+	sample->value[CH_PH] = 6.2 + (i % 5) * 0.1;
+	sample->value[CH_SHT_C] = 25.0 + (i % 7) * 0.01;
+	sample->value[CH_SHT_F] = 77.0 + (i % 7) * 0.02;
+	sample->value[CH_HUMIDITY] = 60.0 + (i % 11) * 0.1;
+	sample->value[CH_PROBE1_C] = 21.5 + (i % 9) * 0.0625;
+	sample->value[CH_PROBE2_C] = 22.0 + (i % 9) * 0.0625;
+
+	for (int ch = 0; ch < NUM_CHANNELS; ch++)
+	{
+		sample->valid[ch] = true;
+		sample->status[ch] = CHANNEL_OK;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Raw to engineering unit conversion for each sensor, CRC check included
+// for the SHT30 since it is done on every read.
+
+static void benchConvert(void)
+{
+	unsigned char raw[6];
+	float a, b, c;
+	double start;
+
+	start = now();
+	for (int i = 0; i < CONVERT_ITERATIONS; i++)
+	{
+		raw[0] = 22;
+		raw[1] = i & 0xFF;
+		pct2075Convert(raw, &a, &b);
+		sink = a + b;
+	}
+	report("convert_pct2075", CONVERT_ITERATIONS, now() - start, 0);
+
+	start = now();
+	for (int i = 0; i < CONVERT_ITERATIONS; i++)
+	{
+		sink = phConvert(i & 0xFF);
+	}
+	report("convert_ph", CONVERT_ITERATIONS, now() - start, 0);
+
+	raw[0] = 0x66;
+	raw[3] = 0x99;
+	raw[4] = 0x99;
+	raw[5] = sht30CRC(raw + 3, 2);
+
+	start = now();
+	for (int i = 0; i < CONVERT_ITERATIONS; i++)
+	{
+		raw[1] = i & 0xFF;
+		raw[2] = sht30CRC(raw, 2);
+		if (sht30CRC(raw, 2) == raw[2] && sht30CRC(raw + 3, 2) == raw[5])
+		{
+			sht30Convert(raw, &a, &b, &c);
+			sink = a + b + c;
+		}
+	}
+	report("convert_sht30", CONVERT_ITERATIONS, now() - start, 0);
+}
+
+
+
+
+//****************************************************************************
+// A pH read the way it used to be done, a throwaway read then a 100ms wait
+// before the one that counts, against the driver's single read that throws
+// out the stale conversion itself.  Both on the simulated bus, with the wait
+// really happening.  How steady the pH comes out each way goes to stderr,
+// as the standard deviation over the reads.
+
+static void benchPh(void)
+{
+	static const unsigned char command[2] = { 0x00, 0x00 };
+	SensorReading reading;
+	double sum = 0, squares = 0;
+
+	i2cSimReset();
+	double start = now();
+	for (int i = 0; i < PH_OLD_ITERATIONS; i++)
+	{
+		unsigned char data[4];
+		driverTransfer(0, ADC_ADDR, command, 2, data, 4, &reading);
+		usleep(PH_OLD_SETTLE_US);
+		driverTransfer(0, ADC_ADDR, command, 2, data, 4, &reading);
+
+		double ph = phConvert(data[0]);
+		sum += ph;
+		squares += ph * ph;
+	}
+	report("ph_read_old_wall", PH_OLD_ITERATIONS, now() - start, 0);
+	report("ph_read_old_bus", PH_OLD_ITERATIONS, i2cSimBusNs() / 1e9, 0);
+
+	double mean = sum / PH_OLD_ITERATIONS;
+	fprintf(stderr, "ph read old: standard deviation %.4f pH\n",
+		sqrt(fmax(squares / PH_OLD_ITERATIONS - mean * mean, 0)));
+
+	sum = squares = 0;
+	i2cSimReset();
+	start = now();
+	for (int i = 0; i < PH_ITERATIONS; i++)
+	{
+		float ph;
+		driverRead(0, &phDriver, &reading);
+		phDriver.decode(&reading.raw, &ph);
+		sum += ph;
+		squares += ph * ph;
+	}
+	report("ph_read_wall", PH_ITERATIONS, now() - start, 0);
+	report("ph_read_bus", PH_ITERATIONS, i2cSimBusNs() / 1e9, 0);
+
+	mean = sum / PH_ITERATIONS;
+	fprintf(stderr, "ph read: standard deviation %.4f pH, settle %d, %d samples\n",
+		sqrt(fmax(squares / PH_ITERATIONS - mean * mean, 0)), phSettle, PH_SAMPLES);
+}
+
+
+
+
+//****************************************************************************
+// A full poll cycle through the real poll code on the simulated bus.  The
+// wall clock time is mostly the SHT30's 15ms measurement, which really
+// does happen.  The bus time is what the transfers would add on a real
+// 100 kHz bus, reported as its own line, and the number of system calls
+// a cycle takes goes to stderr.
+
+static void benchPoll(void)
+{
+	bool due[NUM_SENSORS];
+	SensorSlot slots[NUM_SENSORS];
+	for (int s = 0; s < NUM_SENSORS; s++)
+	{
+		due[s] = BoardSensors::I2C_OF[s];	// the simulated bus is all I2C
+		slots[s].fd = 0;
+		slots[s].addr = BoardSensors::ADDRS[s];
+		slots[s].muxAddr = 0;
+		slots[s].muxPort = 0;
+	}
+
+	i2cSimReset();
+
+	double start = now();
+	for (int i = 0; i < POLL_ITERATIONS; i++)
+	{
+		Sample sample;
+		SensorReading readings[NUM_SENSORS];
+		memset(&sample, 0, sizeof(sample));
+		sample.channels = NUM_CHANNELS;
+		pollSensors(slots, &sample, due, readings);
+		sink = sample.value[CH_PH];
+	}
+	report("poll_cycle_wall", POLL_ITERATIONS, now() - start, 0);
+	report("poll_cycle_bus", POLL_ITERATIONS, i2cSimBusNs() / 1e9, 0);
+	fprintf(stderr, "poll cycle: %.1f system calls\n", (double)i2cSimCalls() / POLL_ITERATIONS);
+}
+
+
+
+
+//****************************************************************************
+// Burst mode with only sensors that have nothing to wait for: each poll
+// finishes inside pollerStart(), and the idle callback starts the next.
+// That has to go round the event loop every time, or it recurses until
+// the stack runs out, and nothing else gets a look in.  It runs in a child
+// since the event loop never returns; the child counts how often a pipe
+// that is always readable got served while the polls went on.
+
+static void benchBurst(void)
+{
+	fflush(stdout);
+
+	pid_t child = fork();
+	if (child < 0)
+	{
+		fprintf(stderr, "Error starting the burst benchmark: %s\n", strerror(errno));
+		failures++;
+		return;
+	}
+
+	if (child == 0)
+	{
+		for (int s = 0; s < NUM_SENSORS; s++)
+		{
+			burstPoll.due[s] = BoardSensors::I2C_OF[s] && BoardSensors::READY_US_OF[s] == 0;
+			burstSlots[s].fd = 0;
+			burstSlots[s].addr = BoardSensors::ADDRS[s];
+			burstSlots[s].muxAddr = 0;
+			burstSlots[s].muxPort = 0;
+		}
+		burstPoll.done = burstDone;
+
+		int other[2];
+		if (!reactorInit() || pipe(other) < 0 || write(other[1], "x", 1) != 1 ||
+			!reactorWatch(other[0], EPOLLIN, burstOther, NULL) || !pollerIdle(burstIdle))
+		{
+			exit(1);
+		}
+
+		i2cSimReset();
+		burstStart = now();
+		pollerStart(burstSlots, &burstPoll);
+		reactorRun();
+	}
+
+	int status;
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		if (WIFSIGNALED(status))
+		{
+			fprintf(stderr, "burst: FAILED, died with signal %d\n", WTERMSIG(status));
+		}
+		else
+		{
+			fprintf(stderr, "burst: FAILED, the event loop never got a look in\n");
+		}
+		failures++;
+	}
+}
+
+
+
+
+//****************************************************************************
+// The DS18B20s, against a pretend w1 sysfs tree in dir: fetching two good
+// probes' temperatures, then a poll with a good probe and one reading the
+// power on value, then one with the second probe gone.
+
+static void benchW1(const char *dir)
+{
+	char root[W1_PATH_SIZE];
+	snprintf(root, sizeof(root), "%s/bench_w1_XXXXXX", dir);
+	if (mkdtemp(root) == NULL)
+	{
+		fprintf(stderr, "Error making %s: %s\n", root, strerror(errno));
+		failures++;
+		return;
+	}
+
+	char saved[W1_PATH_SIZE];
+	snprintf(saved, sizeof(saved), "%s", w1Root);
+	snprintf(w1Root, sizeof(w1Root), "%s", root);
+
+	if (!w1File(root, "w1_bus_master1", "") ||
+		!w1File(root, "28-000000000001", "21500\n") ||
+		!w1File(root, "28-000000000002", "22062\n"))
+	{
+		failures++;
+		return;
+	}
+
+	SensorReading reading;
+	Ds18b20Raw raw;
+	double start = now();
+	for (int i = 0; i < W1_ITERATIONS; i++)
+	{
+		w1Fetch(&raw, &reading);
+	}
+	report("w1_fetch", W1_ITERATIONS, now() - start, 0);
+	sink = raw.milliC[0];
+
+	bool due[NUM_SENSORS];
+	SensorSlot slots[NUM_SENSORS];
+	SensorReading readings[NUM_SENSORS];
+	Sample sample;
+
+	memset(due, 0, sizeof(due));
+	memset(slots, 0, sizeof(slots));
+	due[SENSOR_DS18B20] = true;
+
+	w1File(root, "28-000000000002", "85000\n");
+	memset(&sample, 0, sizeof(sample));
+	sample.channels = NUM_CHANNELS;
+	pollSensors(slots, &sample, due, readings);
+
+	char path[W1_PATH_SIZE + 64];
+	char text[16] = "";
+	snprintf(path, sizeof(path), "%s/w1_bus_master1/therm_bulk_read", root);
+	FILE *in = fopen(path, "r");
+	if (in == NULL || fgets(text, sizeof(text), in) == NULL || strcmp(text, "trigger\n") != 0)
+	{
+		fprintf(stderr, "w1: FAILED, the conversion was not triggered\n");
+		failures++;
+	}
+	if (in != NULL)
+	{
+		fclose(in);
+	}
+
+	failures += !w1Expect("a good probe", &sample, CH_PROBE1_C, 21.5, CHANNEL_OK);
+	failures += !w1Expect("a power on value", &sample, CH_PROBE2_C, NAN, CHANNEL_FAILED);
+
+	snprintf(path, sizeof(path), "%s/28-000000000002/temperature", root);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/28-000000000002", root);
+	rmdir(path);
+
+	memset(&sample, 0, sizeof(sample));
+	sample.channels = NUM_CHANNELS;
+	pollSensors(slots, &sample, due, readings);
+
+	failures += !w1Expect("a good probe", &sample, CH_PROBE1_C, 21.5, CHANNEL_OK);
+	failures += !w1Expect("a missing probe", &sample, CH_PROBE2_C, NAN, CHANNEL_FAILED);
+
+	static const char *const made[] =
+	{
+		"w1_bus_master1/therm_bulk_read", "w1_bus_master1", "28-000000000001/temperature", "28-000000000001"
+	};
+	for (const char *name : made)
+	{
+		snprintf(path, sizeof(path), "%s/%s", root, name);
+		remove(path);
+	}
+	rmdir(root);
+	snprintf(w1Root, sizeof(w1Root), "%s", saved);
+}
+
+
+
+
+//****************************************************************************
+// Makes one file of the pretend w1 tree: a bus master's therm_bulk_read
+// or a probe's temperature file, holding text.  Returns false after
+// printing an error if it can't.
+
+static bool w1File(const char *root, const char *name, const char *text)
+{
+	bool master = strncmp(name, "w1_bus_master", 13) == 0;
+	char path[W1_PATH_SIZE + 64];
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "Error making %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s/%s", root, name, master ? "therm_bulk_read" : "temperature");
+	FILE *out = fopen(path, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error creating %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	fputs(text, out);
+	fclose(out);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Whether a channel came out of a DS18B20 poll as it should have; says so
+// if not.  A NaN value means the channel should have no value.
+
+static bool w1Expect(const char *what, const Sample *sample, int ch, float value, int status)
+{
+	bool good = sample->status[ch] == status &&
+		(isnan(value) ? !sample->valid[ch] : sample->valid[ch] && fabsf(sample->value[ch] - value) < 0.001);
+
+	if (!good)
+	{
+		fprintf(stderr, "w1: FAILED, %s came out as %g with status %d\n", what,
+			sample->value[ch], sample->status[ch]);
+	}
+	return good;
+}
+
+
+
+
+//****************************************************************************
+// One of the burst benchmark's polls is done.
+
+static void burstDone(SensorPoll *poll)
+{
+	sink = poll->sample.value[CH_PH];
+}
+
+
+
+
+//****************************************************************************
+// The buses are free: starts the next burst poll, or when there have been
+// enough, reports and ends the child.
+
+static void burstIdle(void)
+{
+	if (++burstRounds < BURST_ROUNDS)
+	{
+		pollerStart(burstSlots, &burstPoll);
+		return;
+	}
+
+	report("burst_round", burstRounds, now() - burstStart, 0);
+	fprintf(stderr, "burst: an fd was served %.0f%% of the rounds\n", 100.0 * burstServed / burstRounds);
+	fflush(stdout);
+	exit(burstServed > 0 ? 0 : 1);
+}
+
+
+
+
+//****************************************************************************
+// The always readable pipe, left unread so it comes up every time round.
+
+static void burstOther(void *arg, unsigned events)
+{
+	burstServed++;
+}
+
+
+
+
+//****************************************************************************
+// Turning a sample into a CSV row versus a binary record.  The rows go into
+// a memory buffer so no I/O is involved.
+
+static void benchEncode(void)
+{
+	static char memory[MEMORY_SIZE];
+	Sample sample;
+	makeSample(&sample, 0);
+
+	FILE *out = fmemopen(memory, sizeof(memory), "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Error opening memory stream: %s\n", strerror(errno));
+		return;
+	}
+
+	double bytes = 0;
+	double start = now();
+	for (int i = 0; i < ENCODE_ITERATIONS; i++)
+	{
+		sample.when.tv_sec += 60;
+		writeRow(out, &sample);
+
+		// Start over before the buffer fills up
+
+		long used = ftell(out);
+		if (used > MEMORY_SIZE / 2)
+		{
+			bytes += used;
+			rewind(out);
+		}
+	}
+	bytes += ftell(out);
+	report("encode_csv", ENCODE_ITERATIONS, now() - start, bytes);
+	fclose(out);
+
+	static Record records[1024];
+
+	start = now();
+	for (int i = 0; i < ENCODE_ITERATIONS; i++)
+	{
+		sample.when.tv_sec += 60;
+		recordEncode(&sample, &records[i % 1024]);
+	}
+	report("encode_binary", ENCODE_ITERATIONS, now() - start,
+		(double)ENCODE_ITERATIONS * sizeof(Record));
+	sink = records[0].value[0];
+}
+
+
+
+
+//****************************************************************************
+// The deadband filter on samples that mostly stay inside it.  Then a check
+// that a failure gets through it: a row whose only news is a failed channel
+// is still written, and so is that channel's first reading after, even at
+// the old value.
+
+static void benchDeadband(void)
+{
+	float deadband[NUM_CHANNELS];
+	for (int ch = 0; ch < NUM_CHANNELS; ch++)
+	{
+		deadband[ch] = 0.5;
+	}
+	deadbandInit(NUM_CHANNELS, deadband, 3600);
+
+	Sample sample;
+	int left = 0;
+	double start = now();
+	for (int i = 0; i < DEADBAND_ITERATIONS; i++)
+	{
+		makeSample(&sample, i);
+		left += deadbandFilter(&sample);
+	}
+	report("deadband", DEADBAND_ITERATIONS, now() - start, 0);
+	sink = left;
+
+	deadbandInit(NUM_CHANNELS, deadband, 3600);
+	makeSample(&sample, 0);
+	deadbandFilter(&sample);
+
+	makeSample(&sample, 0);
+	sample.when.tv_sec += 60;
+	sample.valid[CH_HUMIDITY] = false;
+	sample.status[CH_HUMIDITY] = CHANNEL_BUS;
+	sample.value[CH_HUMIDITY] = NAN;
+	if (deadbandFilter(&sample) != 1 || sample.status[CH_HUMIDITY] != CHANNEL_BUS)
+	{
+		fprintf(stderr, "deadband: FAILED, a failed channel was held back\n");
+		failures++;
+	}
+
+	makeSample(&sample, 0);
+	sample.when.tv_sec += 120;
+	if (deadbandFilter(&sample) != 1 || !sample.valid[CH_HUMIDITY])
+	{
+		fprintf(stderr, "deadband: FAILED, the reading after a failure was held back\n");
+		failures++;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Writing rows to a real file under each flush policy.
+
+static void benchWrite(const char *dir)
+{
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s/bench_write.csv", dir);
+
+	for (int policy = 0; policy < NUM_WRITE_POLICIES; policy++)
+	{
+		int rows = writePolicies[policy].rows;
+
+		unlink(filename);
+		FILE *out = fopen(filename, "a");
+		if (out == NULL)
+		{
+			fprintf(stderr, "Error creating %s: %s\n", filename, strerror(errno));
+			return;
+		}
+
+		Sample sample;
+		makeSample(&sample, 0);
+
+		double start = now();
+		for (int i = 0; i < rows; i++)
+		{
+			sample.when.tv_sec += 60;
+
+			if (policy == WRITE_REOPEN)
+			{
+				out = fopen(filename, "a");
+				if (out == NULL)
+				{
+					fprintf(stderr, "Error opening %s: %s\n", filename, strerror(errno));
+					return;
+				}
+			}
+
+			writeRow(out, &sample);
+
+			switch (policy)
+			{
+				case WRITE_FLUSH:
+					fflush(out);
+					break;
+
+				case WRITE_FSYNC:
+					fflush(out);
+					fsync(fileno(out));
+					break;
+
+				case WRITE_FSYNC_BATCH:
+					if ((i + 1) % FSYNC_BATCH == 0)
+					{
+						fflush(out);
+						fsync(fileno(out));
+					}
+					break;
+
+				case WRITE_REOPEN:
+					fclose(out);
+					break;
+			}
+		}
+
+		// Buffered data still has to get to the file to be counted
+
+		if (policy != WRITE_REOPEN)
+		{
+			fclose(out);
+		}
+		double seconds = now() - start;
+
+		struct stat info;
+		double bytes = stat(filename, &info) == 0 ? info.st_size : 0;
+		report(writePolicies[policy].name, rows, seconds, bytes);
+	}
+
+	unlink(filename);
+}
+
+
+
+
+//****************************************************************************
+// Appending records to a memory mapped segment, the whole of it allocated
+// up front, under each msync cadence.  The segments go in a directory of
+// their own under dir.
+
+static void benchSegment(const char *dir)
+{
+	char segmentDir[256];
+	snprintf(segmentDir, sizeof(segmentDir), "%s/bench_segments", dir);
+
+	for (unsigned policy = 0; policy < sizeof(segmentPolicies) / sizeof(segmentPolicies[0]); policy++)
+	{
+		int records = segmentPolicies[policy].records;
+
+		removeSegments(segmentDir);
+		if (!segmentInit(segmentDir, records, segmentPolicies[policy].sync))
+		{
+			return;
+		}
+
+		Sample sample;
+		makeSample(&sample, 0);
+
+		double start = now();
+		for (int i = 0; i < records; i++)
+		{
+			sample.when.tv_sec += 60;
+			segmentSample(&sample);
+		}
+		double seconds = now() - start;
+
+		segmentFinish();
+		report(segmentPolicies[policy].name, records, seconds, (double)records * sizeof(Record));
+	}
+
+	removeSegments(segmentDir);
+	rmdir(segmentDir);
+}
+
+
+
+
+//****************************************************************************
+// Deletes the segments benchSegment() left in a directory.
+
+static void removeSegments(const char *dir)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL)
+	{
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL)
+	{
+		if (strstr(entry->d_name, SEGMENT_SUFFIX) != NULL)
+		{
+			char path[512];
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+}
+
+
+
+
+//****************************************************************************
+// Reads a report back in with the report reader.
+
+static void benchParse(const char *filename, const char *name)
+{
+	ReportReader reader;
+	ReportRow row;
+
+	struct stat info;
+	if (stat(filename, &info) < 0)
+	{
+		fprintf(stderr, "Error reading %s: %s\n", filename, strerror(errno));
+		return;
+	}
+
+	if (!reportOpen(&reader, filename))
+	{
+		return;
+	}
+
+	long rows = 0;
+	double start = now();
+	while (reportNext(&reader, &row))
+	{
+		rows++;
+	}
+	double seconds = now() - start;
+	reportClose(&reader);
+
+	if (rows > 0)
+	{
+		report(name, rows, seconds, info.st_size);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Loads a whole report into columns with the mapped loader.
+
+static void benchLoad(const char *filename, const char *name)
+{
+	ReportColumns columns;
+
+	struct stat info;
+	if (stat(filename, &info) < 0)
+	{
+		fprintf(stderr, "Error reading %s: %s\n", filename, strerror(errno));
+		return;
+	}
+
+	double start = now();
+	if (!reportLoad(filename, &columns))
+	{
+		return;
+	}
+	double seconds = now() - start;
+
+	if (columns.rows > 0)
+	{
+		report(name, columns.rows, seconds, info.st_size);
+	}
+	sink = columns.rows > 0 ? columns.value[0][0] : 0;
+	reportFree(&columns);
+}
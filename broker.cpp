@@ -0,0 +1,410 @@
+//****************************************************************************
+// Monitor's side of the sensor broker.  See broker.h.
+//
+// Like the metrics exporter this is one non-blocking listening socket and
+// a handful of connections, all driven from Monitor's event loop.  Requests
+// that the last readings will do for are answered straight away.  The
+// sensors the rest need are read together, as one poll (see poller.h),
+// and everybody waiting is answered when it is done.  While some other
+// poll is on the bus the requests just wait; the broker is called again
+// when the bus is free, and often that poll has answered them anyway.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "broker.h"
+#include "config.h"
+#include "health.h"
+#include "poller.h"
+#include "reactor.h"
+
+#define MAX_CLIENTS	16
+
+struct Client
+{
+	int fd;				// -1 when the slot is free
+	bool waiting;			// request holds a question not yet answered
+	BrokerRequest request;
+};
+
+static int listenfd = -1;
+static Client client[MAX_CLIENTS];
+static const Config *config;
+static SensorPoll reads;		// the broker's own poll
+
+// The last reading of each sensor and when it finished, on CLOCK_REALTIME
+// since that is what the requests are stamped with.  Zero if never read.
+
+static SensorReading last[NUM_SENSORS];
+static long long lastMs[NUM_SENSORS];
+
+static void acceptClients(void *arg, unsigned events);
+static void clientReady(void *arg, unsigned events);
+static void polled(SensorPoll *p);
+static void answer(Client *c);
+static void closeClient(Client *c);
+static int findSensor(const char *name);
+static bool fresh(int sensor, const BrokerRequest *request);
+static long long realtimeMs(const struct timespec *ts);
+
+
+
+
+//****************************************************************************
+// Starts listening on the given socket path.  A socket left behind by an
+// earlier run is removed first, anything else there is left alone.  Returns
+// false after printing an error if that can't be done; Monitor carries on
+// without the broker and the programs use the bus directly.  The config is
+// where the sensors are; it is looked at afresh for every request.
+
+bool brokerInit(const char *path, const Config *settings)
+{
+	config = settings;
+
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		client[i].fd = -1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Broker socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+
+	listenfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenfd < 0)
+	{
+		printf("Error creating broker socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Anybody on the Pi may ask for a reading; they can't do anything else
+
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		chmod(path, 0666) < 0 || listen(listenfd, MAX_CLIENTS) < 0)
+	{
+		printf("Error listening on broker socket %s: %s\n", path, strerror(errno));
+		close(listenfd);
+		listenfd = -1;
+		return false;
+	}
+
+	if (!reactorWatch(listenfd, EPOLLIN, acceptClients, NULL))
+	{
+		close(listenfd);
+		listenfd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Keeps the readings of the sensors that were just polled, so requests can
+// be answered from them.
+
+void brokerUpdate(const SensorReading *readings, const bool *due)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (due[i])
+		{
+			last[i] = readings[i];
+			lastMs[i] = realtimeMs(&now);
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Answers every waiting request the last readings will do for, and starts
+// a poll of the sensors the others need.  Called whenever a request comes
+// in and whenever the bus comes free.  The I2C sensors and the ones that
+// aren't on I2C are never in the same poll, so a request for an I2C sensor
+// doesn't wait out a DS18B20 conversion; the I2C ones go first.
+
+void brokerService(void)
+{
+	if (listenfd < 0)
+	{
+		return;
+	}
+
+	time_t now = time(NULL);
+	bool need[NUM_SENSORS];
+	bool any = false;
+
+	memset(need, 0, sizeof(need));
+	for (int c = 0; c < MAX_CLIENTS; c++)
+	{
+		if (client[c].fd < 0 || !client[c].waiting)
+		{
+			continue;
+		}
+
+		int i = findSensor(client[c].request.sensor);
+		if (i < 0 || !config->enabled[i] || fresh(i, &client[c].request) || !healthReady(i, now))
+		{
+			answer(&client[c]);
+		}
+		else
+		{
+			need[i] = true;
+			any = true;
+		}
+	}
+
+	if (any && !pollerBusy())
+	{
+		bool i2c = false;
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			i2c |= need[i] && BoardSensors::I2C_OF[i];
+		}
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			reads.due[i] = need[i] && BoardSensors::I2C_OF[i] == i2c;
+		}
+		reads.done = polled;
+		pollerStart(config->slot, &reads);
+	}
+}
+
+
+
+
+//****************************************************************************
+// When the oldest waiting request gives up, on CLOCK_REALTIME like time().
+// Zero if none are waiting.
+
+time_t brokerDeadline(void)
+{
+	time_t deadline = 0;
+
+	for (int c = 0; c < MAX_CLIENTS; c++)
+	{
+		if (client[c].fd >= 0 && client[c].waiting &&
+			(deadline == 0 || client[c].request.sent.tv_sec + BROKER_TIMEOUT < deadline))
+		{
+			deadline = client[c].request.sent.tv_sec + BROKER_TIMEOUT;
+		}
+	}
+
+	return deadline;
+}
+
+
+
+
+//****************************************************************************
+// Takes every new connection waiting on the listening socket.
+
+static void acceptClients(void *arg, unsigned events)
+{
+	for (;;)
+	{
+		int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				printf("Error accepting broker connection: %s\n", strerror(errno));
+			}
+			return;
+		}
+
+		int slot = 0;
+		while (slot < MAX_CLIENTS && client[slot].fd >= 0)
+		{
+			slot++;
+		}
+		if (slot == MAX_CLIENTS)
+		{
+			close(fd);		// too busy, the program uses the bus
+			continue;
+		}
+
+		if (!reactorWatch(fd, EPOLLIN, clientReady, &client[slot]))
+		{
+			close(fd);
+			continue;
+		}
+
+		client[slot].fd = fd;
+		client[slot].waiting = false;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Reads a request from a connection and sees to it.  Only one at a time is
+// taken from each: the connection is not watched while its request waits,
+// so the next one stays in the socket until this one is answered.
+
+static void clientReady(void *arg, unsigned events)
+{
+	Client *c = (Client *)arg;
+
+	if (c->waiting)
+	{
+		closeClient(c);		// only a hang up gets here while waiting
+		return;
+	}
+
+	int got = recv(c->fd, &c->request, sizeof(c->request), 0);
+	if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return;
+	}
+	if (got != sizeof(c->request))
+	{
+		closeClient(c);		// hung up, or not one of ours
+		return;
+	}
+
+	c->request.sensor[BROKER_NAME_SIZE - 1] = '\0';
+	c->waiting = true;
+	reactorChange(c->fd, 0);
+	brokerService();
+}
+
+
+
+
+//****************************************************************************
+// The sensors the requests needed have been read.  They count towards the
+// sensors' health like any other read.
+
+static void polled(SensorPoll *p)
+{
+	healthResults(config, p->due, p->failed, p->sample.when.tv_sec);
+	brokerUpdate(p->readings, p->due);
+	brokerService();
+}
+
+
+
+
+//****************************************************************************
+// Sends the answer to a connection's request.
+
+static void answer(Client *c)
+{
+	BrokerReply reply;
+	memset(&reply, 0, sizeof(reply));
+
+	int i = findSensor(c->request.sensor);
+	if (i < 0)
+	{
+		reply.result = BROKER_UNKNOWN;
+	}
+	else if (!config->enabled[i])
+	{
+		reply.result = BROKER_OFF;
+	}
+	else if (!fresh(i, &c->request))
+	{
+		reply.result = BROKER_QUARANTINED;	// the only reason it is not read
+	}
+	else
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		reply.result = BROKER_OK;
+		reply.ageMs = realtimeMs(&now) - lastMs[i];
+		reply.reading = last[i];
+	}
+
+	c->waiting = false;
+	if (send(c->fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(reply) ||
+		!reactorChange(c->fd, EPOLLIN))
+	{
+		closeClient(c);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Closes a connection and frees its slot.
+
+static void closeClient(Client *c)
+{
+	reactorForget(c->fd);
+	close(c->fd);
+	c->fd = -1;
+	c->waiting = false;
+}
+
+
+
+
+//****************************************************************************
+// Returns the sensor with the given name, or -1.
+
+static int findSensor(const char *name)
+{
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (strcasecmp(name, BoardSensors::NAMES[i]) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+// Whether the last reading of a sensor is new enough for a request: it has
+// to have finished no more than maxAgeMs before the request was sent.
+
+static bool fresh(int sensor, const BrokerRequest *request)
+{
+	return lastMs[sensor] != 0 && lastMs[sensor] >= realtimeMs(&request->sent) - request->maxAgeMs;
+}
+
+
+
+
+//****************************************************************************
+// A CLOCK_REALTIME time in milliseconds.
+
+static long long realtimeMs(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000LL + ts->tv_nsec / 1000000;
+}
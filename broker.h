@@ -0,0 +1,82 @@
+//****************************************************************************
+// Sensor reads through Monitor.  While Monitor is running it owns the I2C
+// buses, and the pct2075, ph and sht30 programs ask it for a reading over
+// a Unix socket instead of opening the bus themselves.  Their transfers
+// can then never land in the middle of Monitor's, which matters most for
+// the PCF8591: each read returns the conversion started by the one before,
+// so a stray read from another program steals Monitor's pH sample.
+//
+// A request names a sensor and how old a reading the caller will accept.
+// Monitor keeps the last reading of every sensor (its own polls count), so
+// a request that will take that one costs no bus time at all; otherwise
+// the sensor is read.  Requests that come in while a read is going on are
+// answered from that read, so ten dashboards asking at once cost one bus
+// transaction.  "Old" is measured from when the request was sent, so a
+// max age of zero means a reading finished after the caller asked.
+//
+// The socket is a SOCK_SEQPACKET, one BrokerRequest in and one BrokerReply
+// out, and a connection can ask any number of times.  Both ends are built
+// from the same source, so the structs go over as they are.
+//
+// Monitor's side runs from its event loop (reactor.h) like the metrics
+// exporter, and reads go through the poller (poller.h), so they never
+// overlap Monitor's own sample or hold up anything else.  If Monitor is
+// not running brokerRead() just returns false, and brokerReadSensor() then
+// goes to the bus directly as the programs always have.
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <time.h>
+
+#include "drivers.h"
+
+#define DEFAULT_BROKER_SOCKET	"/home/pi/Jason/monitor.sock"
+
+#define BROKER_NAME_SIZE	16
+
+// Monitor answers between samples, and a sample takes a fraction of a
+// second.  A program that has waited this long gives up: Monitor is stuck,
+// and so probably is the bus.  It is also the deadline Monitor schedules
+// the request by.
+
+#define BROKER_TIMEOUT		5		// seconds
+
+enum
+{
+	BROKER_OK,			// reading holds the result, good or bad
+	BROKER_UNKNOWN,			// no sensor by that name
+	BROKER_OFF,			// turned off in the config
+	BROKER_QUARANTINED		// failing, so left alone for now (health.h)
+};
+
+struct BrokerRequest
+{
+	char sensor[BROKER_NAME_SIZE];	// driver name, like "pH"
+	int maxAgeMs;
+	struct timespec sent;		// CLOCK_REALTIME
+};
+
+struct BrokerReply
+{
+	int result;			// BROKER_ status
+	int ageMs;			// how old the reading was when sent
+	SensorReading reading;
+};
+
+struct Config;
+
+// Monitor's side
+
+bool brokerInit(const char *path, const Config *config);
+void brokerUpdate(const SensorReading *readings, const bool *due);
+void brokerService(void);
+time_t brokerDeadline(void);
+
+// The programs' side
+
+bool brokerRead(const char *path, const char *sensor, int maxAgeMs, BrokerReply *reply);
+bool brokerReadSensor(const char *path, int maxAgeMs, const SensorDriver *driver, SensorReading *reading);
+const char *brokerError(const BrokerReply *reply);
+
+#endif	// BROKER_H
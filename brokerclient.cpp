@@ -0,0 +1,126 @@
+//****************************************************************************
+// The programs' side of the sensor broker.  See broker.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "broker.h"
+
+#define I2C_DEVICE	"/dev/i2c-1"
+
+
+
+
+//****************************************************************************
+// Asks Monitor for a reading of the named sensor, no more than maxAgeMs old
+// (zero for one taken after this call).  Returns false, quietly, if Monitor
+// is not there to ask; otherwise the reply says how it went.
+
+bool brokerRead(const char *path, const char *sensor, int maxAgeMs, BrokerReply *reply)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct timeval timeout = { BROKER_TIMEOUT, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	BrokerRequest request;
+	memset(&request, 0, sizeof(request));
+	snprintf(request.sensor, sizeof(request.sensor), "%s", sensor);
+	request.maxAgeMs = maxAgeMs;
+	clock_gettime(CLOCK_REALTIME, &request.sent);
+
+	bool good = send(fd, &request, sizeof(request), MSG_NOSIGNAL) == sizeof(request) &&
+		recv(fd, reply, sizeof(*reply), 0) == sizeof(*reply);
+
+	close(fd);
+	return good;
+}
+
+
+
+
+//****************************************************************************
+// What the pct2075, ph and sht30 programs do: ask Monitor for a reading of
+// the sensor, or if Monitor is not running read it off the bus.  Prints
+// what went wrong and returns false if neither works.
+
+bool brokerReadSensor(const char *path, int maxAgeMs, const SensorDriver *driver, SensorReading *reading)
+{
+	BrokerReply reply;
+	if (brokerRead(path, driver->name, maxAgeMs, &reply))
+	{
+		if (reply.result != BROKER_OK || reply.reading.status != DRIVER_OK)
+		{
+			printf("%s\n", brokerError(&reply));
+			return false;
+		}
+		*reading = reply.reading;
+		return true;
+	}
+
+	int fd = open(I2C_DEVICE, O_RDWR);
+	if (fd < 0)
+	{
+		printf("Error opening I2C device: %s\n", strerror(errno));
+		return false;
+	}
+
+	bool good = driverRead(fd, driver, reading) == DRIVER_OK;
+	if (!good)
+	{
+		printf("%s\n", driverError(reading));
+	}
+
+	close(fd);
+	return good;
+}
+
+
+
+
+//****************************************************************************
+// Describes what went wrong with a reply, like driverError() does for a
+// reading.
+
+const char *brokerError(const BrokerReply *reply)
+{
+	switch (reply->result)
+	{
+		case BROKER_OK:
+			return driverError(&reply->reading);
+
+		case BROKER_UNKNOWN:
+			return "Monitor does not know this sensor";
+
+		case BROKER_OFF:
+			return "Monitor has this sensor turned off";
+
+		case BROKER_QUARANTINED:
+			return "Monitor has quarantined this sensor, it keeps failing";
+
+		default:
+			return "unknown error";
+	}
+}
@@ -0,0 +1,243 @@
+//****************************************************************************
+// Burst capture.  See burst.h.
+//
+// The ring is records, not samples, so a capture is written straight out
+// of it.  Every record that has ever gone in has a number; the one
+// numbered n is in slot n % BURST_RING_SIZE, which makes it easy to tell
+// whether the start of a capture has been written over yet.
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "burst.h"
+#include "alarm.h"
+#include "config.h"
+#include "health.h"
+#include "broker.h"
+#include "poller.h"
+#include "reactor.h"
+#include "record.h"
+
+#define TAG_SIZE	32
+#define STAMP_SIZE	32
+
+static const Config *config;
+static char dir[CONFIG_PATH_SIZE];
+static int before;			// seconds
+static int after;
+static bool enabled = false;
+
+static Record ring[BURST_RING_SIZE];
+static unsigned long long written = 0;	// records ever put in the ring
+static SensorPoll reads;		// burst mode's own poll
+
+// The capture collecting its after window, if any
+
+static bool capturing = false;
+static unsigned long long captureStart;	// first record number in it
+static time_t triggered;
+static char captureTag[TAG_SIZE];
+
+static void polled(SensorPoll *p);
+static void save(void *arg);
+
+
+
+
+//****************************************************************************
+// Turns burst mode on: captures go in the given directory, with the given
+// number of seconds before and after the trigger.  The directory is made
+// if it isn't there.  The config says which sensors there are; it is looked
+// at afresh for every poll.  Returns false after printing an error if the
+// directory can't be made.
+
+bool burstInit(const char *captureDir, int beforeSeconds, int afterSeconds, const Config *settings)
+{
+	snprintf(dir, sizeof(dir), "%s", captureDir);
+	before = beforeSeconds;
+	after = afterSeconds;
+	config = settings;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		printf("Error making capture directory %s: %s\n", dir, strerror(errno));
+		return false;
+	}
+
+	enabled = true;
+
+	printf("Burst mode: capturing %d seconds before and %d after into %s\n", before, after, dir);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Puts a sample in the ring.
+
+void burstSample(const Sample *sample)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	recordEncode(sample, &ring[written % BURST_RING_SIZE]);
+	written++;
+}
+
+
+
+
+//****************************************************************************
+// Starts another round of reads if the bus is free.  Called whenever it
+// comes free, after everything else has had its turn.  Only the I2C
+// sensors are read: a DS18B20 conversion would hold every round up to its
+// 750ms.
+
+void burstService(void)
+{
+	if (!enabled || pollerBusy())
+	{
+		return;
+	}
+
+	time_t now = time(NULL);
+	bool any = false;
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		reads.due[i] = config->enabled[i] && BoardSensors::I2C_OF[i] && healthReady(i, now);
+		any |= reads.due[i];
+	}
+
+	if (any)
+	{
+		reads.done = polled;
+		pollerStart(config->slot, &reads);
+	}
+}
+
+
+
+
+//****************************************************************************
+// An alarm wants a capture.  The tag goes in the file name, so anything
+// but letters, digits, - and _ becomes _.
+
+void burstTrigger(const char *tag)
+{
+	if (!enabled)
+	{
+		return;
+	}
+	if (capturing)
+	{
+		printf("Capture %s already going, not starting %s\n", captureTag, tag);
+		return;
+	}
+
+	// Find the oldest record in the before window
+
+	triggered = time(NULL);
+	long long from = (triggered - before) * 1000000000LL;
+	unsigned long long oldest = written > BURST_RING_SIZE ? written - BURST_RING_SIZE : 0;
+
+	captureStart = written;
+	while (captureStart > oldest && ring[(captureStart - 1) % BURST_RING_SIZE].when >= from)
+	{
+		captureStart--;
+	}
+
+	int i;
+	for (i = 0; tag[i] != '\0' && i < TAG_SIZE - 1; i++)
+	{
+		captureTag[i] = isalnum((unsigned char)tag[i]) || tag[i] == '-' ? tag[i] : '_';
+	}
+	captureTag[i] = '\0';
+
+	if (reactorAfter(after, save, NULL) >= 0)
+	{
+		capturing = true;
+	}
+}
+
+
+
+
+//****************************************************************************
+// A round of burst reads is done.  They count towards the sensors' health,
+// and the broker can answer from them, like any other read.  The sample
+// goes in the ring before the capture rules see it, so one that fires a
+// capture is in it.
+
+static void polled(SensorPoll *p)
+{
+	healthResults(config, p->due, p->failed, p->sample.when.tv_sec);
+	brokerUpdate(p->readings, p->due);
+	burstSample(&p->sample);
+	alarmBurstSample(&p->sample);
+}
+
+
+
+
+//****************************************************************************
+// The after window is over: writes the capture out.
+
+static void save(void *arg)
+{
+	capturing = false;
+
+	// Whatever has been written over since the trigger is gone
+
+	unsigned long long start = captureStart;
+	if (written - start > BURST_RING_SIZE)
+	{
+		start = written - BURST_RING_SIZE;
+	}
+
+	struct tm local;
+	localtime_r(&triggered, &local);
+	char stamp[STAMP_SIZE];
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+	// Room for the directory, the stamp and the tag whatever their lengths
+
+	char filename[CONFIG_PATH_SIZE + STAMP_SIZE + TAG_SIZE + sizeof("/-.bin")];
+	snprintf(filename, sizeof(filename), "%s/%s-%s.bin", dir, stamp, captureTag);
+
+	FILE *out = fopen(filename, "w");
+	if (out == NULL)
+	{
+		printf("Error opening capture file %s: %s\n", filename, strerror(errno));
+		return;
+	}
+
+	// At most two pieces, either side of the end of the ring
+
+	for (unsigned long long n = start; n < written; )
+	{
+		unsigned slot = n % BURST_RING_SIZE;
+		unsigned long long count = written - n;
+		if (count > BURST_RING_SIZE - slot)
+		{
+			count = BURST_RING_SIZE - slot;
+		}
+
+		fwrite(&ring[slot], sizeof(Record), count, out);
+		n += count;
+	}
+
+	if (fclose(out) != 0)
+	{
+		printf("Error writing capture file %s: %s\n", filename, strerror(errno));
+		return;
+	}
+
+	printf("Captured %llu samples to %s\n", written - start, filename);
+}
@@ -0,0 +1,34 @@
+//****************************************************************************
+// Burst capture.  With burst mode on, Monitor reads the I2C sensors
+// whenever the bus has nothing else to do, as fast as they go, and keeps
+// the results in a ring in memory (the DS18B20s are too slow for it, so
+// they are only in the sample cycles' samples).  Nothing about that touches the SD card.  When an
+// alarm rule with the capture action fires (see alarm.h), the last
+// "before" seconds of the ring plus the next "after" seconds are written to
+// a capture file:
+//
+//    <captures dir>/<YYYYMMDD-HHMMSS>-<tag>.bin
+//
+// named for the moment it fired and the rule's tag.  The file is binary
+// records (see record.h), the same as csv2bin writes, oldest first.  The
+// sample cycles' own samples go in the ring too.
+//
+// One capture at a time: a trigger while one is still collecting its
+// after window is ignored.  The ring holds BURST_RING_SIZE samples, so a
+// very long window at a fast rate only gets the newest of them.
+
+#ifndef BURST_H
+#define BURST_H
+
+#include "sample.h"
+
+struct Config;
+
+#define BURST_RING_SIZE		8192
+
+bool burstInit(const char *dir, int before, int after, const Config *config);
+void burstSample(const Sample *sample);
+void burstService(void);
+void burstTrigger(const char *tag);
+
+#endif	// BURST_H
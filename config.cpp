@@ -0,0 +1,707 @@
+//****************************************************************************
+// Monitor's settings file.  See config.h for the syntax.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "config.h"
+#include "recover.h"
+#include "segment.h"
+
+#define MAX_LINE	256
+#define DEFAULT_BUS	"main"
+#define MUX_PORTS	8
+#define MAX_GPIO_PIN	27		// the highest on the Pi header
+
+static void setDefaults(Config *config);
+static bool parseLine(char *line, const char *where, Config *config);
+static bool parseSensor(char **save, const char *where, Config *config);
+static bool parseNumber(const char *text, int *value);
+static bool setPath(char *path, const char *text, const char *where);
+static int findBus(const Config *config, const char *name);
+static int findMux(const Config *config, const char *name);
+
+
+
+
+//****************************************************************************
+// Reads the config file.  A missing file is fine, it just means everything
+// is left at its default.  Any bad line fails the whole load (after every
+// problem has been reported), so a typo never half applies.
+
+bool configLoad(const char *filename, Config *config)
+{
+	setDefaults(config);
+
+	FILE *in = fopen(filename, "r");
+	if (in == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			printf("Error opening config file %s: %s\n", filename, strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	bool good = true;
+	char line[MAX_LINE];
+	int lineNumber = 0;
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineNumber++;
+
+		char *p = line;
+		while (isspace((unsigned char)*p))
+		{
+			p++;
+		}
+		if (*p == '\0' || *p == '#')
+		{
+			continue;
+		}
+
+		char where[CONFIG_PATH_SIZE + 16];
+		snprintf(where, sizeof(where), "%s:%d", filename, lineNumber);
+
+		if (!parseLine(p, where, config))
+		{
+			good = false;
+		}
+	}
+	fclose(in);
+
+	return good;
+}
+
+
+
+
+//****************************************************************************
+// Opens the buses the enabled sensors are on and fills in the schedule.
+// Buses that the old config (if any) already has open are shared rather
+// than opened again.  On failure nothing new is left open.
+
+bool configOpen(Config *config, const Config *old)
+{
+	for (int b = 0; b < config->buses; b++)
+	{
+		config->bus[b].fd = -1;
+	}
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		config->every[i] = config->sensorEvery[i] > 0 ? config->sensorEvery[i] : config->interval;
+		config->slot[i].fd = -1;
+
+		if (!config->enabled[i] || !BoardSensors::I2C_OF[i])
+		{
+			continue;
+		}
+
+		Bus *bus = &config->bus[config->sensorBus[i]];
+
+		// Two names for the same device, or the same device in the old
+		// config, share one fd.
+
+		for (int b = 0; bus->fd < 0 && b < config->buses; b++)
+		{
+			if (config->bus[b].fd >= 0 && strcmp(config->bus[b].device, bus->device) == 0)
+			{
+				bus->fd = config->bus[b].fd;
+			}
+		}
+
+		for (int b = 0; bus->fd < 0 && old != NULL && b < old->buses; b++)
+		{
+			if (old->bus[b].fd >= 0 && strcmp(old->bus[b].device, bus->device) == 0)
+			{
+				bus->fd = old->bus[b].fd;
+			}
+		}
+
+		if (bus->fd < 0)
+		{
+			bus->fd = open(bus->device, O_RDWR);
+			if (bus->fd < 0)
+			{
+				printf("Error opening I2C device %s: %s\n", bus->device, strerror(errno));
+				configClose(config, old);
+				return false;
+			}
+
+			if (ioctl(bus->fd, I2C_TIMEOUT, BUS_TIMEOUT_MS / 10) < 0)
+			{
+				printf("Error setting the timeout on %s: %s\n", bus->device, strerror(errno));
+			}
+		}
+
+		config->slot[i].fd = bus->fd;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Closes the buses a config has open, except the ones keep is using too.
+
+void configClose(Config *config, const Config *keep)
+{
+	for (int b = 0; b < config->buses; b++)
+	{
+		int fd = config->bus[b].fd;
+		bool unused = fd >= 0;
+
+		// Shared with keep, or with a bus already closed here?
+
+		for (int k = 0; unused && keep != NULL && k < keep->buses; k++)
+		{
+			unused = keep->bus[k].fd != fd;
+		}
+		for (int k = 0; unused && k < b; k++)
+		{
+			unused = config->bus[k].fd != fd;
+		}
+
+		if (unused)
+		{
+			close(fd);
+		}
+	}
+
+	for (int b = 0; b < config->buses; b++)
+	{
+		config->bus[b].fd = -1;
+	}
+}
+
+
+
+
+//****************************************************************************
+// The built in config: every sensor at its usual address on one bus.
+
+static void setDefaults(Config *config)
+{
+	memset(config, 0, sizeof(*config));
+
+	snprintf(config->report, sizeof(config->report), "%s", DEFAULT_REPORT_FILENAME);
+	snprintf(config->alarms, sizeof(config->alarms), "%s", DEFAULT_ALARM_FILENAME);
+	snprintf(config->dosing, sizeof(config->dosing), "%s", DEFAULT_DOSING_FILENAME);
+	snprintf(config->captures, sizeof(config->captures), "%s", DEFAULT_CAPTURE_DIR);
+	snprintf(config->stats, sizeof(config->stats), "%s", DEFAULT_STATS_FILENAME);
+	snprintf(config->broker, sizeof(config->broker), "%s", DEFAULT_BROKER_SOCKET);
+	config->interval = DEFAULT_REPORTING_INTERVAL * 60;
+	config->probe = true;
+	config->phSettle = DEFAULT_PH_SETTLE;
+	snprintf(config->w1, sizeof(config->w1), "%s", DEFAULT_W1_ROOT);
+	config->segmentRecords = DEFAULT_SEGMENT_RECORDS;
+	config->segmentSync = DEFAULT_SEGMENT_SYNC;
+
+	config->buses = 1;
+	snprintf(config->bus[0].name, sizeof(config->bus[0].name), "%s", DEFAULT_BUS);
+	snprintf(config->bus[0].device, sizeof(config->bus[0].device), "%s", DEFAULT_I2C_DEVICE);
+	config->bus[0].scl = DEFAULT_SCL_PIN;
+	config->bus[0].sda = DEFAULT_SDA_PIN;
+	config->bus[0].khz = DEFAULT_BUS_KHZ;
+	config->bus[0].fd = -1;
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		config->sensorBus[i] = 0;
+		config->enabled[i] = true;
+		config->slot[i].fd = -1;
+		config->slot[i].addr = BoardSensors::ADDRS[i];
+	}
+}
+
+
+
+
+//****************************************************************************
+// Handles one line of the file.
+
+static bool parseLine(char *line, const char *where, Config *config)
+{
+	line[strcspn(line, "\r\n")] = '\0';
+
+	char *save;
+	char *keyword = strtok_r(line, " \t", &save);
+
+	if (strcasecmp(keyword, "sensor") == 0)
+	{
+		return parseSensor(&save, where, config);
+	}
+
+	char *arg = strtok_r(NULL, " \t", &save);
+
+	if (arg == NULL)
+	{
+		printf("%s: %s needs a value\n", where, keyword);
+		return false;
+	}
+
+	if (strcasecmp(keyword, "bus") == 0)
+	{
+		char *device = strtok_r(NULL, " \t", &save);
+		if (device == NULL)
+		{
+			printf("%s: bus needs a name and a device\n", where);
+			return false;
+		}
+
+		// Naming an existing bus again just moves it.
+
+		int b = findBus(config, arg);
+		if (b < 0)
+		{
+			if (config->buses == MAX_BUSES)
+			{
+				printf("%s: too many buses, only %d allowed\n", where, MAX_BUSES);
+				return false;
+			}
+			b = config->buses++;
+			snprintf(config->bus[b].name, sizeof(config->bus[b].name), "%s", arg);
+			config->bus[b].device[0] = '\0';
+		}
+
+		Bus *bus = &config->bus[b];
+		if (strcmp(bus->device, device) != 0)
+		{
+			bus->scl = -1;
+			bus->sda = -1;
+		}
+		bus->fd = -1;
+		bus->khz = DEFAULT_BUS_KHZ;
+
+		char *option;
+		while ((option = strtok_r(NULL, " \t", &save)) != NULL)
+		{
+			if (strcasecmp(option, "speed") == 0)
+			{
+				char *khz = strtok_r(NULL, " \t", &save);
+				if (khz == NULL || !parseNumber(khz, &bus->khz) || bus->khz < 10 || bus->khz > 3400)
+				{
+					printf("%s: bus speed is 10 to 3400 kHz\n", where);
+					return false;
+				}
+				continue;
+			}
+
+			char *scl = strtok_r(NULL, " \t", &save);
+			char *sda = strtok_r(NULL, " \t", &save);
+
+			if (strcasecmp(option, "recover") != 0 || scl == NULL || sda == NULL ||
+				!parseNumber(scl, &bus->scl) || !parseNumber(sda, &bus->sda) ||
+				bus->scl < 0 || bus->scl > MAX_GPIO_PIN || bus->sda < 0 || bus->sda > MAX_GPIO_PIN)
+			{
+				printf("%s: bus recovery needs recover <scl pin> <sda pin>\n", where);
+				return false;
+			}
+		}
+
+		return setPath(bus->device, device, where);
+	}
+
+	if (strcasecmp(keyword, "mux") == 0)
+	{
+		char *busName = strtok_r(NULL, " \t", &save);
+		char *addr = strtok_r(NULL, " \t", &save);
+		int value;
+
+		if (busName == NULL || addr == NULL)
+		{
+			printf("%s: mux needs a name, a bus and an address\n", where);
+			return false;
+		}
+		if (findMux(config, arg) >= 0)
+		{
+			printf("%s: mux %s is already defined\n", where, arg);
+			return false;
+		}
+		if (config->muxes == MAX_MUXES)
+		{
+			printf("%s: too many muxes, only %d allowed\n", where, MAX_MUXES);
+			return false;
+		}
+
+		Mux *mux = &config->mux[config->muxes];
+		mux->bus = findBus(config, busName);
+		if (mux->bus < 0)
+		{
+			printf("%s: unknown bus %s\n", where, busName);
+			return false;
+		}
+		if (!parseNumber(addr, &value) || value < 0x03 || value > 0x77)
+		{
+			printf("%s: bad mux address %s\n", where, addr);
+			return false;
+		}
+		mux->addr = value;
+		snprintf(mux->name, sizeof(mux->name), "%s", arg);
+		config->muxes++;
+		return true;
+	}
+
+	if (strcasecmp(keyword, "interval") == 0 || strcasecmp(keyword, "metrics") == 0)
+	{
+		int value;
+		bool interval = strcasecmp(keyword, "interval") == 0;
+
+		if (!parseNumber(arg, &value) || value < (interval ? 1 : 0) || value > 65535)
+		{
+			printf("%s: bad %s %s\n", where, keyword, arg);
+			return false;
+		}
+
+		if (interval)
+		{
+			config->interval = value * 60;
+		}
+		else
+		{
+			config->metricsPort = value;
+		}
+		return true;
+	}
+
+	if (strcasecmp(keyword, "probe") == 0)
+	{
+		if (strcasecmp(arg, "on") != 0 && strcasecmp(arg, "off") != 0)
+		{
+			printf("%s: probe is on or off\n", where);
+			return false;
+		}
+		config->probe = strcasecmp(arg, "on") == 0;
+		return true;
+	}
+
+	if (strcasecmp(keyword, "ph") == 0)
+	{
+		char *count = strtok_r(NULL, " \t", &save);
+		if (strcasecmp(arg, "settle") != 0 || count == NULL || !parseNumber(count, &config->phSettle) ||
+			config->phSettle < 0 || config->phSettle > PH_MAX_SETTLE)
+		{
+			printf("%s: ph settle needs 0 to %d conversions\n", where, PH_MAX_SETTLE);
+			return false;
+		}
+		return true;
+	}
+
+	if (strcasecmp(keyword, "w1") == 0)
+	{
+		return setPath(config->w1, arg, where);
+	}
+
+	if (strcasecmp(keyword, "segments") == 0)
+	{
+		if (strcasecmp(arg, "off") == 0)
+		{
+			config->segments[0] = '\0';
+			return true;
+		}
+
+		char *option;
+		while ((option = strtok_r(NULL, " \t", &save)) != NULL)
+		{
+			char *count = strtok_r(NULL, " \t", &save);
+			int value;
+
+			if (count == NULL || !parseNumber(count, &value))
+			{
+				printf("%s: segments %s needs a number\n", where, option);
+				return false;
+			}
+			if (strcasecmp(option, "records") == 0 && value >= MIN_SEGMENT_RECORDS)
+			{
+				config->segmentRecords = value;
+			}
+			else if (strcasecmp(option, "sync") == 0 && value >= 0)
+			{
+				config->segmentSync = value;
+			}
+			else
+			{
+				printf("%s: segments takes records (at least %d) and sync\n", where, MIN_SEGMENT_RECORDS);
+				return false;
+			}
+		}
+		return setPath(config->segments, arg, where);
+	}
+
+	if (strcasecmp(keyword, "report") == 0)
+	{
+		return setPath(config->report, arg, where);
+	}
+
+	if (strcasecmp(keyword, "alarms") == 0)
+	{
+		return setPath(config->alarms, arg, where);
+	}
+
+	if (strcasecmp(keyword, "burst") == 0)
+	{
+		config->burstBefore = config->burstAfter = 0;
+		if (strcasecmp(arg, "off") == 0)
+		{
+			return true;
+		}
+
+		char *afterArg = strtok_r(NULL, " \t", &save);
+		int before, after;
+		if (afterArg == NULL || !parseNumber(arg, &before) || !parseNumber(afterArg, &after) ||
+			before < 0 || after < 0 || before + after == 0 || before > 3600 || after > 3600)
+		{
+			printf("%s: burst needs seconds before and after, or off\n", where);
+			return false;
+		}
+		config->burstBefore = before;
+		config->burstAfter = after;
+		return true;
+	}
+
+	if (strcasecmp(keyword, "captures") == 0)
+	{
+		return setPath(config->captures, arg, where);
+	}
+
+	if (strcasecmp(keyword, "dosing") == 0)
+	{
+		return setPath(config->dosing, arg, where);
+	}
+
+	if (strcasecmp(keyword, "stats") == 0)
+	{
+		return setPath(config->stats, arg, where);
+	}
+
+	if (strcasecmp(keyword, "broker") == 0)
+	{
+		if (strcasecmp(arg, "off") == 0)
+		{
+			config->broker[0] = '\0';
+			return true;
+		}
+		return setPath(config->broker, arg, where);
+	}
+
+	printf("%s: unknown setting %s\n", where, keyword);
+	return false;
+}
+
+
+
+
+//****************************************************************************
+// sensor <type> <where> [<address>] [every <n> sec|min|hour] [off]
+
+static bool parseSensor(char **save, const char *where, Config *config)
+{
+	char *type = strtok_r(NULL, " \t", save);
+	char *location = strtok_r(NULL, " \t", save);
+
+	if (type == NULL || location == NULL)
+	{
+		printf("%s: sensor needs a type and where it is\n", where);
+		return false;
+	}
+
+	int i;
+	for (i = 0; i < NUM_SENSORS; i++)
+	{
+		if (strcasecmp(type, BoardSensors::NAMES[i]) == 0)
+		{
+			break;
+		}
+	}
+	if (i == NUM_SENSORS)
+	{
+		printf("%s: no %s sensor on this board\n", where, type);
+		return false;
+	}
+
+	SensorSlot *slot = &config->slot[i];
+
+	// Either a bus, or mux:port, or for a sensor that isn't on I2C, w1
+
+	char *colon = strchr(location, ':');
+	if (!BoardSensors::I2C_OF[i])
+	{
+		if (strcasecmp(location, "w1") != 0)
+		{
+			printf("%s: %s is on 1-Wire, so where it is has to be w1\n", where, type);
+			return false;
+		}
+		config->sensorBus[i] = 0;
+		slot->muxAddr = 0;
+		slot->muxPort = 0;
+	}
+	else if (colon == NULL)
+	{
+		config->sensorBus[i] = findBus(config, location);
+		slot->muxAddr = 0;
+		slot->muxPort = 0;
+		if (config->sensorBus[i] < 0)
+		{
+			printf("%s: unknown bus %s\n", where, location);
+			return false;
+		}
+	}
+	else
+	{
+		*colon = '\0';
+		int m = findMux(config, location);
+		int port;
+
+		if (m < 0)
+		{
+			printf("%s: unknown mux %s\n", where, location);
+			return false;
+		}
+		if (!parseNumber(colon + 1, &port) || port < 0 || port >= MUX_PORTS)
+		{
+			printf("%s: bad mux port %s\n", where, colon + 1);
+			return false;
+		}
+		config->sensorBus[i] = config->mux[m].bus;
+		slot->muxAddr = config->mux[m].addr;
+		slot->muxPort = port;
+	}
+
+	char *token;
+	while ((token = strtok_r(NULL, " \t", save)) != NULL)
+	{
+		int value;
+
+		if (strcasecmp(token, "off") == 0)
+		{
+			config->enabled[i] = false;
+		}
+		else if (strcasecmp(token, "every") == 0)
+		{
+			char *count = strtok_r(NULL, " \t", save);
+			char *unit = strtok_r(NULL, " \t", save);
+			int scale = 0;
+
+			if (unit != NULL)
+			{
+				if (strncasecmp(unit, "sec", 3) == 0)
+				{
+					scale = 1;
+				}
+				else if (strncasecmp(unit, "min", 3) == 0)
+				{
+					scale = 60;
+				}
+				else if (strncasecmp(unit, "hour", 4) == 0)
+				{
+					scale = 3600;
+				}
+			}
+
+			if (count == NULL || !parseNumber(count, &value) || value < 1 || scale == 0)
+			{
+				printf("%s: every needs a number and sec, min or hour\n", where);
+				return false;
+			}
+			config->sensorEvery[i] = value * scale;
+		}
+		else if (BoardSensors::I2C_OF[i] && parseNumber(token, &value) && value >= 0x03 && value <= 0x77)
+		{
+			slot->addr = value;
+		}
+		else
+		{
+			printf("%s: don't understand %s\n", where, token);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Reads a whole number, in decimal or 0x hex.
+
+static bool parseNumber(const char *text, int *value)
+{
+	char *end;
+
+	errno = 0;
+	long number = strtol(text, &end, 0);
+	if (errno != 0 || end == text || *end != '\0')
+	{
+		return false;
+	}
+
+	*value = number;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+
+static bool setPath(char *path, const char *text, const char *where)
+{
+	if (strlen(text) >= CONFIG_PATH_SIZE)
+	{
+		printf("%s: %s is too long\n", where, text);
+		return false;
+	}
+
+	strcpy(path, text);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+
+static int findBus(const Config *config, const char *name)
+{
+	for (int b = 0; b < config->buses; b++)
+	{
+		if (strcmp(config->bus[b].name, name) == 0)
+		{
+			return b;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+
+static int findMux(const Config *config, const char *name)
+{
+	for (int m = 0; m < config->muxes; m++)
+	{
+		if (strcmp(config->mux[m].name, name) == 0)
+		{
+			return m;
+		}
+	}
+
+	return -1;
+}
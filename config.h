@@ -0,0 +1,179 @@
+//****************************************************************************
+// Monitor's settings file.  It is read at startup and again whenever
+// Monitor gets a SIGHUP.  Settings given on the command line win over the
+// file.
+//
+// One setting per line, blank lines and lines starting with # are ignored:
+//
+//    bus <name> <device> [speed <kHz>] [recover <scl> <sda>]
+//                                         an I2C bus, like /dev/i2c-1, how
+//                                         fast it is clocked and the GPIO
+//                                         pins to unstick it with
+//    mux <name> <bus> <address>           a TCA9548A mux on a bus
+//    sensor <type> <where> [<address>] [every <n> sec|min|hour] [off]
+//    interval <minutes>                   how often sensors are read
+//    report <file>                        where the report is written
+//    alarms <file>                        alarm rules, see alarm.h
+//    dosing <file>                        pH dosing, see dosing.h
+//    stats <file>                         where SIGUSR1 writes I2C stats
+//    metrics <port>                       Prometheus exporter port
+//    broker <socket>|off                  where the programs ask for
+//                                         readings, see broker.h
+//    probe on|off                         look for the sensors first
+//    burst <before> <after>|off           burst capture, seconds either
+//                                         side of the trigger, see burst.h
+//    captures <dir>                       where burst captures go
+//    ph settle <conversions>              pH conversions thrown out while
+//                                         the input settles, see drivers.h
+//    w1 <dir>                             where the 1-Wire devices are in
+//                                         sysfs, see w1.cpp
+//    segments <dir> [records <n>] [sync <n>]|off
+//                                         also write samples to memory
+//                                         mapped segments, of n records,
+//                                         msync'd every n (0 for never),
+//                                         see segment.h
+//
+// The sensor types are the ones this board was built with (PCT2075, pH,
+// SHT30, DS18B20); the config says where each one is and how often to read
+// it, it cannot add new ones.  <where> is a bus name, or <mux>:<port> for
+// a sensor behind a mux; the DS18B20 probes are on 1-Wire, so theirs is
+// just w1, and the "w1 <dir>" setting says where to find them.  The
+// address defaults to the sensor's usual one.  A sensor marked off is
+// never read.  For example:
+//
+//    bus main /dev/i2c-1
+//    mux tank main 0x70
+//    sensor PCT2075 main
+//    sensor pH main every 5 min
+//    sensor SHT30 tank:2 0x45
+//    sensor DS18B20 w1 every 1 min
+//
+// Anything the file does not mention keeps its default: one bus on
+// /dev/i2c-1 (recovered through GPIO 3 and 2, its pins on the Pi), every
+// sensor at its usual address on it, read every 15 minutes.  With no file
+// at all, that is the whole config.  Naming a bus again with the same
+// device keeps its recovery pins.
+//
+// Unless probing is turned off, the buses are then checked for what is
+// really there (see probe.h): a sensor found somewhere else is read from
+// there instead, and one that cannot be found is not read at all.
+//
+// Everything is worked out when the file is loaded: buses are opened,
+// names are resolved and intervals are in seconds, so the main loop just
+// indexes slot[] and every[].  On a reload the sensor settings, interval,
+// pH settling, 1-Wire directory, report file and stats file take effect
+// right away; the alarm rules, the dosing settings, the metrics port, the
+// broker socket, burst mode, segments and where the rollups go are only
+// read at startup.
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "sensors.h"
+#include "broker.h"
+
+#define DEFAULT_CONFIG_FILENAME		"/home/pi/Jason/monitor.conf"
+
+// How often, in minutes, betweeen each reporting interval.
+
+#define DEFAULT_REPORTING_INTERVAL	15
+
+// This is the default report file.
+
+#define	DEFAULT_REPORT_FILENAME		"/home/pi/Jason/report.csv"
+
+// Alarm rules are read from this file at startup, see alarm.h.  If the file
+// is not there then there are no alarms.
+
+#define DEFAULT_ALARM_FILENAME		"/home/pi/Jason/alarms.conf"
+
+// Likewise the dosing controller's settings, see dosing.h.  No file, no
+// dosing.
+
+#define DEFAULT_DOSING_FILENAME		"/home/pi/Jason/dosing.conf"
+
+// Sending Monitor a SIGUSR1 writes the I2C timing and error statistics to
+// this file (see i2cbus.h).
+
+#define DEFAULT_STATS_FILENAME		"/home/pi/Jason/i2c.stats"
+
+// Burst captures (see burst.h) are written here, when burst mode is on.
+
+#define DEFAULT_CAPTURE_DIR		"/home/pi/Jason/captures"
+
+#define DEFAULT_I2C_DEVICE		"/dev/i2c-1"
+
+// The Pi clocks its I2C bus at 100kHz unless the device tree says
+// otherwise (dtparam=i2c_arm_baudrate).  The speed given in the config
+// doesn't change the bus, it just tells the schedule check (schedule.h)
+// what the bus can carry.
+
+#define DEFAULT_BUS_KHZ			100
+
+#define CONFIG_NAME_SIZE	16
+#define CONFIG_PATH_SIZE	128
+#define MAX_BUSES		4
+#define MAX_MUXES		4
+
+// A transfer that takes longer than this fails, rather than holding up the
+// whole poll cycle (the kernel works in 10ms steps).
+
+#define BUS_TIMEOUT_MS		100
+
+struct Bus
+{
+	char name[CONFIG_NAME_SIZE];
+	char device[CONFIG_PATH_SIZE];
+	int scl;			// GPIO pins for recovery, -1 for none
+	int sda;
+	int khz;			// clock speed, for the schedule check
+	int fd;				// -1 until configOpen
+};
+
+struct Mux
+{
+	char name[CONFIG_NAME_SIZE];
+	int bus;
+	int addr;
+};
+
+struct Config
+{
+	// As read from the file
+
+	char report[CONFIG_PATH_SIZE];
+	char alarms[CONFIG_PATH_SIZE];
+	char dosing[CONFIG_PATH_SIZE];
+	char stats[CONFIG_PATH_SIZE];
+	int metricsPort;		// zero for none
+	char broker[CONFIG_PATH_SIZE];	// empty for none
+	bool probe;			// check where the sensors really are
+	int burstBefore;		// seconds, both zero for no burst mode
+	int burstAfter;
+	char captures[CONFIG_PATH_SIZE];
+	int phSettle;			// see PH_SAMPLES in drivers.h
+	char w1[CONFIG_PATH_SIZE];	// sysfs directory of 1-Wire devices
+	char segments[CONFIG_PATH_SIZE];	// empty for none
+	int segmentRecords;
+	int segmentSync;		// records between msyncs, zero for none
+	int interval;			// seconds
+	int buses;
+	Bus bus[MAX_BUSES];
+	int muxes;
+	Mux mux[MAX_MUXES];
+	int sensorBus[NUM_SENSORS];
+	int sensorEvery[NUM_SENSORS];	// seconds, zero to use interval
+	bool enabled[NUM_SENSORS];
+
+	// Everything but the fd is filled in from the file; configOpen fills
+	// in the fd and every[], which is all the main loop looks at.
+
+	SensorSlot slot[NUM_SENSORS];
+	int every[NUM_SENSORS];		// seconds between reads
+};
+
+bool configLoad(const char *filename, Config *config);
+bool configOpen(Config *config, const Config *old);
+void configClose(Config *config, const Config *keep);
+
+#endif	// CONFIG_H
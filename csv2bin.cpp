@@ -0,0 +1,144 @@
+//****************************************************************************
+// Converts a report to a file of binary records (see record.h), which can
+// be read back with one fread or mapped straight into numpy:
+//
+//    numpy.fromfile("report.bin", dtype=[("when", "<i8"), ("valid", "<u4"),
+//        ("channels", "<u2"), ("magic", "<u2"), ("value", "<f4", 8),
+//        ("status", "u1", 8)])
+//
+// Every record in this layout has 0x4333 ("C3", the low half of
+// RECORD_MAGIC) in magic; numpy.all(r["magic"] == 0x4333) checks a file.
+//
+// A record has this board's channels, so the report's columns are matched
+// to them by name.  That way a report from before a sensor was added still
+// converts: a channel it has no column for is CHANNEL_NOT_READ throughout,
+// and a column this board has no channel for is left out.  Empty fields
+// become CHANNEL_NOT_READ and NaN fields CHANNEL_FAILED; either way the
+// value is NaN.
+//
+// Usage: csv2bin <report file> <record file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "reportload.h"
+#include "record.h"
+
+
+
+
+//****************************************************************************
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		printf("Usage: %s <report file> <record file>\n", argv[0]);
+		exit(1);
+	}
+
+	struct timespec start, loaded;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ReportColumns columns;
+	if (!reportLoad(argv[1], &columns))
+	{
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &loaded);
+
+	// Find the report's column for each of the record's channels, whose
+	// names are the rest of this board's header
+
+	int column[NUM_CHANNELS];
+	int matched = 0;
+	const char *name = BoardSensors::HEADER.data() + strlen(REPORT_HEADER_START);
+	for (int ch = 0; ch < NUM_CHANNELS; ch++)
+	{
+		name++;		// the comma
+		int length = strcspn(name, ",\n");
+
+		column[ch] = -1;
+		for (int c = 0; c < columns.channels; c++)
+		{
+			if ((int)strlen(columns.names[c]) == length && strncmp(columns.names[c], name, length) == 0)
+			{
+				column[ch] = c;
+				matched++;
+			}
+		}
+		if (column[ch] < 0)
+		{
+			printf("No %.*s column, writing it as not read\n", length, name);
+		}
+
+		name += length;
+	}
+
+	if (matched == 0)
+	{
+		printf("%s has none of this board's columns, expected %s", argv[1], BoardSensors::HEADER.data());
+		exit(1);
+	}
+	if (matched < columns.channels)
+	{
+		printf("%d of the report's columns are not on this board, leaving them out\n", columns.channels - matched);
+	}
+
+	FILE *out = fopen(argv[2], "wb");
+	if (out == NULL)
+	{
+		printf("Error creating %s: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	for (long row = 0; row < columns.rows; row++)
+	{
+		Record record;
+		memset(&record, 0, sizeof(record));
+		record.when = columns.epoch[row] * 1000000000LL;
+		record.channels = NUM_CHANNELS;
+		record.magic = RECORD_MAGIC & 0xFFFF;
+
+		for (int ch = 0; ch < NUM_CHANNELS; ch++)
+		{
+			int c = column[ch];
+			float value = c < 0 ? NAN : columns.value[c][row];
+
+			if (c < 0 || !(columns.written[row] & (1u << c)))
+			{
+				record.status[ch] = CHANNEL_NOT_READ;
+				record.value[ch] = NAN;
+			}
+			else if (isnan(value))
+			{
+				record.status[ch] = CHANNEL_FAILED;
+				record.value[ch] = NAN;
+			}
+			else
+			{
+				record.status[ch] = CHANNEL_OK;
+				record.value[ch] = value;
+				record.valid |= 1u << ch;
+			}
+		}
+
+		fwrite(&record, sizeof(record), 1, out);
+	}
+
+	if (fclose(out) != 0)
+	{
+		printf("Error writing %s: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	double seconds = (loaded.tv_sec - start.tv_sec) + (loaded.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%ld rows, loaded in %.3f seconds\n", columns.rows, seconds);
+
+	reportFree(&columns);
+	exit(0);
+}
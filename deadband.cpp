@@ -0,0 +1,95 @@
+//****************************************************************************
+// Deadband (report-by-exception) filter.  See deadband.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "deadband.h"
+
+struct Channel
+{
+	float deadband;			// how far it must move to be written
+	bool written;			// has been written at least once
+	float lastValue;		// last value written
+	time_t lastTime;		// when it was written
+};
+
+static Channel channel[MAX_CHANNELS];
+static int numChannels = 0;
+static int heartbeat;
+
+
+
+
+//****************************************************************************
+// Sets the deadband of each channel and the longest a channel may go
+// without being written.
+
+bool deadbandInit(int channels, const float *deadband, int heartbeatSeconds)
+{
+	if (channels > MAX_CHANNELS || heartbeatSeconds < 1)
+	{
+		printf("Bad deadband settings: %d channels, %d second heartbeat\n", channels, heartbeatSeconds);
+		return false;
+	}
+
+	numChannels = channels;
+	heartbeat = heartbeatSeconds;
+
+	memset(channel, 0, sizeof(channel));
+	for (int ch = 0; ch < channels; ch++)
+	{
+		channel[ch].deadband = deadband[ch];
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Marks the channels of a sample that should not be written as not valid.
+// Returns how many channels are still to be written; zero means skip the
+// row.
+
+int deadbandFilter(Sample *sample)
+{
+	time_t now = sample->when.tv_sec;
+	int left = 0;
+
+	for (int ch = 0; ch < numChannels && ch < sample->channels; ch++)
+	{
+		Channel *c = &channel[ch];
+		if (!sample->valid[ch])
+		{
+			// A failure is always news, and the first good reading after
+			// one is written whatever it is, so a reader never carries the
+			// value from before the failure across it.
+
+			if (sample->status[ch] > CHANNEL_OK)
+			{
+				c->written = false;
+				left++;
+			}
+			continue;
+		}
+
+		float value = sample->value[ch];
+		if (c->written && fabsf(value - c->lastValue) <= c->deadband &&
+			now - c->lastTime < heartbeat)
+		{
+			sample->valid[ch] = false;	// nothing new to say
+			sample->status[ch] = CHANNEL_NOT_READ;
+			continue;
+		}
+
+		c->written = true;
+		c->lastValue = value;
+		c->lastTime = now;
+		left++;
+	}
+
+	return left;
+}
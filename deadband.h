@@ -0,0 +1,20 @@
+//****************************************************************************
+// Report-by-exception.  In deadband mode a channel is only written to the
+// report when it has moved by more than its deadband since the last value
+// written for it, or when it has been silent for the heartbeat time.  A
+// channel that is held back is left as an empty field, and a row where
+// every channel is held back is not written at all.  A channel that failed
+// is always written (as NaN), and so is its first good reading after that.
+//
+// The gaps mean "same as the last value written"; reportreader.h fills them
+// back in for anyone reading the report.
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include "sample.h"
+
+bool deadbandInit(int channels, const float *deadband, int heartbeatSeconds);
+int deadbandFilter(Sample *sample);
+
+#endif	// DEADBAND_H
@@ -0,0 +1,458 @@
+//****************************************************************************
+// pH dosing controller.  See dosing.h for the settings.
+//
+// Everything is set up in dosingInit(), so dosingSample() is a little
+// arithmetic and at most one pin write.  The dose is ended by a timer on
+// the event loop (see reactor.h) rather than by waiting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "dosing.h"
+#include "actuator.h"
+#include "gpio.h"
+#include "metrics.h"
+#include "reactor.h"
+
+#define MAX_LINE	256
+
+// Doses are remembered for an hour to keep to the hourly limit.  Spacing
+// them at least MIN_EVERY apart means an hour's worth always fits.
+
+#define MAX_DOSES	360
+#define MIN_EVERY	(3600 / MAX_DOSES)
+
+struct Dose
+{
+	double start;			// CLOCK_MONOTONIC seconds
+	double seconds;
+};
+
+// From the settings file
+
+static bool enabled = false;
+static float setpoint;
+static float kp, ki, kd;
+static float doseMin = DEFAULT_DOSE_MIN;
+static float doseMax = DEFAULT_DOSE_MAX;
+static int every = DEFAULT_DOSE_EVERY;
+static float hourly = DEFAULT_DOSE_HOURLY;
+static float alpha = 1;			// smoothing, 1 is none
+static int stale = DEFAULT_DOSE_STALE;
+static int phChannel = -1;
+static int tempChannel = -1;		// -1 for no compensation
+static Actuator pump;
+
+// Controller state
+
+static bool started = false;		// have a smoothed pH
+static float smoothed;
+static double lastTime;			// sample time of the last pH, seconds
+static float integral;
+static float lastTemp = 25;
+static Dose dose[MAX_DOSES];
+static int nextDose = 0;
+static double lastDoseStart = -1e9;
+static int offTimer = -1;
+
+static bool parseSetting(char *line, const char *where, int channels, const char **names);
+static int findChannel(const char *name, int channels, const char **names);
+static double pumpedInLastHour(double now);
+static void pumpOff(void *arg);
+static double seconds(const struct timespec *ts);
+
+
+
+
+//****************************************************************************
+// Reads the settings and sets up the pump.  A missing file just means no
+// dosing.  Returns false after printing an error if dosing can't be done;
+// the pump is left off.
+
+bool dosingInit(const char *configFilename, int channels, const char **names)
+{
+	enabled = false;
+
+	FILE *in = fopen(configFilename, "r");
+	if (in == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			printf("Error opening dosing file %s: %s\n", configFilename, strerror(errno));
+		}
+		return false;
+	}
+
+	phChannel = findChannel("pH", channels, names);
+	setpoint = -1;
+	pump.set = NULL;
+
+	char line[MAX_LINE];
+	int lineNumber = 0;
+	bool good = true;
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineNumber++;
+
+		char *p = line;
+		while (isspace((unsigned char)*p))
+		{
+			p++;
+		}
+		if (*p == '\0' || *p == '#')
+		{
+			continue;
+		}
+
+		char where[MAX_LINE];
+		snprintf(where, sizeof(where), "%s:%d", configFilename, lineNumber);
+		if (!parseSetting(p, where, channels, names))
+		{
+			good = false;
+		}
+	}
+	fclose(in);
+
+	if (!good || phChannel < 0 || setpoint < 0 || pump.set == NULL || doseMin > doseMax)
+	{
+		if (good)
+		{
+			printf("%s: dosing needs a setpoint and a pump\n", configFilename);
+		}
+		printf("No dosing\n");
+		return false;
+	}
+
+	enabled = true;
+	printf("Dosing pH down to %.2f, gains %g %g %g\n", setpoint, kp, ki, kd);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Runs the controller on a freshly taken sample and starts a dose if one
+// is called for.  taken is when the pH itself was read (CLOCK_MONOTONIC),
+// which can be well before the sample is done if a slower sensor was in
+// the same poll.
+
+void dosingSample(const Sample *sample, const struct timespec *taken)
+{
+	if (!enabled || !sample->valid[phChannel])
+	{
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (seconds(&now) - seconds(taken) > stale / 1000.0)
+	{
+		counters.staleDoses++;
+		return;
+	}
+
+	// A pH probe's slope goes with the absolute temperature, so a reading
+	// from a probe calibrated at 25C is scaled about pH 7.
+
+	float ph = sample->value[phChannel];
+	if (tempChannel >= 0)
+	{
+		if (sample->valid[tempChannel])
+		{
+			lastTemp = sample->value[tempChannel];
+		}
+		ph = 7 + (ph - 7) * (298.15 / (lastTemp + 273.15));
+	}
+
+	double t = sample->when.tv_sec + sample->when.tv_nsec / 1e9;
+	float previous = smoothed;
+	double dt = started ? t - lastTime : 0;
+
+	smoothed = started ? smoothed + alpha * (ph - smoothed) : ph;
+	lastTime = t;
+	if (!started)
+	{
+		previous = smoothed;
+		started = true;
+	}
+
+	// The most that may be dosed right now
+
+	double mono = seconds(&now);
+	double limit = doseMax;
+	if (pump.on || mono - lastDoseStart < every)
+	{
+		limit = 0;
+	}
+	else if (hourly - pumpedInLastHour(mono) < limit)
+	{
+		limit = hourly - pumpedInLastHour(mono);
+	}
+
+	float error = smoothed - setpoint;
+	float growing = integral + ki * error * dt;
+	if (growing < 0)
+	{
+		growing = 0;
+	}
+	else if (growing > doseMax)
+	{
+		growing = doseMax;
+	}
+
+	float derivative = dt > 0 ? kd * (smoothed - previous) / dt : 0;
+	float output = kp * error + growing + derivative;
+
+	// Anti-windup: while a limit is holding the dose back the integral may
+	// shrink but not grow.
+
+	if (output <= limit || growing < integral)
+	{
+		integral = growing;
+	}
+
+	if (output > limit)
+	{
+		output = limit;
+	}
+	if (output < doseMin)
+	{
+		return;
+	}
+
+	struct timespec end = now;
+	long long ns = end.tv_nsec + (long long)(output * 1e9);
+	end.tv_sec += ns / 1000000000;
+	end.tv_nsec = ns % 1000000000;
+
+	offTimer = reactorAt(&end, pumpOff, NULL);
+	if (offTimer < 0)
+	{
+		return;		// no way to stop it again
+	}
+	if (!actuatorSet(&pump, true))
+	{
+		reactorCancel(offTimer);
+		offTimer = -1;
+		return;
+	}
+
+	struct timespec switched;
+	clock_gettime(CLOCK_MONOTONIC, &switched);
+	double latency = seconds(&switched) - seconds(taken);
+
+	dosingLatency.count++;
+	dosingLatency.sum += latency;
+	if (latency > dosingLatency.worst)
+	{
+		dosingLatency.worst = latency;
+	}
+	counters.doses++;
+
+	dose[nextDose].start = mono;
+	dose[nextDose].seconds = output;
+	nextDose = (nextDose + 1) % MAX_DOSES;
+	lastDoseStart = mono;
+
+	printf("Dosing %.1f s at pH %.2f, %.1f ms after the reading\n", output, smoothed, latency * 1000);
+}
+
+
+
+
+//****************************************************************************
+// Parses one setting.  Returns false after printing an error if it is no
+// good.
+
+static bool parseSetting(char *line, const char *where, int channels, const char **names)
+{
+	line[strcspn(line, "\r\n")] = '\0';
+
+	char *save;
+	char *keyword = strtok_r(line, " \t", &save);
+	char *arg[3];
+	int args = 0;
+	while (args < 3 && (arg[args] = strtok_r(NULL, " \t", &save)) != NULL)
+	{
+		args++;
+	}
+
+	if (strcasecmp(keyword, "setpoint") == 0 && args == 1)
+	{
+		setpoint = atof(arg[0]);
+		if (setpoint > 0 && setpoint < 14)
+		{
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "pump") == 0 && args >= 2 && strcasecmp(arg[0], "gpio") == 0)
+	{
+		bool low = args == 3 && strcasecmp(arg[2], "low") == 0;
+		if (args == 2 || low)
+		{
+			return actuatorGpio(&pump, DEFAULT_GPIO_CHIP, atoi(arg[1]), low);
+		}
+	}
+	else if (strcasecmp(keyword, "pump") == 0 && args == 2 && strcasecmp(arg[0], "sim") == 0)
+	{
+		return actuatorSim(&pump, arg[1]);
+	}
+	else if (strcasecmp(keyword, "gains") == 0 && args == 3)
+	{
+		kp = atof(arg[0]);
+		ki = atof(arg[1]);
+		kd = atof(arg[2]);
+		if (kp >= 0 && ki >= 0 && kd >= 0)
+		{
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "dose") == 0 && args == 2)
+	{
+		doseMin = atof(arg[0]);
+		doseMax = atof(arg[1]);
+		if (doseMin > 0 && doseMax >= doseMin)
+		{
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "every") == 0 && args == 1)
+	{
+		every = atoi(arg[0]);
+		if (every >= MIN_EVERY)
+		{
+			return true;
+		}
+		printf("%s: doses can't be closer than %d seconds\n", where, MIN_EVERY);
+		return false;
+	}
+	else if (strcasecmp(keyword, "hourly") == 0 && args == 1)
+	{
+		hourly = atof(arg[0]);
+		if (hourly >= 0)
+		{
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "smooth") == 0 && args == 1)
+	{
+		int samples = atoi(arg[0]);
+		if (samples >= 1)
+		{
+			alpha = 2.0 / (samples + 1);
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "compensate") == 0 && args == 1)
+	{
+		tempChannel = findChannel(arg[0], channels, names);
+		if (tempChannel >= 0)
+		{
+			return true;
+		}
+	}
+	else if (strcasecmp(keyword, "stale") == 0 && args == 1)
+	{
+		stale = atoi(arg[0]);
+		if (stale > 0)
+		{
+			return true;
+		}
+	}
+
+	printf("%s: bad dosing setting %s\n", where, keyword);
+	return false;
+}
+
+
+
+
+//****************************************************************************
+// Returns the channel with the given name, or -1.
+
+static int findChannel(const char *name, int channels, const char **names)
+{
+	for (int ch = 0; ch < channels; ch++)
+	{
+		if (strcasecmp(name, names[ch]) == 0)
+		{
+			return ch;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+// How many seconds the pump has run in the hour up to now.
+
+static double pumpedInLastHour(double now)
+{
+	double total = 0;
+	for (int i = 0; i < MAX_DOSES; i++)
+	{
+		if (dose[i].seconds > 0 && now - dose[i].start < 3600)
+		{
+			total += dose[i].seconds;
+		}
+	}
+
+	return total;
+}
+
+
+
+
+//****************************************************************************
+// The dose is done.  If the pump won't switch off, try again shortly.
+
+static void pumpOff(void *arg)
+{
+	offTimer = -1;
+	if (!actuatorSet(&pump, false))
+	{
+		offTimer = reactorAfter(1, pumpOff, NULL);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Switches the pump off, for when Monitor is stopping, so a dose that is
+// under way does not outlive it.
+
+void dosingFinish(void)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	if (offTimer >= 0)
+	{
+		reactorCancel(offTimer);
+		offTimer = -1;
+	}
+	actuatorSet(&pump, false);
+}
+
+
+
+
+//****************************************************************************
+// A CLOCK_MONOTONIC time in seconds.
+
+static double seconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
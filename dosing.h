@@ -0,0 +1,63 @@
+//****************************************************************************
+// pH dosing.  Monitor runs a PID controller on every pH reading as soon as
+// the sample is taken and doses pH down through a pump (see actuator.h),
+// instead of a script reacting to the report minutes later.
+//
+// The settings are read from their own file once at startup; if the file
+// is not there, nothing is dosed.  One setting per line, blank lines and
+// lines starting with # are ignored:
+//
+//    setpoint <pH>              the pH to hold (needed)
+//    pump gpio <line> [low]     the pump, on a GPIO pin (active low for
+//                               most relay boards) ...
+//    pump sim <file>            ... or simulated, logging to a file (needed)
+//    gains <kp> <ki> <kd>       pump seconds per pH above the setpoint, per
+//                               pH-second, and per pH/second
+//    dose <min> <max>           shortest and longest single dose, seconds
+//    every <seconds>            shortest time from one dose to the next
+//    hourly <seconds>           most pump time in any hour
+//    smooth <samples>           average the pH over about this many samples
+//    compensate <channel>       correct the pH to 25C using this temperature
+//                               channel (for a probe calibrated at 25C)
+//    stale <ms>                 don't act on a reading older than this
+//
+// For example:
+//
+//    setpoint 6.0
+//    pump gpio 22 low
+//    gains 4 0.01 0
+//    dose 0.5 5
+//    every 300
+//    hourly 30
+//    compensate PCT_C
+//
+// Only pH down is dosed, so below the setpoint the pump just stays off.
+// The integral is held within what one dose can be and stops growing while
+// a limit is holding a dose back (anti-windup).  The derivative is taken on
+// the pH rather than the error, so changing the setpoint does not kick.
+// When Monitor is stopped the pump is switched off, dose or no dose.
+//
+// The time from a reading being taken to the pump being switched for it is
+// measured and exported (see metrics.h); it is the dosing code and one
+// ioctl, since the dose is decided before the sample is written anywhere.
+
+#ifndef DOSING_H
+#define DOSING_H
+
+#include <time.h>
+
+#include "sample.h"
+
+// Defaults for anything the file doesn't say.
+
+#define DEFAULT_DOSE_MIN	0.5	// seconds
+#define DEFAULT_DOSE_MAX	5.0
+#define DEFAULT_DOSE_EVERY	300
+#define DEFAULT_DOSE_HOURLY	30.0
+#define DEFAULT_DOSE_STALE	1000	// ms
+
+bool dosingInit(const char *configFilename, int channels, const char **names);
+void dosingSample(const Sample *sample, const struct timespec *taken);
+void dosingFinish(void);
+
+#endif	// DOSING_H
@@ -0,0 +1,558 @@
+//****************************************************************************
+// Drivers for the I2C sensors.  See drivers.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "drivers.h"
+#include "i2cbus.h"
+
+// How many flushes in a row have to go through before a failed I2C_RDWR
+// is forgotten (see driverFlush()).  A poll is two or three flushes.
+
+#define SPLIT_FLUSHES	16
+
+const SensorDriver pct2075Driver = makeDriver<Pct2075>();
+const SensorDriver phDriver = makeDriver<Ph>();
+const SensorDriver sht30Driver = makeDriver<Sht30>();
+
+// How many pH conversions get thrown out after the stale one.  Monitor
+// sets it from the config; the programs just use the default.
+
+int phSettle = DEFAULT_PH_SETTLE;
+
+// The messages waiting for driverFlush(), who they belong to and what it
+// means if each one fails.
+
+static bool queueing = false;
+static bool rdwrWorks = true;		// cleared if the adapter can't do I2C_RDWR
+static int splitting = 0;		// flushes left to send a reading at a time
+static int queueFd = -1;
+static int queued = 0;
+static struct i2c_msg queue[I2C_RDWR_IOCTL_MAX_MSGS];
+static SensorReading *queueOwner[I2C_RDWR_IOCTL_MAX_MSGS];
+static int queueStatus[I2C_RDWR_IOCTL_MAX_MSGS];
+
+static bool enqueue(int fd, int addr, bool read, const unsigned char *buffer, int length,
+	int status, SensorReading *reading);
+static int sendSplit(int count);
+static void fail(int from, int to, int error);
+static void replay(int count);
+static void stamp(SensorReading *readings, const int *order, int *from, int to);
+
+
+
+
+//****************************************************************************
+// Reads one sensor: begin, wait until it is ready, fetch.  Returns the
+// status, which is also left in the reading.
+
+int driverRead(int fd, const SensorDriver *driver, SensorReading *reading)
+{
+	driverBatch(fd, &driver, 1, reading);
+	return reading->status;
+}
+
+
+
+
+//****************************************************************************
+// Reads several sensors at once.  Every one of them is started first, then
+// each is fetched as soon as it is ready, soonest first.  A sensor that
+// fails to start is not fetched; its reading just keeps the error.  The
+// transfers are queued, so this is one I2C_RDWR for the starts (and any
+// fetches that need no wait) and one per wait after that.
+
+void driverBatch(int fd, const SensorDriver **drivers, int count, SensorReading *readings)
+{
+	int order[DRIVER_MAX_BATCH];
+
+	if (count > DRIVER_MAX_BATCH)
+	{
+		count = DRIVER_MAX_BATCH;
+	}
+
+	driverQueue(true);
+
+	for (int i = 0; i < count; i++)
+	{
+		memset(&readings[i], 0, sizeof(readings[i]));
+		readings[i].addr = drivers[i]->addr;
+		readings[i].status = drivers[i]->begin(fd, &readings[i]);
+		driverReadyAt(&readings[i], drivers[i]->readyUs);
+	}
+
+	// Sort by ready time.  There are only a handful, so an insertion sort
+	// is plenty.
+
+	for (int i = 0; i < count; i++)
+	{
+		int j = i;
+		while (j > 0 && drivers[order[j - 1]]->readyUs > drivers[i]->readyUs)
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	int stamped = 0;
+	for (int i = 0; i < count; i++)
+	{
+		SensorReading *reading = &readings[order[i]];
+
+		// Whatever is queued goes out before waiting
+
+		if (drivers[order[i]]->readyUs > 0)
+		{
+			driverFlush();
+			stamp(readings, order, &stamped, i);
+		}
+
+		if (reading->status != DRIVER_OK)
+		{
+			continue;
+		}
+
+		driverWait(reading);
+		reading->status = drivers[order[i]]->fetch(fd, reading);
+	}
+
+	driverQueue(false);
+	stamp(readings, order, &stamped, count);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (readings[i].status == DRIVER_OK)
+		{
+			readings[i].status = drivers[i]->check(&readings[i].raw);
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Describes what went wrong with a reading.  The text is only good until
+// the next call.
+
+const char *driverError(const SensorReading *reading)
+{
+	static char text[128];
+
+	switch (reading->status)
+	{
+		case DRIVER_OK:
+			return "no error";
+
+		case DRIVER_SELECT_ERROR:
+			snprintf(text, sizeof(text), "Error acquiring sensor: %s", strerror(reading->error));
+			break;
+
+		case DRIVER_WRITE_ERROR:
+			snprintf(text, sizeof(text), "Error writing sensor command: %s", strerror(reading->error));
+			break;
+
+		case DRIVER_READ_ERROR:
+			snprintf(text, sizeof(text), "Reading sensor data: %s", strerror(reading->error));
+			break;
+
+		case DRIVER_CRC_ERROR:
+			return "CRC error";
+
+		case DRIVER_MUX_ERROR:
+			snprintf(text, sizeof(text), "Error selecting MUX port: %s", strerror(reading->error));
+			break;
+
+		default:
+			return "unknown error";
+	}
+
+	return text;
+}
+
+
+
+
+//****************************************************************************
+// Computes the CRC-8 the SHT30 appends to each pair of data bytes.
+
+unsigned char sht30CRC(const unsigned char *data, int length)
+{
+	unsigned char crc = SHT30_CRC_INIT;
+
+	for (int i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? (crc << 1) ^ SHT30_CRC_POLY : crc << 1;
+		}
+	}
+
+	return crc;
+}
+
+
+
+
+//****************************************************************************
+// Addresses a device and writes a command to it.
+
+int driverCommand(int fd, int addr, const unsigned char *command, int length, SensorReading *reading)
+{
+	if (enqueue(fd, addr, false, command, length, DRIVER_WRITE_ERROR, reading))
+	{
+		return DRIVER_OK;
+	}
+
+	if (i2cSelect(fd, addr) < 0)
+	{
+		reading->error = errno;
+		return DRIVER_SELECT_ERROR;
+	}
+
+	int got = i2cWrite(fd, command, length);
+	if (got != length)
+	{
+		reading->error = got < 0 ? errno : EIO;
+		return DRIVER_WRITE_ERROR;
+	}
+
+	return DRIVER_OK;
+}
+
+
+
+
+//****************************************************************************
+// Addresses a device, writes a command to it and reads the answer.
+
+int driverTransfer(int fd, int addr, const unsigned char *command, int commandLength,
+	unsigned char *buffer, int length, SensorReading *reading)
+{
+	if (enqueue(fd, addr, false, command, commandLength, DRIVER_WRITE_ERROR, reading))
+	{
+		enqueue(fd, addr, true, buffer, length, DRIVER_READ_ERROR, reading);
+		return DRIVER_OK;
+	}
+
+	int status = driverCommand(fd, addr, command, commandLength, reading);
+
+	if (status != DRIVER_OK)
+	{
+		return status;
+	}
+
+	// Still selected from the command, so just read
+
+	int got = i2cRead(fd, buffer, length);
+	if (got != length)
+	{
+		reading->error = got < 0 ? errno : EIO;
+		return DRIVER_READ_ERROR;
+	}
+
+	return DRIVER_OK;
+}
+
+
+
+
+//****************************************************************************
+// Addresses a device and reads from it.  A short read counts as an error.
+
+int driverFetch(int fd, int addr, unsigned char *buffer, int length, SensorReading *reading)
+{
+	if (enqueue(fd, addr, true, buffer, length, DRIVER_READ_ERROR, reading))
+	{
+		return DRIVER_OK;
+	}
+
+	if (i2cSelect(fd, addr) < 0)
+	{
+		reading->error = errno;
+		return DRIVER_SELECT_ERROR;
+	}
+
+	int got = i2cRead(fd, buffer, length);
+	if (got != length)
+	{
+		reading->error = got < 0 ? errno : EIO;
+		return DRIVER_READ_ERROR;
+	}
+
+	return DRIVER_OK;
+}
+
+
+
+
+//****************************************************************************
+// Switches the TCA9548A a sensor sits behind over to its port.  Sensors
+// that are not behind a mux are left alone.  The switch only happens on a
+// STOP, so when queueing the queue is sent right away.
+
+int driverMux(const SensorSlot *slot, SensorReading *reading)
+{
+	if (slot->muxAddr == 0)
+	{
+		return DRIVER_OK;
+	}
+
+	unsigned char port = 1 << slot->muxPort;
+	if (enqueue(slot->fd, slot->muxAddr, false, &port, 1, DRIVER_MUX_ERROR, reading))
+	{
+		driverFlush();
+		return reading->status;
+	}
+
+	if (driverCommand(slot->fd, slot->muxAddr, &port, 1, reading) != DRIVER_OK)
+	{
+		return DRIVER_MUX_ERROR;
+	}
+
+	return DRIVER_OK;
+}
+
+
+
+
+//****************************************************************************
+// Works out when a reading that was just started can be fetched.
+
+void driverReadyAt(SensorReading *reading, int readyUs)
+{
+	clock_gettime(CLOCK_MONOTONIC, &reading->ready);
+
+	reading->ready.tv_nsec += readyUs * 1000L;
+	while (reading->ready.tv_nsec >= 1000000000L)
+	{
+		reading->ready.tv_sec++;
+		reading->ready.tv_nsec -= 1000000000L;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Sleeps until a reading can be fetched.
+
+void driverWait(const SensorReading *reading)
+{
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &reading->ready, NULL) == EINTR)
+	{
+	}
+}
+
+
+
+
+//****************************************************************************
+// Turns queueing on or off.  Turning it off sends whatever is queued.
+
+void driverQueue(bool on)
+{
+	if (!on)
+	{
+		driverFlush();
+	}
+
+	queueing = on;
+}
+
+
+
+
+//****************************************************************************
+// Sends everything queued as one I2C_RDWR.  An adapter without I2C_RDWR
+// gets the messages one by one instead.
+//
+// If the I2C_RDWR itself fails, some of the messages may already have gone
+// out, and sending them again would repeat writes the devices acted on
+// (mux selects, measure commands, control bytes).  So every reading in it
+// fails, and from then on each reading gets an I2C_RDWR of its own, so one
+// sensor that has gone missing only fails itself (until health.h takes it
+// out of the polls).  After SPLIT_FLUSHES of those in a row with nothing
+// failing it is back to one for everything.
+
+void driverFlush(void)
+{
+	int count = queued;
+	queued = 0;
+
+	if (count == 0)
+	{
+		return;
+	}
+
+	if (rdwrWorks && splitting > 0)
+	{
+		splitting = sendSplit(count) > 0 ? SPLIT_FLUSHES : splitting - 1;
+		return;
+	}
+
+	if (rdwrWorks)
+	{
+		if (i2cTransfer(queueFd, queue, count) == count)
+		{
+			return;
+		}
+
+		if (errno != ENOTTY && errno != EOPNOTSUPP)
+		{
+			fail(0, count, errno);
+			splitting = SPLIT_FLUSHES;
+			return;
+		}
+
+		rdwrWorks = false;
+	}
+
+	replay(count);
+}
+
+
+
+
+//****************************************************************************
+// Adds a message to the queue, sending the queue first if it is full or for
+// another bus.  Returns false if not queueing, so the caller does the
+// transfer itself.
+
+static bool enqueue(int fd, int addr, bool read, const unsigned char *buffer, int length,
+	int status, SensorReading *reading)
+{
+	if (!queueing)
+	{
+		return false;
+	}
+
+	if (queued > 0 && (fd != queueFd || queued == I2C_RDWR_IOCTL_MAX_MSGS))
+	{
+		driverFlush();
+	}
+
+	struct i2c_msg *message = &queue[queued];
+	message->addr = addr;
+	message->flags = read ? I2C_M_RD : 0;
+	message->len = length;
+	message->buf = (unsigned char *)buffer;		// only written to for reads
+
+	queueOwner[queued] = reading;
+	queueStatus[queued] = status;
+	queueFd = fd;
+	queued++;
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Sends the queue as one I2C_RDWR per reading (per run of its messages,
+// strictly).  Returns how many of them failed.
+
+static int sendSplit(int count)
+{
+	int failures = 0;
+
+	for (int from = 0, to; from < count; from = to)
+	{
+		for (to = from + 1; to < count && queueOwner[to] == queueOwner[from]; to++)
+		{
+		}
+
+		if (queueOwner[from]->status == DRIVER_OK &&
+			i2cTransfer(queueFd, &queue[from], to - from) != to - from)
+		{
+			fail(from, to, errno);
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+
+
+
+//****************************************************************************
+// Fails the readings of the queued messages from up to to, each with the
+// status its first message there says.
+
+static void fail(int from, int to, int error)
+{
+	for (int i = from; i < to; i++)
+	{
+		SensorReading *reading = queueOwner[i];
+		if (reading->status == DRIVER_OK)
+		{
+			reading->error = error;
+			reading->status = queueStatus[i];
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Sends queued messages one at a time.  Once one of a reading's messages
+// fails the rest of its messages are skipped.
+
+static void replay(int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		struct i2c_msg *message = &queue[i];
+		SensorReading *reading = queueOwner[i];
+
+		if (reading->status != DRIVER_OK)
+		{
+			continue;
+		}
+
+		if (i2cSelect(queueFd, message->addr) < 0)
+		{
+			reading->error = errno;
+			reading->status = queueStatus[i] == DRIVER_MUX_ERROR ? DRIVER_MUX_ERROR : DRIVER_SELECT_ERROR;
+			continue;
+		}
+
+		int got = message->flags & I2C_M_RD ?
+			i2cRead(queueFd, message->buf, message->len) :
+			i2cWrite(queueFd, message->buf, message->len);
+
+		if (got != message->len)
+		{
+			reading->error = got < 0 ? errno : EIO;
+			reading->status = queueStatus[i];
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Sets the fetched time of the readings in order[from] up to order[to],
+// which have just been sent.
+
+static void stamp(SensorReading *readings, const int *order, int *from, int to)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (; *from < to; (*from)++)
+	{
+		readings[order[*from]].fetched = now;
+	}
+}
@@ -0,0 +1,541 @@
+//****************************************************************************
+// Drivers for the I2C sensors, and the DS18B20 1-Wire probes.  Monitor
+// and the little pct2075, ph and sht30 programs all read the sensors
+// through these.
+//
+// Every sensor is read the same way, in five steps:
+//
+//    begin    start a conversion
+//    ready    how long after begin the result can be fetched
+//    fetch    read the raw bytes back
+//    check    check them, if the part sends a CRC
+//    decode   turn the raw bytes into values, in engineering units
+//
+// Nothing here prints anything.  Each step returns a DRIVER_ status and the
+// errno that went with it is saved in the reading, so the caller decides
+// what to say about it.  Splitting the read up this way is what lets
+// driverBatch() start every sensor, then collect each one as it becomes
+// ready, so the sensors' measurement times overlap instead of adding up.
+//
+// Between driverQueue(true) and driverQueue(false) the transfers are not
+// done right away: their messages are queued up and sent together as one
+// I2C_RDWR ioctl when driverFlush() is called, so a whole poll cycle is a
+// few system calls instead of a dozen or more.  The steps then return
+// DRIVER_OK and a failure shows up in the reading's status after the
+// flush, which is why check is a step of its own.  A queue is sent early
+// when it fills up (the kernel takes 42 messages at most) and after every
+// mux switch, since the TCA9548A only changes ports on a STOP.
+//
+// If a batch fails, every reading in it fails: some of its messages may
+// have gone out already, and sending them again would repeat writes the
+// devices acted on.  The next few flushes then give each reading an
+// I2C_RDWR of its own, so a sensor that has gone missing only fails
+// itself, and after enough of them go through cleanly it is back to one
+// for everything.  Only an adapter that can't do I2C_RDWR at all (ENOTTY
+// or EOPNOTSUPP) has its messages sent again, one at a time.
+//
+//    SensorReading reading;
+//    float values[DRIVER_MAX_VALUES];
+//    if (driverRead(fd, &pct2075Driver, &reading) == DRIVER_OK)
+//    {
+//        pct2075Driver.decode(&reading.raw, values);
+//        ... values[0] is C, values[1] is F ...
+//    }
+
+#ifndef DRIVERS_H
+#define DRIVERS_H
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// This is the I2C address of the PCT2075 sensor.  Do not change this unless
+// the device is moved to a different address via the address selection bits.
+
+#define PCT2075_ADDR	0x37
+
+// This is the I2C address of the PCF8591 ADC.  Do not change this unless
+// the device is moved to a different address via the address selection bits.
+
+#define ADC_ADDR	0x48
+
+// This is the I2C address of the SHT30 sensor.  Do not change this unless
+// the device is moved to a different address via the address selection bits.
+
+#define SHT30_ADDR	0x44
+
+// Microseconds in a millisecond
+
+#define US_IN_MS	1000
+
+// The maximum voltage that the pH sensor provides.  It is always 3.3 volts.
+
+#define SENSOR_VOLTAGE	3.3
+
+// Constants for converting voltage into pH.  Beats me what the values mean.
+
+#define CONSTANT	-19.18518519
+#define OFFSET		41.02740741		//deviation compensate
+
+// Every byte read from the PCF8591 is a conversion, started as the byte
+// before it is acked, so the first byte of a read is whatever was converted
+// at the end of the last read, however long ago that was.  A pH read
+// throws that one out, then phSettle more while the input settles, and
+// averages the PH_SAMPLES after that, all in the one read.  At 100 kHz a
+// conversion is 90us.  "ph -c" works out how many need throwing out for
+// the board it is run on; the config sets it with "ph settle <n>".
+
+#define PH_SAMPLES		4
+#define PH_MAX_SETTLE		16
+#define DEFAULT_PH_SETTLE	1
+
+// The SHT30 sends a CRC after each pair of data bytes.  This is the CRC-8
+// the datasheet describes: polynomial 0x31, starting value 0xFF.
+
+#define SHT30_CRC_POLY	0x31
+#define SHT30_CRC_INIT	0xFF
+
+// A high repeatability measurement takes up to 15ms.  Fetching any sooner
+// still works (the part holds the clock until it is done) but ties up the
+// bus while it waits.
+
+#define SHT30_MEASURE_US	(15 * US_IN_MS)
+
+// DS18B20s are read through the kernel's w1 driver in sysfs (see w1.cpp),
+// which can be pointed somewhere else for testing.  A 12 bit conversion
+// takes up to 750ms.  The first DS18B20_PROBES of them, in order of their
+// ROM ids, are read; a probe keeps its column as long as the probes on the
+// bus stay the same.
+
+#define DEFAULT_W1_ROOT		"/sys/bus/w1/devices"
+#define W1_PATH_SIZE		128
+#define DS18B20_PROBES		2
+#define DS18B20_CONVERT_US	(750 * US_IN_MS)
+
+// The most values any one sensor decodes to, and the most sensors one
+// batch can read.
+
+#define DRIVER_MAX_VALUES	4
+#define DRIVER_MAX_BATCH	16
+
+enum
+{
+	DRIVER_OK,
+	DRIVER_SELECT_ERROR,		// could not address the device
+	DRIVER_WRITE_ERROR,		// sending the command failed
+	DRIVER_READ_ERROR,		// reading the data failed or came up short
+	DRIVER_CRC_ERROR,		// the data came back but was corrupt
+	DRIVER_MUX_ERROR		// could not switch the mux to the sensor
+};
+
+// Raw data as it comes off the wire, one layout per sensor.
+
+struct Pct2075Raw
+{
+	unsigned char data[2];		// temperature register, MSB first
+};
+
+struct PhRaw
+{
+	unsigned char settle;		// conversions thrown out after data[0]
+	unsigned char data[1 + PH_MAX_SETTLE + PH_SAMPLES];
+};
+
+struct Sht30Raw
+{
+	unsigned char data[6];		// temp, CRC, humidity, CRC
+};
+
+struct Ds18b20Raw
+{
+	int milliC[DS18B20_PROBES];	// as sysfs gives them
+	unsigned char present;		// bit n set if probe n was read
+};
+
+union SensorRaw
+{
+	Pct2075Raw pct2075;
+	PhRaw ph;
+	Sht30Raw sht30;
+	Ds18b20Raw ds18b20;
+};
+
+// Where a sensor is: the bus it is on (an open /dev/i2c-N), its address,
+// and the TCA9548A mux port it sits behind, if any.
+
+struct SensorSlot
+{
+	int fd;
+	int addr;
+	int muxAddr;			// zero if there is no mux
+	int muxPort;
+};
+
+struct SensorReading
+{
+	int status;			// DRIVER_OK or what went wrong
+	int error;			// errno, for select, write and read errors
+	int addr;			// the address the steps talk to
+	struct timespec ready;		// when fetch can be called, set by begin
+	struct timespec fetched;	// when the data came back (CLOCK_MONOTONIC)
+	SensorRaw raw;
+};
+
+struct SensorDriver
+{
+	const char *name;
+	int addr;
+	int values;			// how many values decode fills in
+	const char *columns;		// report column headers for those values
+	int readyUs;			// from begin until the data can be fetched
+	int (*begin)(int fd, SensorReading *reading);
+	int (*fetch)(int fd, SensorReading *reading);
+	int (*check)(const SensorRaw *raw);
+	void (*decode)(const SensorRaw *raw, float *values);
+};
+
+//****************************************************************************
+// Converts the two bytes read from the PCT2075 temperature register.
+//
+// Okay, so I had to play around a bit to get reasonable values, although
+// it does not seem to jive with the datasheet.  Whatever, it works.
+
+static inline void pct2075Convert(const unsigned char *raw, float *cTemp, float *fTemp)
+{
+	unsigned value = (raw[0] << 8) | raw[1];
+	*cTemp = value / 256.0;
+	*fTemp = (*cTemp * 9.0 / 5.0) + 32;
+}
+
+//****************************************************************************
+// The average of the conversions in a pH read that count (see PH_SAMPLES).
+
+static inline float phAverage(const PhRaw *raw)
+{
+	int total = 0;
+	for (int i = 0; i < PH_SAMPLES; i++)
+	{
+		total += raw->data[1 + raw->settle + i];
+	}
+
+	return total / (float)PH_SAMPLES;
+}
+
+//****************************************************************************
+// Converts a PCF8591 reading of the pH sensor into a pH.
+
+static inline float phConvert(float raw)
+{
+	float voltage = raw * (SENSOR_VOLTAGE / 255);
+	return CONSTANT * voltage + OFFSET;
+}
+
+//****************************************************************************
+// Converts the six bytes read from the SHT30 (CRCs already checked).
+
+static inline void sht30Convert(const unsigned char *raw, float *cTemp, float *fTemp, float *humidity)
+{
+	float temp = raw[0] * 256 + raw[1];
+	*cTemp = -45 + (175 * temp / 65536.0);
+	*fTemp = -49 + (315 * temp / 65536.0);
+	*humidity = 100 * (raw[3] * 256 + raw[4]) / 65536.0;
+}
+
+unsigned char sht30CRC(const unsigned char *data, int length);
+int driverCommand(int fd, int addr, const unsigned char *command, int length, SensorReading *reading);
+int driverFetch(int fd, int addr, unsigned char *buffer, int length, SensorReading *reading);
+int driverTransfer(int fd, int addr, const unsigned char *command, int commandLength,
+	unsigned char *buffer, int length, SensorReading *reading);
+int driverMux(const SensorSlot *slot, SensorReading *reading);
+void driverReadyAt(SensorReading *reading, int readyUs);
+void driverWait(const SensorReading *reading);
+void driverQueue(bool on);
+void driverFlush(void);
+
+extern int phSettle;
+extern char w1Root[W1_PATH_SIZE];
+
+int w1Trigger(SensorReading *reading);
+int w1Fetch(Ds18b20Raw *raw, SensorReading *reading);
+bool w1Found(void);
+
+//****************************************************************************
+// The drivers themselves.  Each sensor is a type: what is known about it
+// is in constants and its steps are static functions, so a sensor list
+// built at compile time (sensortable.h) calls them directly and they get
+// inlined.  CANDIDATES are the addresses the part can be set to, and
+// identify() checks whether what is at an address really is one; SIGNATURE
+// says how much that check proves (2 for a register or CRC check, 1 for
+// "it answered"), so the stronger checks get to go first.  The SensorDriver
+// tables further down are made from the same types, for code that picks
+// its sensors at run time.
+//
+// MESSAGES and BYTES are what one read (begin and fetch together) puts on
+// the bus, not counting mux switches; the schedule is checked against the
+// bus speed with them (see schedule.h).  A sensor that isn't on I2C at all
+// says so with I2C: its steps ignore the fd, and probing, bus recovery
+// and the bus schedule leave it out.
+
+struct Pct2075
+{
+	static constexpr char NAME[] = "PCT2075";
+	static constexpr char COLUMNS[] = "PCT_C,PCT_F";
+	static constexpr int ADDR = PCT2075_ADDR;	// the usual address
+	static constexpr int VALUES = 2;
+	static constexpr bool I2C = true;
+	static constexpr int READY_US = 0;
+	static constexpr int MESSAGES = 2;		// pointer write, 2 byte read
+	static constexpr int BYTES = 3;
+
+	// The address pins are three-state, so there are 27 possible addresses.
+	// 0x48 to 0x4F are left out: the PCF8591 lives there, and identify()
+	// would write its pointer bytes into the ADC's control register (and a
+	// quiet ADC passes the check).  One set to any of those is still found
+	// where the config says it is (see probe.cpp).
+
+	static constexpr unsigned char CANDIDATES[] =
+	{
+		0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x35, 0x36, 0x37,
+		0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77
+	};
+	static constexpr int SIGNATURE = 2;
+
+	// The PCT2075 converts all the time, so starting it just points it at
+	// the temperature register, address 0.
+
+	static int begin(int fd, SensorReading *reading)
+	{
+		static const unsigned char command = 0x00;
+		return driverCommand(fd, reading->addr, &command, 1, reading);
+	}
+
+	static int fetch(int fd, SensorReading *reading)
+	{
+		return driverFetch(fd, reading->addr, reading->raw.pct2075.data, 2, reading);
+	}
+
+	static int check(const SensorRaw *raw)
+	{
+		return DRIVER_OK;
+	}
+
+	// C, F
+
+	static void decode(const SensorRaw *raw, float *values)
+	{
+		pct2075Convert(raw->pct2075.data, &values[0], &values[1]);
+	}
+
+	// Is this a PCT2075?  Tos and Thyst are 9 bit values, so the low 7
+	// bits of each always read back as zero, and only the low 5 bits of
+	// Tidle are used.  (The pointer is left on Tidle; begin sets it back.)
+
+	static bool identify(int fd, int addr)
+	{
+		static const unsigned char tos = 0x03, thyst = 0x02, tidle = 0x04;
+		SensorReading scratch;
+		unsigned char data[2];
+
+		return driverTransfer(fd, addr, &tos, 1, data, 2, &scratch) == DRIVER_OK &&
+			(data[1] & 0x7F) == 0 &&
+			driverTransfer(fd, addr, &thyst, 1, data, 2, &scratch) == DRIVER_OK &&
+			(data[1] & 0x7F) == 0 &&
+			driverTransfer(fd, addr, &tidle, 1, data, 1, &scratch) == DRIVER_OK &&
+			(data[0] & 0xE0) == 0;
+	}
+};
+
+struct Ph
+{
+	static constexpr char NAME[] = "pH";
+	static constexpr char COLUMNS[] = "pH";
+	static constexpr int ADDR = ADC_ADDR;		// the usual address
+	static constexpr int VALUES = 1;
+	static constexpr bool I2C = true;
+	static constexpr int READY_US = 0;
+	static constexpr int MESSAGES = 2;		// control byte, then the read
+	static constexpr int BYTES = 2 + 1 + DEFAULT_PH_SETTLE + PH_SAMPLES;	// schedule.cpp adds any more settle
+
+	static constexpr unsigned char CANDIDATES[] =
+	{
+		0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F
+	};
+	static constexpr int SIGNATURE = 1;
+
+	// Selects input 0.  The conversions happen during the read, so there
+	// is nothing to wait for.
+
+	static int begin(int fd, SensorReading *reading)
+	{
+		static const unsigned char command[2] = { 0x00, 0x00 };
+		return driverCommand(fd, reading->addr, command, 2, reading);
+	}
+
+	// Reads the stale conversion, the settling ones and the samples in one
+	// go (see PH_SAMPLES).
+
+	static int fetch(int fd, SensorReading *reading)
+	{
+		reading->raw.ph.settle = phSettle;
+		return driverFetch(fd, reading->addr, reading->raw.ph.data, 1 + phSettle + PH_SAMPLES, reading);
+	}
+
+	static int check(const SensorRaw *raw)
+	{
+		return DRIVER_OK;
+	}
+
+	// pH
+
+	static void decode(const SensorRaw *raw, float *values)
+	{
+		values[0] = phConvert(phAverage(&raw->ph));
+	}
+
+	// The PCF8591 has nothing to identify it by, so anything at one of its
+	// addresses that takes a control byte and answers is taken to be one.
+	// That is why it is tried after the sensors that can be recognized.
+
+	static bool identify(int fd, int addr)
+	{
+		static const unsigned char command[2] = { 0x00, 0x00 };
+		SensorReading scratch;
+		unsigned char data[2];
+
+		return driverTransfer(fd, addr, command, 2, data, 2, &scratch) == DRIVER_OK;
+	}
+};
+
+struct Sht30
+{
+	static constexpr char NAME[] = "SHT30";
+	static constexpr char COLUMNS[] = "TempC,TempF,Humidity";
+	static constexpr int ADDR = SHT30_ADDR;		// the usual address
+	static constexpr int VALUES = 3;
+	static constexpr bool I2C = true;
+	static constexpr int READY_US = SHT30_MEASURE_US;
+	static constexpr int MESSAGES = 2;		// 2 byte command, 6 byte read
+	static constexpr int BYTES = 8;
+
+	static constexpr unsigned char CANDIDATES[] = { 0x44, 0x45 };
+	static constexpr int SIGNATURE = 2;
+
+	// Starts a high repeatability measurement with clock stretching.
+
+	static int begin(int fd, SensorReading *reading)
+	{
+		static const unsigned char command[2] = { 0x2c, 0x06 };
+		return driverCommand(fd, reading->addr, command, 2, reading);
+	}
+
+	static int fetch(int fd, SensorReading *reading)
+	{
+		return driverFetch(fd, reading->addr, reading->raw.sht30.data, 6, reading);
+	}
+
+	// Each pair of bytes is followed by its CRC.  Bad data is thrown out
+	// rather than logged.
+
+	static int check(const SensorRaw *raw)
+	{
+		const unsigned char *data = raw->sht30.data;
+
+		if (sht30CRC(data, 2) != data[2] || sht30CRC(data + 3, 2) != data[5])
+		{
+			return DRIVER_CRC_ERROR;
+		}
+
+		return DRIVER_OK;
+	}
+
+	// C, F, humidity
+
+	static void decode(const SensorRaw *raw, float *values)
+	{
+		sht30Convert(raw->sht30.data, &values[0], &values[1], &values[2]);
+	}
+
+	// Is this an SHT30?  Reads the status register, which comes with a CRC.
+
+	static bool identify(int fd, int addr)
+	{
+		static const unsigned char command[2] = { 0xF3, 0x2D };
+		SensorReading scratch;
+		unsigned char data[3];
+
+		return driverTransfer(fd, addr, command, 2, data, 3, &scratch) == DRIVER_OK &&
+			sht30CRC(data, 2) == data[2];
+	}
+};
+
+struct Ds18b20
+{
+	static constexpr char NAME[] = "DS18B20";
+	static constexpr char COLUMNS[] = "Probe1_C,Probe2_C";
+	static constexpr int ADDR = 0;			// 1-Wire, found by ROM id
+	static constexpr int VALUES = DS18B20_PROBES;
+	static constexpr bool I2C = false;
+	static constexpr int READY_US = DS18B20_CONVERT_US;
+	static constexpr int MESSAGES = 0;
+	static constexpr int BYTES = 0;
+
+	static constexpr unsigned char CANDIDATES[] = { 0 };
+	static constexpr int SIGNATURE = 0;		// never tried on I2C
+
+	// Every probe on the bus converts at once, and none of it waits.
+
+	static int begin(int fd, SensorReading *reading)
+	{
+		return w1Trigger(reading);
+	}
+
+	static int fetch(int fd, SensorReading *reading)
+	{
+		return w1Fetch(&reading->raw.ds18b20, reading);
+	}
+
+	static int check(const SensorRaw *raw)
+	{
+		return DRIVER_OK;
+	}
+
+	// C for each probe, NaN for one that isn't there
+
+	static void decode(const SensorRaw *raw, float *values)
+	{
+		for (int i = 0; i < DS18B20_PROBES; i++)
+		{
+			values[i] = raw->ds18b20.present & (1 << i) ? raw->ds18b20.milliC[i] / 1000.0 : NAN;
+		}
+	}
+
+	static bool identify(int fd, int addr)
+	{
+		return w1Found();
+	}
+};
+
+//****************************************************************************
+// Makes the run time table for a driver type.
+
+template <typename Driver>
+constexpr SensorDriver makeDriver(void)
+{
+	static_assert(Driver::VALUES <= DRIVER_MAX_VALUES, "too many values for DRIVER_MAX_VALUES");
+
+	return SensorDriver
+	{
+		Driver::NAME, Driver::ADDR, Driver::VALUES, Driver::COLUMNS, Driver::READY_US,
+		Driver::begin, Driver::fetch, Driver::check, Driver::decode
+	};
+}
+
+extern const SensorDriver pct2075Driver;
+extern const SensorDriver phDriver;
+extern const SensorDriver sht30Driver;
+
+int driverRead(int fd, const SensorDriver *driver, SensorReading *reading);
+void driverBatch(int fd, const SensorDriver **drivers, int count, SensorReading *readings);
+const char *driverError(const SensorReading *reading);
+
+#endif	// DRIVERS_H
@@ -0,0 +1,72 @@
+//****************************************************************************
+// GPIO output pins via the character device.  See gpio.h.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "gpio.h"
+
+
+
+
+//****************************************************************************
+// Requests one line of a GPIO chip as an output and sets its initial value.
+// Returns an fd used to drive the pin, or -1 after printing an error.
+
+int gpioOpenOutput(const char *chip, int line, int initial)
+{
+	int chipfd = open(chip, O_RDWR);
+	if (chipfd < 0)
+	{
+		printf("Error opening GPIO chip %s: %s\n", chip, strerror(errno));
+		return -1;
+	}
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof(request));
+	request.offsets[0] = line;
+	request.num_lines = 1;
+	snprintf(request.consumer, sizeof(request.consumer), "Monitor");
+	request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	request.config.num_attrs = 1;
+	request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	request.config.attrs[0].attr.values = initial ? 1 : 0;
+	request.config.attrs[0].mask = 1;
+
+	int result = ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &request);
+	close(chipfd);		// the line fd stays valid on its own
+
+	if (result < 0)
+	{
+		printf("Error requesting GPIO line %d on %s: %s\n", line, chip, strerror(errno));
+		return -1;
+	}
+
+	return request.fd;
+}
+
+
+
+
+//****************************************************************************
+// Drives a line opened with gpioOpenOutput high (non-zero) or low.
+
+bool gpioWrite(int fd, int value)
+{
+	struct gpio_v2_line_values values;
+	values.bits = value ? 1 : 0;
+	values.mask = 1;
+
+	if (ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+	{
+		printf("Error writing GPIO line: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
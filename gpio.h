@@ -0,0 +1,16 @@
+//****************************************************************************
+// Minimal access to output pins through the GPIO character device
+// (/dev/gpiochipN).  A line is requested once and then driven with a single
+// ioctl, so setting a pin is cheap enough to do from the sampling loop.
+
+#ifndef GPIO_H
+#define GPIO_H
+
+// The Raspberry Pi header pins are all on the first chip.
+
+#define DEFAULT_GPIO_CHIP	"/dev/gpiochip0"
+
+int gpioOpenOutput(const char *chip, int line, int initial);
+bool gpioWrite(int fd, int value);
+
+#endif	// GPIO_H
@@ -0,0 +1,197 @@
+//****************************************************************************
+// Sensor health and stuck bus recovery.  See health.h.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "health.h"
+#include "recover.h"
+#include "metrics.h"
+
+struct Health
+{
+	int state;
+	int failures;			// failed reads in a row
+	int backoff;			// seconds, zero until first quarantined
+	time_t until;			// end of the quarantine
+};
+
+static const char *stateNames[] = { "healthy", "degraded", "quarantined", "probing" };
+
+static Health health[NUM_SENSORS];
+static int stuckCycles[MAX_BUSES];
+static time_t lastRecovery[MAX_BUSES];
+
+static void sensorResult(int sensor, bool good, time_t now);
+static void busResults(const Config *config, const bool *polled, unsigned failed, time_t now);
+
+
+
+
+//****************************************************************************
+// Everything starts out healthy.  Called again when the config changes,
+// since the sensors may have moved.
+
+void healthInit(void)
+{
+	memset(health, 0, sizeof(health));
+	memset(stuckCycles, 0, sizeof(stuckCycles));
+}
+
+
+
+
+//****************************************************************************
+// Says whether a sensor that is due should really be read.  A quarantined
+// sensor whose backoff has run out gets its one trial read.
+
+bool healthReady(int sensor, time_t now)
+{
+	Health *h = &health[sensor];
+
+	if (h->state != HEALTH_QUARANTINED)
+	{
+		return true;
+	}
+	if (now < h->until)
+	{
+		return false;
+	}
+
+	h->state = HEALTH_PROBING;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Takes in how a poll cycle went: polled says which sensors were read and
+// failed has bit i set if sensor i failed.
+
+void healthResults(const Config *config, const bool *polled, unsigned failed, time_t now)
+{
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (polled[i])
+		{
+			sensorResult(i, (failed & (1u << i)) == 0, now);
+		}
+	}
+
+	busResults(config, polled, failed, now);
+}
+
+
+
+
+//****************************************************************************
+
+int healthState(int sensor)
+{
+	return health[sensor].state;
+}
+
+
+
+
+//****************************************************************************
+// Moves one sensor through the states.
+
+static void sensorResult(int sensor, bool good, time_t now)
+{
+	Health *h = &health[sensor];
+	int was = h->state;
+
+	if (good)
+	{
+		h->state = HEALTH_HEALTHY;
+		h->failures = 0;
+		h->backoff = 0;
+	}
+	else if (h->state == HEALTH_PROBING || ++h->failures >= HEALTH_FAILURES)
+	{
+		h->backoff = h->backoff == 0 ? HEALTH_BACKOFF_FIRST : h->backoff * 2;
+		if (h->backoff > HEALTH_BACKOFF_MAX)
+		{
+			h->backoff = HEALTH_BACKOFF_MAX;
+		}
+		h->until = now + h->backoff;
+		h->state = HEALTH_QUARANTINED;
+		counters.quarantines++;
+
+		printf("%s quarantined, trying again in %d seconds\n", BoardSensors::NAMES[sensor], h->backoff);
+		return;
+	}
+	else
+	{
+		h->state = HEALTH_DEGRADED;
+	}
+
+	if (h->state != was && (h->state != HEALTH_DEGRADED || was != HEALTH_HEALTHY))
+	{
+		printf("%s is %s\n", BoardSensors::NAMES[sensor], stateNames[h->state]);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Looks for buses where nothing worked, and tries to unstick them.
+
+static void busResults(const Config *config, const bool *polled, unsigned failed, time_t now)
+{
+	for (int b = 0; b < config->buses; b++)
+	{
+		const Bus *bus = &config->bus[b];
+		bool tried = false;
+		bool worked = false;
+
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			if (polled[i] && BoardSensors::I2C_OF[i] && config->sensorBus[i] == b)
+			{
+				tried = true;
+				worked |= (failed & (1u << i)) == 0;
+			}
+		}
+
+		if (!tried)
+		{
+			continue;
+		}
+		if (worked)
+		{
+			stuckCycles[b] = 0;
+			continue;
+		}
+
+		if (++stuckCycles[b] < HEALTH_STUCK_CYCLES || bus->scl < 0 ||
+			now - lastRecovery[b] < HEALTH_RECOVER_EVERY)
+		{
+			continue;
+		}
+
+		lastRecovery[b] = now;
+		stuckCycles[b] = 0;
+		counters.busRecoveries++;
+
+		if (!busRecover(bus->scl, bus->sda))
+		{
+			printf("Bus %s is stuck and could not be freed\n", bus->name);
+			continue;
+		}
+
+		// Whatever was wrong with its sensors may have been the bus
+
+		printf("Bus %s was stuck, clocked it free\n", bus->name);
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			if (BoardSensors::I2C_OF[i] && config->sensorBus[i] == b && health[i].state == HEALTH_QUARANTINED)
+			{
+				health[i].until = now;
+			}
+		}
+	}
+}
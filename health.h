@@ -0,0 +1,48 @@
+//****************************************************************************
+// How each sensor is doing, so that one which has gone bad does not hold up
+// the rest.  Every sensor is in one of these states:
+//
+//    HEALTHY      its last read was good
+//    DEGRADED     its last read failed, but it is still read on schedule
+//    QUARANTINED  HEALTH_FAILURES reads in a row failed, so it is left
+//                 alone until its backoff runs out
+//    PROBING      the backoff ran out and one trial read is allowed; if it
+//                 works the sensor is HEALTHY again, if not it goes back to
+//                 QUARANTINED for twice as long (up to HEALTH_BACKOFF_MAX)
+//
+// A quarantined sensor costs nothing, so the healthy ones keep their
+// timing.  Together with the transfer timeout set when a bus is opened (see
+// config.cpp) one bad read can only cost a cycle that much.
+//
+// A bus where every sensor read fails for HEALTH_STUCK_CYCLES cycles in a
+// row is probably stuck, with some device holding SDA low.  If the config
+// gives its pins the bus is clocked free (see recover.h), at most once
+// every HEALTH_RECOVER_EVERY seconds, and its sensors get a fresh start.
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <time.h>
+
+#include "config.h"
+
+#define HEALTH_FAILURES		3	// failed reads in a row
+#define HEALTH_BACKOFF_FIRST	60	// seconds
+#define HEALTH_BACKOFF_MAX	3600
+#define HEALTH_STUCK_CYCLES	2
+#define HEALTH_RECOVER_EVERY	60	// seconds
+
+enum
+{
+	HEALTH_HEALTHY,
+	HEALTH_DEGRADED,
+	HEALTH_QUARANTINED,
+	HEALTH_PROBING
+};
+
+void healthInit(void);
+bool healthReady(int sensor, time_t now);
+void healthResults(const Config *config, const bool *polled, unsigned failed, time_t now);
+int healthState(int sensor);
+
+#endif	// HEALTH_H
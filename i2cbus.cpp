@@ -0,0 +1,470 @@
+//****************************************************************************
+// Instrumented I2C access.  See i2cbus.h.
+//
+// Times are kept in nanoseconds.  A histogram bucket index is the power of
+// two of the value plus the next three bits below the top bit, which is the
+// same trick HDR histograms use: small tables, constant time to record, and
+// the same relative accuracy at 2us as at 2s.
+//
+// In real time mode the transactions are counted on the acquisition
+// thread, and the dump is written on the event loop's.  So the counting
+// and the cycle totals are done holding statsLock, and the dump copies
+// everything out under it and writes the copy.  The lock is priority
+// inheriting, so the acquisition thread is never stuck behind the event
+// loop's thread for longer than the copy takes.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "i2cbus.h"
+
+#define MAX_DEVICES	8		// distinct addresses tracked
+#define MAX_ERRNO	134		// errno values above this are lumped together
+#define SUB_BITS	3
+#define SUB_BUCKETS	(1 << SUB_BITS)
+#define NUM_BUCKETS	((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+enum
+{
+	OP_SELECT,
+	OP_WRITE,
+	OP_READ,
+	OP_TRANSFER,
+	NUM_OPS
+};
+
+static const char *opNames[NUM_OPS] = { "select", "write", "read", "rdwr" };
+
+struct Histogram
+{
+	unsigned long count;
+	unsigned long long total;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned buckets[NUM_BUCKETS];
+};
+
+struct OpStats
+{
+	Histogram latency;
+	unsigned long shortTransfers;	// fewer bytes than asked for
+	unsigned errors[MAX_ERRNO + 1];	// indexed by errno
+};
+
+struct Device
+{
+	int addr;
+	OpStats op[NUM_OPS];
+};
+
+static Device device[MAX_DEVICES];
+static int numDevices = 0;
+static signed char slotOf[128];		// address to device slot, -1 if none
+static int currentAddr = 0;		// last address selected
+
+// Per cycle totals
+
+static Histogram cycleTime;
+static Histogram cycleBusTime;
+static unsigned long long cycleTransactions;
+static struct timespec cycleStart;
+static unsigned long long busThisCycle;
+static unsigned transactionsThisCycle;
+
+static unsigned long long overheadNs;	// cost of recording one transaction
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;	// made priority inheriting by i2cStatsInit()
+
+// What i2cStatsDump() writes, copied out under the lock
+
+static Device shownDevice[MAX_DEVICES];
+static int shownDevices;
+static Histogram shownCycleTime;
+static Histogram shownCycleBusTime;
+static unsigned long long shownCycleTransactions;
+
+static Device *lookup(int addr);
+static unsigned long long now(void);
+static void record(Histogram *h, unsigned long long value);
+static void finish(int op, int addr, unsigned long long start, int result, int wanted, int savedErrno);
+static unsigned long long bucketValue(int index);
+static unsigned long long percentile(const Histogram *h, double p);
+static void dumpHistogram(FILE *out, const char *name, const Histogram *h, double scale, const char *unit);
+
+
+
+
+//****************************************************************************
+// Clears the tables and measures what recording a transaction costs.
+
+void i2cStatsInit(void)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&statsLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	memset(device, 0, sizeof(device));
+	memset(slotOf, -1, sizeof(slotOf));
+	numDevices = 0;
+
+	// Time a batch of fake transactions going through exactly what a real
+	// one does: two clock reads and a histogram update under the lock.
+
+	static Histogram scratch;
+	const int loops = 1000;
+	unsigned long long start = now();
+	for (int i = 0; i < loops; i++)
+	{
+		unsigned long long t = now();
+		pthread_mutex_lock(&statsLock);
+		record(&scratch, now() - t);
+		pthread_mutex_unlock(&statsLock);
+	}
+	overheadNs = (now() - start) / loops;
+}
+
+
+
+
+//****************************************************************************
+// Points the fd at a device, same as ioctl(fd, I2C_SLAVE, addr).
+
+int i2cSelect(int fd, int addr)
+{
+	unsigned long long start = now();
+	int result = ioctl(fd, I2C_SLAVE, addr);
+	int savedErrno = errno;
+
+	currentAddr = addr & 0x7F;
+	finish(OP_SELECT, currentAddr, start, result, 0, savedErrno);
+	errno = savedErrno;
+	return result;
+}
+
+
+
+
+//****************************************************************************
+// Same as write(fd, buffer, length) to the selected device.
+
+int i2cWrite(int fd, const void *buffer, int length)
+{
+	unsigned long long start = now();
+	int result = write(fd, buffer, length);
+	int savedErrno = errno;
+
+	finish(OP_WRITE, currentAddr, start, result, length, savedErrno);
+	errno = savedErrno;
+	return result;
+}
+
+
+
+
+//****************************************************************************
+// Same as read(fd, buffer, length) from the selected device.
+
+int i2cRead(int fd, void *buffer, int length)
+{
+	unsigned long long start = now();
+	int result = read(fd, buffer, length);
+	int savedErrno = errno;
+
+	finish(OP_READ, currentAddr, start, result, length, savedErrno);
+	errno = savedErrno;
+	return result;
+}
+
+
+
+
+//****************************************************************************
+// Same as ioctl(fd, I2C_RDWR) with the given messages.  Returns the number
+// of messages transferred; anything else is counted as short.
+
+int i2cTransfer(int fd, struct i2c_msg *messages, int count)
+{
+	struct i2c_rdwr_ioctl_data batch;
+	batch.msgs = messages;
+	batch.nmsgs = count;
+
+	unsigned long long start = now();
+	int result = ioctl(fd, I2C_RDWR, &batch);
+	int savedErrno = errno;
+
+	finish(OP_TRANSFER, messages[0].addr & 0x7F, start, result, count, savedErrno);
+	errno = savedErrno;
+	return result;
+}
+
+
+
+
+//****************************************************************************
+// Marks the start of a poll cycle.
+
+void i2cCycleBegin(void)
+{
+	pthread_mutex_lock(&statsLock);
+	clock_gettime(CLOCK_MONOTONIC, &cycleStart);
+	busThisCycle = 0;
+	transactionsThisCycle = 0;
+	pthread_mutex_unlock(&statsLock);
+}
+
+
+
+
+//****************************************************************************
+// Marks the end of a poll cycle and adds it to the cycle totals.
+
+void i2cCycleEnd(void)
+{
+	pthread_mutex_lock(&statsLock);
+
+	unsigned long long start = cycleStart.tv_sec * 1000000000ULL + cycleStart.tv_nsec;
+
+	record(&cycleTime, now() - start);
+	record(&cycleBusTime, busThisCycle);
+	cycleTransactions += transactionsThisCycle;
+
+	pthread_mutex_unlock(&statsLock);
+}
+
+
+
+
+//****************************************************************************
+// Writes out everything collected so far.
+
+void i2cStatsDump(FILE *out)
+{
+	pthread_mutex_lock(&statsLock);
+	memcpy(shownDevice, device, numDevices * sizeof(Device));
+	shownDevices = numDevices;
+	shownCycleTime = cycleTime;
+	shownCycleBusTime = cycleBusTime;
+	shownCycleTransactions = cycleTransactions;
+	pthread_mutex_unlock(&statsLock);
+
+	fprintf(out, "I2C statistics, %lu poll cycles\n", shownCycleTime.count);
+
+	dumpHistogram(out, "cycle time", &shownCycleTime, 1e6, "ms");
+	dumpHistogram(out, "cycle bus time", &shownCycleBusTime, 1e6, "ms");
+
+	if (shownCycleTime.count > 0)
+	{
+		double perCycle = (double)shownCycleTransactions / shownCycleTime.count;
+		double average = (double)shownCycleTime.total / shownCycleTime.count;
+
+		fprintf(out, "transactions per cycle: %1.1f\n", perCycle);
+		fprintf(out, "instrumentation cost: %llu ns per transaction, %1.4f%% of a cycle\n",
+			overheadNs, average > 0 ? 100.0 * overheadNs * perCycle / average : 0);
+	}
+
+	for (int d = 0; d < shownDevices; d++)
+	{
+		for (int op = 0; op < NUM_OPS; op++)
+		{
+			OpStats *s = &shownDevice[d].op[op];
+			if (s->latency.count == 0)
+			{
+				continue;
+			}
+
+			char name[32];
+			snprintf(name, sizeof(name), "0x%02X %s", shownDevice[d].addr, opNames[op]);
+			dumpHistogram(out, name, &s->latency, 1e3, "us");
+
+			if (s->shortTransfers > 0)
+			{
+				fprintf(out, "    short transfers: %lu\n", s->shortTransfers);
+			}
+			for (int e = 0; e <= MAX_ERRNO; e++)
+			{
+				if (s->errors[e] > 0)
+				{
+					fprintf(out, "    errors %s: %u\n",
+						e == MAX_ERRNO ? "other" : strerror(e), s->errors[e]);
+				}
+			}
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Finds (or adds) the slot for an address.  Returns NULL if the table is
+// full, in which case the transaction is not counted.
+
+static Device *lookup(int addr)
+{
+	if (slotOf[addr] < 0)
+	{
+		if (numDevices == MAX_DEVICES)
+		{
+			return NULL;
+		}
+		slotOf[addr] = numDevices;
+		device[numDevices].addr = addr;
+		numDevices++;
+	}
+
+	return &device[(int)slotOf[addr]];
+}
+
+
+
+
+//****************************************************************************
+// Monotonic time in nanoseconds.
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+
+//****************************************************************************
+// Adds a value to a histogram.
+
+static void record(Histogram *h, unsigned long long value)
+{
+	int index;
+	if (value < SUB_BUCKETS)
+	{
+		index = value;
+	}
+	else
+	{
+		int top = 63 - __builtin_clzll(value);		// highest bit set
+		int sub = (value >> (top - SUB_BITS)) & (SUB_BUCKETS - 1);
+		index = (top - SUB_BITS + 1) * SUB_BUCKETS + sub;
+	}
+
+	h->buckets[index]++;
+	if (h->count == 0 || value < h->min)
+	{
+		h->min = value;
+	}
+	if (value > h->max)
+	{
+		h->max = value;
+	}
+	h->total += value;
+	h->count++;
+}
+
+
+
+
+//****************************************************************************
+// Records the outcome of one transaction.
+
+static void finish(int op, int addr, unsigned long long start, int result, int wanted, int savedErrno)
+{
+	unsigned long long took = now() - start;
+
+	pthread_mutex_lock(&statsLock);
+
+	busThisCycle += took;
+	transactionsThisCycle++;
+
+	Device *d = lookup(addr);
+	if (d != NULL)
+	{
+		OpStats *s = &d->op[op];
+		record(&s->latency, took);
+
+		if (result < 0)
+		{
+			s->errors[savedErrno < MAX_ERRNO ? savedErrno : MAX_ERRNO]++;
+		}
+		else if (op != OP_SELECT && result != wanted)
+		{
+			s->shortTransfers++;
+		}
+	}
+
+	pthread_mutex_unlock(&statsLock);
+}
+
+
+
+
+//****************************************************************************
+// Returns the smallest value that lands in a bucket.
+
+static unsigned long long bucketValue(int index)
+{
+	if (index < SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	int top = index / SUB_BUCKETS - 1 + SUB_BITS;
+	int sub = index % SUB_BUCKETS;
+	return (unsigned long long)(SUB_BUCKETS + sub) << (top - SUB_BITS);
+}
+
+
+
+
+//****************************************************************************
+// Returns the value below which the given fraction of samples fall.  That
+// is the top of the bucket it lands in, kept within the min and max seen.
+
+static unsigned long long percentile(const Histogram *h, double p)
+{
+	unsigned long target = (unsigned long)(p * h->count);
+	unsigned long seen = 0;
+
+	for (int i = 0; i < NUM_BUCKETS - 1; i++)
+	{
+		seen += h->buckets[i];
+		if (seen > target)
+		{
+			unsigned long long top = bucketValue(i + 1) - 1;
+			return top < h->min ? h->min : top > h->max ? h->max : top;
+		}
+	}
+
+	return h->max;
+}
+
+
+
+
+//****************************************************************************
+// One line summary of a histogram, in the given unit.
+
+static void dumpHistogram(FILE *out, const char *name, const Histogram *h, double scale, const char *unit)
+{
+	if (h->count == 0)
+	{
+		fprintf(out, "%s: none\n", name);
+		return;
+	}
+
+	fprintf(out, "%s: %lu, avg %1.3f %s, min %1.3f, p50 %1.3f, p90 %1.3f, p99 %1.3f, max %1.3f\n",
+		name, h->count, h->total / (double)h->count / scale, unit,
+		h->min / scale,
+		percentile(h, 0.50) / scale,
+		percentile(h, 0.90) / scale,
+		percentile(h, 0.99) / scale,
+		h->max / scale);
+}
@@ -0,0 +1,37 @@
+//****************************************************************************
+// Instrumented I2C access.  These are drop in replacements for the ioctl,
+// write and read calls the poll functions make on /dev/i2c-1, and they
+// return exactly what those calls return (errno included).  i2cTransfer()
+// is ioctl(fd, I2C_RDWR) for a batch of messages; it is counted against the
+// address of the first one.  Along the way they keep, per device address
+// and per operation:
+//
+//  - a latency histogram with log-linear buckets (8 per power of two, so
+//    any reading is within 12.5%), plus count, min, max and total
+//  - error counts by errno, and a count of short transfers
+//
+// and per poll cycle the wall time, the time spent on the bus and the
+// number of transactions.  Everything lives in fixed size tables.
+//
+// i2cStatsDump() writes it all out as text; Monitor does that when it gets
+// SIGUSR1.  The dump also shows what the bookkeeping itself costs, measured
+// at startup, as a percentage of the average poll cycle.
+
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <stdio.h>
+#include <linux/i2c.h>
+
+int i2cSelect(int fd, int addr);
+int i2cWrite(int fd, const void *buffer, int length);
+int i2cRead(int fd, void *buffer, int length);
+int i2cTransfer(int fd, struct i2c_msg *messages, int count);
+
+void i2cCycleBegin(void);
+void i2cCycleEnd(void);
+
+void i2cStatsInit(void);
+void i2cStatsDump(FILE *out);
+
+#endif	// I2CBUS_H
@@ -0,0 +1,301 @@
+//****************************************************************************
+// Simulated I2C bus.  See i2csim.h.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "i2csim.h"
+#include "drivers.h"
+
+// Standard mode I2C: 100 kHz, 9 clocks per byte (8 data bits plus the ack)
+// and roughly 2 more for the start and stop.
+
+#define CLOCK_NS	10000ULL
+#define BYTE_CLOCKS	9
+#define FRAME_CLOCKS	2
+
+// The SHT30 holds the clock for whatever is left of its measurement time
+// when it is read.
+
+#define SHT30_MEASURE_NS	(SHT30_MEASURE_US * 1000ULL)
+
+// What the SHT30 will answer a read with.  With nothing pending it does not
+// ack the read at all.
+
+enum
+{
+	SHT30_NONE,
+	SHT30_MEASURE,
+	SHT30_STATUS
+};
+
+#define SHT30_STATUS_WORD	0x8010	// alert pending, reset detected
+
+static int currentAddr = 0;
+static unsigned long long busNs = 0;
+static unsigned char adcPrevious = 0x80;	// the PCF8591 powers up with 0x80
+static int sht30Pending = SHT30_NONE;
+static unsigned long long sht30Started;
+static unsigned noise = 1;
+static unsigned long calls = 0;
+static bool batching = false;		// inside i2cTransfer
+
+static unsigned long long now(void);
+static unsigned char nextNoise(void);
+static unsigned long long transferNs(int length);
+
+
+
+
+//****************************************************************************
+// Puts every pretend device back to its power up state.
+
+void i2cSimReset(void)
+{
+	currentAddr = 0;
+	busNs = 0;
+	adcPrevious = 0x80;
+	sht30Pending = SHT30_NONE;
+	noise = 1;
+	calls = 0;
+}
+
+
+
+
+//****************************************************************************
+// Returns the time all transfers so far would have taken on a real bus.
+
+unsigned long long i2cSimBusNs(void)
+{
+	return busNs;
+}
+
+
+
+
+//****************************************************************************
+// Returns how many system calls the transfers so far would have taken.
+
+unsigned long i2cSimCalls(void)
+{
+	return calls;
+}
+
+
+
+
+//****************************************************************************
+// Selects a device.  Any 7 bit address is accepted, like the real ioctl.
+
+int i2cSelect(int fd, int addr)
+{
+	if (addr < 0 || addr > 0x7F)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	calls += !batching;
+	currentAddr = addr;
+	return 0;
+}
+
+
+
+
+//****************************************************************************
+// Writes a command to the selected device.  Devices that are not there do
+// not ack, which the real driver reports as EREMOTEIO.
+
+int i2cWrite(int fd, const void *buffer, int length)
+{
+	const unsigned char *data = (const unsigned char *)buffer;
+
+	calls += !batching;
+	switch (currentAddr)
+	{
+		case PCT2075_ADDR:
+		case ADC_ADDR:
+			break;
+
+		case SHT30_ADDR:
+			if (length == 0)
+			{
+				break;		// a quick write, no command
+			}
+			sht30Pending = length != 2 ? SHT30_NONE :
+				data[0] == 0x2C && data[1] == 0x06 ? SHT30_MEASURE :
+				data[0] == 0xF3 && data[1] == 0x2D ? SHT30_STATUS : SHT30_NONE;
+			sht30Started = now();
+			break;
+
+		default:
+			busNs += transferNs(0);
+			errno = EREMOTEIO;
+			return -1;
+	}
+
+	busNs += transferNs(length);
+	return length;
+}
+
+
+
+
+//****************************************************************************
+// Reads from the selected device.
+
+int i2cRead(int fd, void *buffer, int length)
+{
+	unsigned char *data = (unsigned char *)buffer;
+
+	calls += !batching;
+	switch (currentAddr)
+	{
+		case PCT2075_ADDR:
+			for (int i = 0; i < length; i++)
+			{
+				data[i] = i == 0 ? 22 : i == 1 ? 0x80 + (nextNoise() & 0x0F) : 0;
+			}
+			break;
+
+		case ADC_ADDR:
+			// The first byte is the conversion from the last read; every
+			// byte after that is a fresh conversion.
+
+			for (int i = 0; i < length; i++)
+			{
+				unsigned char conversion = 140 + (nextNoise() % 3) - 1;	// about pH 6.2
+				data[i] = i == 0 ? adcPrevious : conversion;
+				adcPrevious = conversion;
+			}
+			break;
+
+		case SHT30_ADDR:
+		{
+			int pending = sht30Pending;
+			sht30Pending = SHT30_NONE;
+
+			if (pending == SHT30_NONE)
+			{
+				busNs += transferNs(0);
+				errno = EREMOTEIO;
+				return -1;
+			}
+
+			unsigned char raw[6];
+			if (pending == SHT30_STATUS)
+			{
+				raw[0] = SHT30_STATUS_WORD >> 8;
+				raw[1] = SHT30_STATUS_WORD & 0xFF;
+				raw[2] = sht30CRC(raw, 2);
+				memcpy(data, raw, length < 3 ? length : 3);
+				break;
+			}
+
+			unsigned long long waited = now() - sht30Started;
+			if (waited < SHT30_MEASURE_NS)
+			{
+				busNs += SHT30_MEASURE_NS - waited;
+			}
+
+			unsigned short temp = 0x6666 + (nextNoise() & 0x3F);	// about 25 C
+			unsigned short humidity = 0x9999 + (nextNoise() & 0x3F);	// about 60%
+			raw[0] = temp >> 8;
+			raw[1] = temp & 0xFF;
+			raw[2] = sht30CRC(raw, 2);
+			raw[3] = humidity >> 8;
+			raw[4] = humidity & 0xFF;
+			raw[5] = sht30CRC(raw + 3, 2);
+			memcpy(data, raw, length < 6 ? length : 6);
+			break;
+		}
+
+		default:
+			busNs += transferNs(0);
+			errno = EREMOTEIO;
+			return -1;
+	}
+
+	busNs += transferNs(length);
+	return length;
+}
+
+
+
+
+//****************************************************************************
+// A batch of messages, stopping at the first one that fails like the real
+// adapter does.  Each message after the first starts with a repeated start
+// instead of a stop and a start.
+
+int i2cTransfer(int fd, struct i2c_msg *messages, int count)
+{
+	int saved = currentAddr;
+	int result = count;
+
+	calls++;
+	batching = true;
+
+	for (int i = 0; i < count; i++)
+	{
+		i2cSelect(fd, messages[i].addr);
+
+		int got = messages[i].flags & I2C_M_RD ?
+			i2cRead(fd, messages[i].buf, messages[i].len) :
+			i2cWrite(fd, messages[i].buf, messages[i].len);
+
+		if (i > 0)
+		{
+			busNs -= (FRAME_CLOCKS - 1) * CLOCK_NS;
+		}
+		if (got != messages[i].len)
+		{
+			result = -1;
+			break;
+		}
+	}
+
+	batching = false;
+	currentAddr = saved;		// I2C_RDWR leaves the selected address alone
+	return result;
+}
+
+
+
+
+//****************************************************************************
+// Nanoseconds on the monotonic clock.
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+
+//****************************************************************************
+// Cheap repeatable pseudo random noise for the readings.
+
+static unsigned char nextNoise(void)
+{
+	noise = noise * 1103515245 + 12345;
+	return (noise >> 16) & 0xFF;
+}
+
+
+
+
+//****************************************************************************
+// Bus time for one transfer of the given number of data bytes.
+
+static unsigned long long transferNs(int length)
+{
+	return (FRAME_CLOCKS + BYTE_CLOCKS * (1 + length)) * CLOCK_NS;
+}
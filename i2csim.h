@@ -0,0 +1,29 @@
+//****************************************************************************
+// A simulated I2C bus for benchmarks.  i2csim.cpp provides the same
+// i2cSelect, i2cWrite, i2cRead and i2cTransfer as i2cbus.cpp, so linking it
+// in place of i2cbus.cpp runs the real poll code against pretend sensors:
+//
+//    0x37  PCT2075, about 22.5 C
+//    0x48  PCF8591, a pH probe around pH 6.2 on input 0, with the "previous
+//          conversion" behaviour of the real part
+//    0x44  SHT30, about 25 C and 60%, with correct CRCs.  It answers its
+//          status read, and like the real part does not ack a read when
+//          no measurement or status read is pending
+//
+// Nothing actually waits.  Instead the time the transfers would take on a
+// 100 kHz bus (including the SHT30 holding the clock if it is read before
+// its measurement is done) is added up and can be read back with
+// i2cSimBusNs().  The messages of an I2C_RDWR batch are joined by repeated
+// starts, so they share one start and stop.  i2cSimCalls() counts the
+// system calls the real bus would have taken.
+
+#ifndef I2CSIM_H
+#define I2CSIM_H
+
+#include "i2cbus.h"
+
+void i2cSimReset(void);
+unsigned long long i2cSimBusNs(void);
+unsigned long i2cSimCalls(void);
+
+#endif	// I2CSIM_H
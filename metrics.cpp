@@ -0,0 +1,502 @@
+//****************************************************************************
+// Prometheus exporter.  See metrics.h.
+//
+// This is a very small HTTP/1.0 server: one non-blocking listening socket
+// and a handful of connections, all driven from Monitor's event loop.  Each
+// connection reads until the end of the request headers, gets pointed at a
+// ready made response and is closed once that has been sent.
+//
+// The page is double buffered.  A render goes into the buffer nobody is
+// reading, then the two are swapped, so a slow client that is still
+// receiving the previous page is not disturbed (unless a second render
+// comes along first, in which case that client is dropped).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "metrics.h"
+#include "reactor.h"
+
+#define MAX_CONNECTIONS	16
+#define REQUEST_SIZE	1024
+#define PAGE_SIZE	16384
+#define HEADER_ROOM	128		// the HTTP headers fit in this
+
+// Upper bounds of the poll cycle histogram buckets, in seconds.  The
+// SHT30's 15ms measurement is the longest wait, so most cycles should land
+// just over that.
+
+static const double cycleBuckets[] =
+{
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.15, 0.25, 0.5, 1, 2.5
+};
+
+#define NUM_BUCKETS	(sizeof(cycleBuckets) / sizeof(cycleBuckets[0]))
+
+struct Connection
+{
+	int fd;				// -1 when the slot is free
+	char request[REQUEST_SIZE];
+	int got;			// bytes of request so far
+	const char *response;		// set once the request is complete
+	int length;
+	int sent;
+	int page;			// which page buffer, or -1
+};
+
+Counters counters;
+LatencyStats wakeupStats;
+LatencyStats dosingLatency;
+
+static int listenfd = -1;
+static Connection connection[MAX_CONNECTIONS];
+
+static char page[2][PAGE_SIZE];
+static int pageLength[2];
+static int currentPage = 0;
+
+// What has been seen so far, kept between renders.
+
+static int numChannels;
+static const char **channelNames;
+static float lastValue[MAX_CHANNELS];
+static long long lastTime[MAX_CHANNELS];	// 0 if never read
+static unsigned long cycleCount[NUM_BUCKETS + 1];	// last is +Inf
+static double cycleSum;
+static unsigned long cycleTotal;
+static double lastWriterLag;
+static double expectedRate[MAX_CHANNELS];	// Hz, 0 if not read
+static double achievedRate[MAX_CHANNELS];
+static unsigned long lateReads[MAX_CHANNELS];
+
+static const char notFound[] =
+	"HTTP/1.0 404 Not Found\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 10\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Not found\n";
+
+static void render(void);
+static void acceptConnection(void *arg, unsigned events);
+static void serviceConnection(void *arg, unsigned events);
+static void closeConnection(Connection *c);
+
+
+
+
+//****************************************************************************
+// Starts listening on the given port.  Returns false after printing an
+// error if that can't be done; Monitor carries on without the exporter.
+
+bool metricsInit(int port, int channels, const char **names)
+{
+	numChannels = channels < MAX_CHANNELS ? channels : MAX_CHANNELS;
+	channelNames = names;
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++)
+	{
+		connection[i].fd = -1;
+	}
+
+	listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenfd < 0)
+	{
+		printf("Error creating metrics socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	int on = 1;
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listenfd, MAX_CONNECTIONS) < 0)
+	{
+		printf("Error listening for metrics on port %d: %s\n", port, strerror(errno));
+		close(listenfd);
+		listenfd = -1;
+		return false;
+	}
+
+	if (!reactorWatch(listenfd, EPOLLIN, acceptConnection, NULL))
+	{
+		close(listenfd);
+		listenfd = -1;
+		return false;
+	}
+
+	render();		// so there is something to scrape right away
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Records the results of a sample cycle and renders a fresh page.
+
+void metricsUpdate(const Sample *sample, double cycleSeconds, double writerLag)
+{
+	counters.samples++;
+
+	for (int ch = 0; ch < numChannels && ch < sample->channels; ch++)
+	{
+		if (sample->valid[ch])
+		{
+			lastValue[ch] = sample->value[ch];
+			lastTime[ch] = sample->when.tv_sec;
+		}
+	}
+
+	unsigned bucket = 0;
+	while (bucket < NUM_BUCKETS && cycleSeconds > cycleBuckets[bucket])
+	{
+		bucket++;
+	}
+	cycleCount[bucket]++;
+	cycleSum += cycleSeconds;
+	cycleTotal++;
+	lastWriterLag = writerLag;
+
+	if (listenfd >= 0)
+	{
+		render();
+	}
+}
+
+
+
+
+//****************************************************************************
+// Takes the rate each channel should be read at, the rate it is and how
+// many of its reads were late (see schedule.h).  Shows up with the next
+// render.
+
+void metricsRates(const double *expectedHz, const double *achievedHz, const unsigned long *missed)
+{
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		expectedRate[ch] = expectedHz[ch];
+		achievedRate[ch] = achievedHz[ch];
+		lateReads[ch] = missed[ch];
+	}
+}
+
+
+
+
+//****************************************************************************
+// Adds formatted text to the end of a buffer, never running past the end.
+
+static void append(char *buffer, int *length, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buffer + *length, PAGE_SIZE - *length, format, args);
+	va_end(args);
+
+	*length += n;
+	if (*length >= PAGE_SIZE)
+	{
+		*length = PAGE_SIZE - 1;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Builds the complete HTTP response, headers and all, into the spare page
+// and makes it the current one.
+
+static void render(void)
+{
+	static char body[PAGE_SIZE];
+	int length = 0;
+
+	append(body, &length, "# HELP hydro_value Latest reading of each channel.\n");
+	append(body, &length, "# TYPE hydro_value gauge\n");
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		if (lastTime[ch] != 0)
+		{
+			append(body, &length, "hydro_value{channel=\"%s\"} %g\n", channelNames[ch], lastValue[ch]);
+		}
+	}
+
+	append(body, &length, "# HELP hydro_value_timestamp_seconds When each channel was last read.\n");
+	append(body, &length, "# TYPE hydro_value_timestamp_seconds gauge\n");
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		if (lastTime[ch] != 0)
+		{
+			append(body, &length, "hydro_value_timestamp_seconds{channel=\"%s\"} %lld\n", channelNames[ch], lastTime[ch]);
+		}
+	}
+
+	append(body, &length, "# HELP hydro_expected_rate_hz How often each channel is scheduled to be read.\n");
+	append(body, &length, "# TYPE hydro_expected_rate_hz gauge\n");
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		if (expectedRate[ch] > 0)
+		{
+			append(body, &length, "hydro_expected_rate_hz{channel=\"%s\"} %g\n", channelNames[ch], expectedRate[ch]);
+		}
+	}
+
+	append(body, &length, "# HELP hydro_achieved_rate_hz How often each channel has been read since its schedule started.\n");
+	append(body, &length, "# TYPE hydro_achieved_rate_hz gauge\n");
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		if (expectedRate[ch] > 0)
+		{
+			append(body, &length, "hydro_achieved_rate_hz{channel=\"%s\"} %g\n", channelNames[ch], achievedRate[ch]);
+		}
+	}
+
+	append(body, &length, "# HELP hydro_deadline_misses_total Reads of each channel that came a whole interval late.\n");
+	append(body, &length, "# TYPE hydro_deadline_misses_total counter\n");
+	for (int ch = 0; ch < numChannels; ch++)
+	{
+		if (expectedRate[ch] > 0)
+		{
+			append(body, &length, "hydro_deadline_misses_total{channel=\"%s\"} %lu\n", channelNames[ch], lateReads[ch]);
+		}
+	}
+
+	append(body, &length, "# HELP hydro_samples_total Sample cycles taken.\n");
+	append(body, &length, "# TYPE hydro_samples_total counter\n");
+	append(body, &length, "hydro_samples_total %lu\n", counters.samples);
+	append(body, &length, "# HELP hydro_i2c_errors_total Failed I2C ioctl, write or read calls.\n");
+	append(body, &length, "# TYPE hydro_i2c_errors_total counter\n");
+	append(body, &length, "hydro_i2c_errors_total %lu\n", counters.i2cErrors);
+	append(body, &length, "# HELP hydro_crc_errors_total Sensor data that failed its CRC check.\n");
+	append(body, &length, "# TYPE hydro_crc_errors_total counter\n");
+	append(body, &length, "hydro_crc_errors_total %lu\n", counters.crcErrors);
+	append(body, &length, "# HELP hydro_quarantines_total Times a failing sensor was quarantined.\n");
+	append(body, &length, "# TYPE hydro_quarantines_total counter\n");
+	append(body, &length, "hydro_quarantines_total %lu\n", counters.quarantines);
+	append(body, &length, "# HELP hydro_bus_recoveries_total Times a stuck I2C bus was clocked free.\n");
+	append(body, &length, "# TYPE hydro_bus_recoveries_total counter\n");
+	append(body, &length, "hydro_bus_recoveries_total %lu\n", counters.busRecoveries);
+	append(body, &length, "# HELP hydro_doses_total pH doses started.\n");
+	append(body, &length, "# TYPE hydro_doses_total counter\n");
+	append(body, &length, "hydro_doses_total %lu\n", counters.doses);
+	append(body, &length, "# HELP hydro_stale_doses_total pH readings too old by the time they got to the dosing controller.\n");
+	append(body, &length, "# TYPE hydro_stale_doses_total counter\n");
+	append(body, &length, "hydro_stale_doses_total %lu\n", counters.staleDoses);
+
+	append(body, &length, "# HELP hydro_poll_cycle_seconds Time taken to read all due sensors.\n");
+	append(body, &length, "# TYPE hydro_poll_cycle_seconds histogram\n");
+	unsigned long cumulative = 0;
+	for (unsigned i = 0; i < NUM_BUCKETS; i++)
+	{
+		cumulative += cycleCount[i];
+		append(body, &length, "hydro_poll_cycle_seconds_bucket{le=\"%g\"} %lu\n", cycleBuckets[i], cumulative);
+	}
+	append(body, &length, "hydro_poll_cycle_seconds_bucket{le=\"+Inf\"} %lu\n", cycleTotal);
+	append(body, &length, "hydro_poll_cycle_seconds_sum %g\n", cycleSum);
+	append(body, &length, "hydro_poll_cycle_seconds_count %lu\n", cycleTotal);
+
+	append(body, &length, "# HELP hydro_writer_lag_seconds Time from taking the last sample to it being written out.\n");
+	append(body, &length, "# TYPE hydro_writer_lag_seconds gauge\n");
+	append(body, &length, "hydro_writer_lag_seconds %g\n", lastWriterLag);
+
+	if (wakeupStats.count > 0)
+	{
+		append(body, &length, "# HELP hydro_rt_wakeup_latency_seconds How late the acquisition thread woke from its sleeps.\n");
+		append(body, &length, "# TYPE hydro_rt_wakeup_latency_seconds summary\n");
+		append(body, &length, "hydro_rt_wakeup_latency_seconds_sum %g\n", wakeupStats.sum);
+		append(body, &length, "hydro_rt_wakeup_latency_seconds_count %lu\n", wakeupStats.count);
+		append(body, &length, "# HELP hydro_rt_wakeup_latency_worst_seconds The latest the acquisition thread has woken.\n");
+		append(body, &length, "# TYPE hydro_rt_wakeup_latency_worst_seconds gauge\n");
+		append(body, &length, "hydro_rt_wakeup_latency_worst_seconds %g\n", wakeupStats.worst);
+	}
+
+	if (dosingLatency.count > 0)
+	{
+		append(body, &length, "# HELP hydro_dosing_latency_seconds Time from a pH reading to the pump being switched on for it.\n");
+		append(body, &length, "# TYPE hydro_dosing_latency_seconds summary\n");
+		append(body, &length, "hydro_dosing_latency_seconds_sum %g\n", dosingLatency.sum);
+		append(body, &length, "hydro_dosing_latency_seconds_count %lu\n", dosingLatency.count);
+		append(body, &length, "# HELP hydro_dosing_latency_worst_seconds The longest from a pH reading to the pump being switched on.\n");
+		append(body, &length, "# TYPE hydro_dosing_latency_worst_seconds gauge\n");
+		append(body, &length, "hydro_dosing_latency_worst_seconds %g\n", dosingLatency.worst);
+	}
+
+	// Anybody still being sent the spare page has been too slow; the page is
+	// about to change under them.
+
+	int spare = !currentPage;
+	for (int i = 0; i < MAX_CONNECTIONS; i++)
+	{
+		if (connection[i].fd >= 0 && connection[i].page == spare)
+		{
+			closeConnection(&connection[i]);
+		}
+	}
+
+	// A body too big for the page is cut back to its last whole line
+	// before the length goes in the header, so the header never promises
+	// more than is sent.
+
+	if (length > PAGE_SIZE - HEADER_ROOM)
+	{
+		length = PAGE_SIZE - HEADER_ROOM;
+		while (length > 0 && body[length - 1] != '\n')
+		{
+			length--;
+		}
+	}
+
+	int total = 0;
+	append(page[spare], &total,
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: close\r\n"
+		"\r\n", length);
+	memcpy(page[spare] + total, body, length);
+	pageLength[spare] = total + length;
+	currentPage = spare;
+}
+
+
+
+
+//****************************************************************************
+// Takes a new connection from the listening socket.
+
+static void acceptConnection(void *arg, unsigned events)
+{
+	int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < MAX_CONNECTIONS; i++)
+	{
+		Connection *c = &connection[i];
+		if (c->fd < 0)
+		{
+			if (!reactorWatch(fd, EPOLLIN, serviceConnection, c))
+			{
+				break;
+			}
+
+			c->fd = fd;
+			c->got = 0;
+			c->response = NULL;
+			c->page = -1;
+			return;
+		}
+	}
+
+	close(fd);		// too busy
+}
+
+
+
+
+//****************************************************************************
+// Reads the request, picks the response and sends as much of it as the
+// socket will take.
+
+static void serviceConnection(void *arg, unsigned events)
+{
+	Connection *c = (Connection *)arg;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		closeConnection(c);
+		return;
+	}
+
+	if (c->response == NULL)
+	{
+		int got = read(c->fd, c->request + c->got, REQUEST_SIZE - 1 - c->got);
+		if (got <= 0)
+		{
+			if (got == 0 || errno != EAGAIN)
+			{
+				closeConnection(c);
+			}
+			return;
+		}
+		c->got += got;
+		c->request[c->got] = '\0';
+
+		if (strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL)
+		{
+			if (c->got == REQUEST_SIZE - 1)
+			{
+				closeConnection(c);	// silly big request
+			}
+			return;
+		}
+
+		if (strncmp(c->request, "GET /metrics ", 13) == 0 ||
+			strncmp(c->request, "GET /metrics?", 13) == 0)
+		{
+			c->page = currentPage;
+			c->response = page[currentPage];
+			c->length = pageLength[currentPage];
+		}
+		else
+		{
+			c->response = notFound;
+			c->length = sizeof(notFound) - 1;
+		}
+		c->sent = 0;
+	}
+
+	int put = write(c->fd, c->response + c->sent, c->length - c->sent);
+	if (put < 0)
+	{
+		if (errno != EAGAIN)
+		{
+			closeConnection(c);
+		}
+		return;
+	}
+
+	c->sent += put;
+	if (c->sent == c->length)
+	{
+		closeConnection(c);
+		return;
+	}
+
+	// Wait for room to send the rest.
+
+	reactorChange(c->fd, EPOLLOUT);
+}
+
+
+
+
+//****************************************************************************
+// Closes a connection and frees its slot.
+
+static void closeConnection(Connection *c)
+{
+	reactorForget(c->fd);
+	close(c->fd);
+	c->fd = -1;
+	c->page = -1;
+}
@@ -0,0 +1,52 @@
+//****************************************************************************
+// Prometheus/OpenMetrics exporter.  Monitor listens on a TCP port and
+// answers GET /metrics with the latest reading of every channel plus some
+// counters about Monitor itself (bus errors, CRC failures, how long a poll
+// cycle takes, how far the report writer lags behind the sample).
+//
+// The page is rendered once per sample into a buffer and every scrape just
+// sends that buffer, so scraping never touches the I2C bus.  Everything
+// runs on Monitor's one thread: scrapes are answered from its event loop
+// (see reactor.h), in between everything else.
+//
+//    curl http://localhost:9464/metrics
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+
+#include "sample.h"
+
+// Counted wherever the problem is noticed, shown on the next render.
+
+struct Counters
+{
+	unsigned long samples;		// sample cycles taken
+	unsigned long i2cErrors;	// failed ioctl, write or read
+	unsigned long crcErrors;	// SHT30 data that failed its CRC
+	unsigned long quarantines;	// times a sensor was quarantined
+	unsigned long busRecoveries;	// times a stuck bus was clocked
+	unsigned long doses;		// pH doses started
+	unsigned long staleDoses;	// pH readings too old to dose on
+};
+
+extern Counters counters;
+
+// How long something took, or how late it was, since Monitor started.
+
+struct LatencyStats
+{
+	unsigned long count;
+	double sum;			// seconds
+	double worst;
+};
+
+extern LatencyStats wakeupStats;	// real time mode's sleeps, see poller.h
+extern LatencyStats dosingLatency;	// pH reading to pump on, see dosing.h
+
+bool metricsInit(int port, int channels, const char **names);
+void metricsRates(const double *expectedHz, const double *achievedHz, const unsigned long *missed);
+void metricsUpdate(const Sample *sample, double cycleSeconds, double writerLag);
+
+#endif	// METRICS_H
@@ -12,21 +12,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
 
+#include "drivers.h"
+#include "broker.h"
 
-// This is the I2C address of the PCT2075 sensor.  Do not change this unless
-// the device is moved to a different address via the address selection bits.
-
-#define PCT2075_ADDR	0x37
-
-static void pollTemp(int fd);
+static void usage(const char *name);
 
 
 
@@ -34,14 +27,38 @@ static void pollTemp(int fd);
 //****************************************************************************
 int main(int argc, char **argv)
 {
-	int i2cfd = open("/dev/i2c-1", O_RDWR);
-	if (i2cfd <= 0)
+	const char *socketPath = DEFAULT_BROKER_SOCKET;
+	int maxAge = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "a:s:")) != -1)
+	{
+		switch (option)
+		{
+			case 'a':
+				maxAge = atoi(optarg);
+				break;
+
+			case 's':
+				socketPath = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	// Through Monitor if it is running, otherwise straight off the bus
+
+	SensorReading reading;
+	if (!brokerReadSensor(socketPath, maxAge * 1000, &pct2075Driver, &reading))
 	{
-		printf("Error opening I2C device: %s\n", strerror(errno));
 		exit(1);
 	}
 
-	pollTemp(i2cfd);	// get and display value
+	float values[DRIVER_MAX_VALUES];
+	pct2075Driver.decode(&reading.raw, values);
+	printf("%1.1f C, %1.1f F\n", values[0], values[1]);
 
 	exit(0);
 }
@@ -50,44 +67,13 @@ int main(int argc, char **argv)
 
 
 //****************************************************************************
-// This polls the temperatue sensor and prints the value.
+// Explains the command line and exits.
 
-static void pollTemp(int fd)
+static void usage(const char *name)
 {
-	if (ioctl(fd, I2C_SLAVE, PCT2075_ADDR) < 0)
-	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
-		return;
-	}
-
-	int got;
-
-	unsigned char buffer[8];
-
-	// Send over a request to read from the data register, address 0
-
-	buffer[0] = 0x00;
-	if ((got = write(fd, buffer, 1)) != 1)
-	{
-		printf("%d Error writing sensor command: %s\n", got, strerror(errno));
-		return;
-	}
-
-	if ((got = read(fd, buffer, 2)) != 2)
-	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
-		return;
-	}
-
-	// Okay, so I had to play around a bit to get reasonable values, although
-	// it does not seem to jive with the datasheet.  Whatever, it works.
-
-	//printf("raw 0x%02X 0x%02X\n", buffer[0], buffer[1]);
-	unsigned raw = (buffer[0] << 8) | buffer[1];
-	float cTemp = raw / 256.0;
-	float fTemp = (cTemp * 9.0 / 5.0) + 32;
-	printf("%1.1f C, %1.1f F\n", cTemp, fTemp);
+	printf("Usage: %s [-a seconds] [-s socket]\n", name);
+	printf("   -a  a reading Monitor already has will do if it is no older\n");
+	printf("       than this, default 0 (a fresh one)\n");
+	printf("   -s  Monitor's broker socket, default %s\n", DEFAULT_BROKER_SOCKET);
+	exit(1);
 }
-
-
@@ -45,35 +45,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
+#include <math.h>
 
+#include "drivers.h"
+#include "broker.h"
 
-// Microseconds in a millisecond
+#define I2C_DEVICE	"/dev/i2c-1"
 
-#define US_IN_MS	1000
+// Working out the settling: each round is one long read, a little while
+// after the last one like Monitor's are.  The last TAIL conversions of a
+// round are taken as where the input settled, and a conversion within
+// half a step of that, on average, counts as settled.
 
-// This is the I2C address of the PCF8591 ADC.  Do not change this unless
-// the device is moved to a different address via the address selection bits.
+#define CHARACTERIZE_ROUNDS	50
+#define CHARACTERIZE_LENGTH	32
+#define CHARACTERIZE_TAIL	8
+#define CHARACTERIZE_GAP_US	(100 * US_IN_MS)
+#define SETTLED_STEPS		0.5
 
-#define ADC_ADDR	0x48
-
-// The maximum voltage that the pH sensor provides.  It is always 3.3 volts.
-
-#define SENSOR_VOLTAGE	3.3
-
-// Constants for converting voltage into pH.  Beats me what the values mean.
-
-#define CONSTANT	-19.18518519
-#define OFFSET		41.02740741		//deviation compensate
-
-
-static int pollPH(int fd);
+static bool characterize(void);
+static void usage(const char *name);
 
 
 
@@ -81,22 +75,45 @@ static int pollPH(int fd);
 //****************************************************************************
 int main(int argc, char **argv)
 {
-	int i2cfd = open("/dev/i2c-1", O_RDWR);
-	if (i2cfd <= 0)
+	const char *socketPath = DEFAULT_BROKER_SOCKET;
+	int maxAge = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "a:cs:")) != -1)
 	{
-		printf("Error opening I2C device: %s\n", strerror(errno));
-		exit(1);
+		switch (option)
+		{
+			case 'c':
+				exit(characterize() ? 0 : 1);
+
+			case 'a':
+				maxAge = atoi(optarg);
+				break;
+
+			case 's':
+				socketPath = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
 	}
 
-	pollPH(i2cfd);			// throw out first
-	usleep(100 * US_IN_MS);		// delay 100ms
-	int raw = pollPH(i2cfd);	// get actual value
+	// If Monitor is running it does the read.  Either way the stale
+	// conversion the ADC was holding is thrown out within the read.
 
-	// Now conver the raw value into a PH
+	SensorReading reading;
+	if (!brokerReadSensor(socketPath, maxAge * 1000, &phDriver, &reading))
+	{
+		exit(1);
+	}
 
+	float raw = phAverage(&reading.raw.ph);
 	float voltage = raw * (SENSOR_VOLTAGE / 255);
-	printf("raw = %u, voltage = %f\n", raw, voltage);	// handy debugging data
-	float ph = CONSTANT * voltage + OFFSET;
+	printf("raw = %.2f, voltage = %f\n", raw, voltage);	// handy debugging data
+
+	float ph;
+	phDriver.decode(&reading.raw, &ph);
 	printf("pH = %f\n", ph);
 
 	exit(0);
@@ -106,38 +123,109 @@ int main(int argc, char **argv)
 
 
 //****************************************************************************
-// This polls the ADC and returns the value.  Note that the initial read
-// will always be 128 (0x80).  Each poll actually returns the previous poll
-// value and starts another conversion.
+// Reads the ADC straight off the bus to see how many conversions the input
+// takes to settle, and how steady a reading is once it has.  Prints what
+// to put in Monitor's config.  Monitor can keep running: its reads throw
+// out their own stale conversion, so these don't upset them.
 
-static int pollPH(int fd)
+static bool characterize(void)
 {
-	if (ioctl(fd, I2C_SLAVE, ADC_ADDR) < 0)
+	static unsigned char data[CHARACTERIZE_ROUNDS][CHARACTERIZE_LENGTH];
+	static const unsigned char command[2] = { 0x00, 0x00 };
+
+	int fd = open(I2C_DEVICE, O_RDWR);
+	if (fd < 0)
+	{
+		printf("Error opening I2C device: %s\n", strerror(errno));
+		return false;
+	}
+
+	for (int r = 0; r < CHARACTERIZE_ROUNDS; r++)
+	{
+		SensorReading reading;
+		if (driverCommand(fd, ADC_ADDR, command, 2, &reading) != DRIVER_OK ||
+			driverFetch(fd, ADC_ADDR, data[r], CHARACTERIZE_LENGTH, &reading) != DRIVER_OK)
+		{
+			printf("%s\n", driverError(&reading));
+			close(fd);
+			return false;
+		}
+		usleep(CHARACTERIZE_GAP_US);
+	}
+	close(fd);
+
+	// How far each conversion is from where its round settled
+
+	double off[CHARACTERIZE_LENGTH] = { 0 };
+	for (int r = 0; r < CHARACTERIZE_ROUNDS; r++)
 	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
-		return -1;
+		double settled = 0;
+		for (int i = CHARACTERIZE_LENGTH - CHARACTERIZE_TAIL; i < CHARACTERIZE_LENGTH; i++)
+		{
+			settled += data[r][i];
+		}
+		settled /= CHARACTERIZE_TAIL;
+
+		for (int i = 0; i < CHARACTERIZE_LENGTH; i++)
+		{
+			off[i] += fabs(data[r][i] - settled) / CHARACTERIZE_ROUNDS;
+		}
 	}
 
-	int got;
+	printf("conversion  steps off\n");
+	for (int i = 0; i < CHARACTERIZE_LENGTH - CHARACTERIZE_TAIL; i++)
+	{
+		printf("%10d  %9.2f%s\n", i, off[i], i == 0 ? "  (stale)" : "");
+	}
 
-	unsigned char buffer[8];
+	// The fewest thrown out that leaves every sample settled
 
-	buffer[0] = 0x00;
-	buffer[1] = 0x00;
-	if ((got = write(fd, buffer, 2)) != 2)
+	int settle = 0;
+	for (int i = 1; i < CHARACTERIZE_LENGTH - CHARACTERIZE_TAIL; i++)
 	{
-		printf("%d Error writing sensor command: %s\n", got, strerror(errno));
-		return -1;
+		if (off[i] > SETTLED_STEPS)
+		{
+			settle = i;
+		}
+	}
+	if (settle > PH_MAX_SETTLE)
+	{
+		printf("The input never settles within %d conversions\n", PH_MAX_SETTLE);
+		return false;
 	}
 
-	if ((got = read(fd, buffer, 4)) != 4)
+	double sum = 0, squares = 0;
+	for (int r = 0; r < CHARACTERIZE_ROUNDS; r++)
 	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
-		return -1;
+		PhRaw raw;
+		raw.settle = settle;
+		memcpy(raw.data, data[r], sizeof(raw.data));
+		double ph = phConvert(phAverage(&raw));
+		sum += ph;
+		squares += ph * ph;
 	}
+	double mean = sum / CHARACTERIZE_ROUNDS;
+	double deviation = sqrt(fmax(squares / CHARACTERIZE_ROUNDS - mean * mean, 0));
 
-	return buffer[0];
+	printf("pH %.3f, standard deviation %.4f over %d reads\n", mean, deviation, CHARACTERIZE_ROUNDS);
+	printf("For Monitor's config:\n    ph settle %d\n", settle);
+	return true;
 }
 
 
+
+
+//****************************************************************************
+// Explains the command line and exits.
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-a seconds] [-s socket]\n", name);
+	printf("       %s -c\n", name);
+	printf("   -a  a reading Monitor already has will do if it is no older\n");
+	printf("       than this, default 0 (a fresh one)\n");
+	printf("   -c  work out how long the input takes to settle, reading\n");
+	printf("       %s directly\n", I2C_DEVICE);
+	printf("   -s  Monitor's broker socket, default %s\n", DEFAULT_BROKER_SOCKET);
+	exit(1);
+}
@@ -0,0 +1,354 @@
+//****************************************************************************
+// Reads the sensors from the event loop.  See poller.h.
+//
+// In real time mode a poll is handed to the acquisition thread through one
+// eventfd and handed back through another, which the event loop watches.
+// Only one poll is ever going, so whichever thread has it is the only one
+// touching it, the slots and the drivers.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "poller.h"
+#include "metrics.h"
+#include "reactor.h"
+
+// The acquisition thread's stack.  It is all touched before the first poll
+// so that a poll never takes a page fault on it.
+
+#define RT_STACK_SIZE	(256 * 1024)
+#define RT_STACK_TOUCH	(192 * 1024)
+
+static SensorPoll *current = NULL;
+static SensorSlot slot[NUM_SENSORS];
+static void (*idleCallback)(void) = NULL;
+static int idlefd = -1;			// complete() to the idle callback, through the loop
+
+// Real time mode.  The wake-up figures are kept by the acquisition thread
+// and copied out to the metrics when it hands a poll back.
+
+static bool realtime = false;
+static int startfd = -1;		// event loop to acquisition thread
+static int donefd = -1;			// and back
+static unsigned long wakeups;
+static double wakeupSum;
+static double wakeupWorst;
+
+static void collect(void *arg);
+static void complete(void);
+static void idle(void *arg, unsigned events);
+static void *acquire(void *arg);
+static void acquired(void *arg, unsigned events);
+static double late(const struct timespec *due, const struct timespec *woke);
+
+
+
+
+//****************************************************************************
+// Starts reading the due sensors at the given slots.  The slots are copied,
+// so a reload can't pull them out from under the poll.  Returns false if a
+// poll is already going.
+
+bool pollerStart(const SensorSlot *slots, SensorPoll *poll)
+{
+	if (current != NULL)
+	{
+		return false;
+	}
+
+	current = poll;
+	memcpy(slot, slots, sizeof(slot));
+
+	memset(&poll->sample, 0, sizeof(poll->sample));
+	poll->sample.channels = NUM_CHANNELS;
+	clock_gettime(CLOCK_REALTIME, &poll->sample.when);
+	poll->failed = 0;
+
+	if (realtime)
+	{
+		uint64_t one = 1;
+		if (write(startfd, &one, sizeof(one)) == sizeof(one))
+		{
+			return true;
+		}
+		printf("Error starting the acquisition thread: %s\n", strerror(errno));
+	}
+
+	BoardSensors::start(slot, poll->due, poll->readings, poll->waiting);
+	collect(NULL);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Whether a poll is going.
+
+bool pollerBusy(void)
+{
+	return current != NULL;
+}
+
+
+
+
+//****************************************************************************
+// Sets what to call whenever a poll finishes and the buses are free.
+// Returns false after printing an error if the event loop can't be set up
+// to call it.
+
+bool pollerIdle(void (*callback)(void))
+{
+	idlefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (idlefd < 0)
+	{
+		printf("Error creating the poller's idle event: %s\n", strerror(errno));
+		return false;
+	}
+	if (!reactorWatch(idlefd, EPOLLIN, idle, NULL))
+	{
+		close(idlefd);
+		idlefd = -1;
+		return false;
+	}
+
+	idleCallback = callback;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Switches to real time mode: locks Monitor into memory and starts the
+// acquisition thread, SCHED_FIFO at the given priority and pinned to the
+// given CPU.  Returns false after printing an error if any of that can't be
+// done (it needs root, or CAP_SYS_NICE and CAP_IPC_LOCK); the polls then
+// carry on being done from the event loop.
+
+bool pollerRealtime(int cpu, int priority)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		printf("Error locking Monitor into memory: %s\n", strerror(errno));
+		return false;
+	}
+
+	startfd = eventfd(0, EFD_CLOEXEC);
+	donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (startfd < 0 || donefd < 0)
+	{
+		printf("Error creating acquisition thread events: %s\n", strerror(errno));
+		munlockall();
+		return false;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+	pthread_t thread;
+	int error = EBUSY;
+	if (reactorWatch(donefd, EPOLLIN, acquired, NULL))
+	{
+		error = pthread_create(&thread, &attr, acquire, NULL);
+		if (error != 0)
+		{
+			printf("Error starting the acquisition thread on CPU %d at priority %d: %s\n",
+				cpu, priority, strerror(error));
+			reactorForget(donefd);
+		}
+	}
+	pthread_attr_destroy(&attr);
+
+	if (error != 0)
+	{
+		close(startfd);
+		close(donefd);
+		startfd = donefd = -1;
+		munlockall();
+		return false;
+	}
+
+	realtime = true;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Fetches whatever is ready, then either waits for the next one or, if
+// that was the last, finishes the poll.
+
+static void collect(void *arg)
+{
+	struct timespec next;
+
+	if (BoardSensors::collect(slot, current->readings, current->waiting, &next))
+	{
+		if (reactorAt(&next, collect, NULL) >= 0)
+		{
+			return;
+		}
+
+		// No timer to be had, so just wait here this once
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+		{
+		}
+		collect(NULL);
+		return;
+	}
+
+	BoardSensors::finish(&current->sample, current->due, current->readings);
+	complete();
+}
+
+
+
+
+//****************************************************************************
+// The sensors have all been read: checks the results and tells whoever
+// started the poll.
+
+static void complete(void)
+{
+	SensorPoll *poll = current;
+	poll->failed = pollResults(&poll->sample, poll->due, poll->readings);
+
+	current = NULL;
+	poll->done(poll);
+
+	// The idle callback goes through the loop, see poller.h
+
+	if (current == NULL && idlefd >= 0)
+	{
+		uint64_t one = 1;
+		write(idlefd, &one, sizeof(one));
+	}
+}
+
+
+
+
+//****************************************************************************
+// A poll finished a while ago; if the buses are still free, says so.  Any
+// number of finished polls since the last time come to one call.
+
+static void idle(void *arg, unsigned events)
+{
+	uint64_t n;
+	if (read(idlefd, &n, sizeof(n)) == sizeof(n) && current == NULL)
+	{
+		idleCallback();
+	}
+}
+
+
+
+
+//****************************************************************************
+// The acquisition thread.  It waits for a poll, does the whole thing with
+// nothing but I2C calls and sleeps, and hands it back.  Each sleep is to an
+// absolute time, so the SHT30's measurement wait is 15ms plus however late
+// the thread wakes, and that lateness is what gets measured.
+
+static void *acquire(void *arg)
+{
+	// The empty asm says the stack is used, so the memset stays in
+
+	char stack[RT_STACK_TOUCH];
+	memset(stack, 0, sizeof(stack));
+	__asm__ __volatile__("" : : "r"(stack) : "memory");
+
+	for (;;)
+	{
+		uint64_t n;
+		if (read(startfd, &n, sizeof(n)) != sizeof(n))
+		{
+			continue;	// interrupted
+		}
+
+		SensorPoll *poll = current;
+		struct timespec next;
+
+		BoardSensors::start(slot, poll->due, poll->readings, poll->waiting);
+		while (BoardSensors::collect(slot, poll->readings, poll->waiting, &next))
+		{
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			{
+			}
+
+			struct timespec woke;
+			clock_gettime(CLOCK_MONOTONIC, &woke);
+
+			double seconds = late(&next, &woke);
+			wakeups++;
+			wakeupSum += seconds;
+			if (seconds > wakeupWorst)
+			{
+				wakeupWorst = seconds;
+			}
+		}
+		BoardSensors::finish(&poll->sample, poll->due, poll->readings);
+
+		n = 1;
+		write(donefd, &n, sizeof(n));
+	}
+
+	return NULL;
+}
+
+
+
+
+//****************************************************************************
+// The acquisition thread has handed a poll back.
+
+static void acquired(void *arg, unsigned events)
+{
+	uint64_t n;
+	if (read(donefd, &n, sizeof(n)) != sizeof(n) || current == NULL)
+	{
+		return;
+	}
+
+	wakeupStats.count = wakeups;
+	wakeupStats.sum = wakeupSum;
+	wakeupStats.worst = wakeupWorst;
+
+	complete();
+}
+
+
+
+
+//****************************************************************************
+// How long after it was due a sleep woke up, in seconds.
+
+static double late(const struct timespec *due, const struct timespec *woke)
+{
+	return (woke->tv_sec - due->tv_sec) + (woke->tv_nsec - due->tv_nsec) / 1e9;
+}
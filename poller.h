@@ -0,0 +1,48 @@
+//****************************************************************************
+// Reads the sensors from Monitor's event loop (reactor.h) without ever
+// sitting in a wait.  pollerStart() begins every due sensor and returns;
+// each one is fetched from a timer when its conversion is done, and once
+// they all have been the results are checked and done() is called.  In
+// between, the loop is free to answer scrapes and broker requests.
+//
+// Only one poll is on the buses at a time.  pollerStart() returns false if
+// one is already going; the idle callback is called each time one finishes
+// so whoever was turned away can try again.  It is called from the event
+// loop, never from inside the poll that finished: a poll of sensors with
+// nothing to wait for finishes inside pollerStart(), and an idle callback
+// that started another (burst mode does) would otherwise recurse until the
+// stack ran out.
+//
+// In real time mode (pollerRealtime()) the polls are done by an
+// acquisition thread instead: SCHED_FIFO, pinned to a CPU (ideally one
+// kept free with isolcpus=), with Monitor locked into memory.  It does
+// nothing but the I2C calls and the sleeps between them; pollResults(),
+// done() and all the writing still happen on the event loop's thread at
+// normal priority.  How late it wakes from each sleep goes to the metrics
+// (wakeupStats).
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include "sensors.h"
+
+struct SensorPoll
+{
+	bool due[NUM_SENSORS];			// set by the caller
+	void (*done)(SensorPoll *poll);
+
+	// The results, as pollSensors() leaves them
+
+	Sample sample;
+	SensorReading readings[NUM_SENSORS];
+	unsigned failed;
+
+	bool waiting[NUM_SENSORS];		// begun, not fetched yet
+};
+
+bool pollerStart(const SensorSlot *slots, SensorPoll *poll);
+bool pollerBusy(void);
+bool pollerIdle(void (*idle)(void));
+bool pollerRealtime(int cpu, int priority);
+
+#endif	// POLLER_H
@@ -0,0 +1,349 @@
+//****************************************************************************
+// Finding the sensors.  See probe.h.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "probe.h"
+#include "i2cbus.h"
+
+#define FIRST_ADDR	0x03		// the rest are reserved
+#define LAST_ADDR	0x77
+
+// Where i2cdetect reads instead of doing a quick write: a quick write can
+// lock some EEPROMs (0x50 to 0x5F) and confuse some other parts.
+
+#define READ_PROBE(addr)	(((addr) >= 0x30 && (addr) <= 0x37) || ((addr) >= 0x50 && (addr) <= 0x5F))
+#define MUX_PORTS	8
+#define MAX_FOUND	64
+
+struct Found
+{
+	int bus;			// index into config->bus
+	int mux;			// index into config->mux, or -1
+	int port;
+	int addr;
+	int sensor;			// what it is, or -1 if unknown
+	bool claimed;			// some sensor slot is using it
+};
+
+static Found found[MAX_FOUND];
+static int numFound;
+
+static void scanBus(Config *config, int bus);
+static void scanAddresses(Config *config, int bus, int mux, int port, const bool *skip, bool *seen);
+static bool answers(int fd, int addr);
+static int identify(const Config *config, const Found *f);
+static bool configuredAt(const Config *config, int sensor, const Found *f);
+static void allPortsOff(const Config *config, int bus);
+static void describe(const Config *config, const Found *f, char *text, int size);
+
+
+
+
+//****************************************************************************
+// Scans the buses and fixes the config up to match what is there.  Returns
+// how many sensors will be read.
+
+int probeSensors(Config *config)
+{
+	numFound = 0;
+
+	for (int b = 0; b < config->buses; b++)
+	{
+		// Only buses in use are open; scan each device just once.
+
+		bool scanned = config->bus[b].fd < 0;
+		for (int k = 0; !scanned && k < b; k++)
+		{
+			scanned = config->bus[k].fd == config->bus[b].fd;
+		}
+
+		if (!scanned)
+		{
+			scanBus(config, b);
+		}
+	}
+
+	int present = 0;
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (!config->enabled[i])
+		{
+			continue;
+		}
+
+		// Not on I2C, so just whether it is there at all
+
+		if (!BoardSensors::I2C_OF[i])
+		{
+			if (BoardSensors::identify(i, -1, 0))
+			{
+				present++;
+			}
+			else
+			{
+				printf("Probe: no %s found, it will not be read\n", BoardSensors::NAMES[i]);
+				config->enabled[i] = false;
+			}
+			continue;
+		}
+
+		SensorSlot *slot = &config->slot[i];
+		Found *match = NULL;
+
+		// Where the config says it is, or failing that anywhere at all
+
+		for (int n = 0; match == NULL && n < numFound; n++)
+		{
+			Found *f = &found[n];
+			if (f->sensor == i && !f->claimed && configuredAt(config, i, f))
+			{
+				match = f;
+			}
+		}
+
+		for (int n = 0; match == NULL && n < numFound; n++)
+		{
+			if (found[n].sensor == i && !found[n].claimed)
+			{
+				match = &found[n];
+
+				char where[64];
+				describe(config, match, where, sizeof(where));
+				printf("Probe: %s is at %s, not where the config says\n", BoardSensors::NAMES[i], where);
+			}
+		}
+
+		if (match == NULL)
+		{
+			printf("Probe: no %s found, it will not be read\n", BoardSensors::NAMES[i]);
+			config->enabled[i] = false;
+			continue;
+		}
+
+		match->claimed = true;
+		config->sensorBus[i] = match->bus;
+		slot->fd = config->bus[match->bus].fd;
+		slot->addr = match->addr;
+		slot->muxAddr = match->mux < 0 ? 0 : config->mux[match->mux].addr;
+		slot->muxPort = match->mux < 0 ? 0 : match->port;
+		present++;
+	}
+
+	return present;
+}
+
+
+
+
+//****************************************************************************
+// Scans one bus: first with every mux port off, then each mux port on its
+// own.  Whatever shows up behind a port that was not there with the ports
+// off is behind that port.
+
+static void scanBus(Config *config, int bus)
+{
+	bool isMux[LAST_ADDR + 1];
+	bool seen[LAST_ADDR + 1];
+
+	memset(isMux, 0, sizeof(isMux));
+	memset(seen, 0, sizeof(seen));
+
+	for (int m = 0; m < config->muxes; m++)
+	{
+		if (config->mux[m].bus == bus)
+		{
+			isMux[config->mux[m].addr] = true;
+		}
+	}
+
+	allPortsOff(config, bus);
+	scanAddresses(config, bus, -1, 0, isMux, seen);
+
+	for (int m = 0; m < config->muxes; m++)
+	{
+		if (config->mux[m].bus != bus)
+		{
+			continue;
+		}
+
+		for (int port = 0; port < MUX_PORTS; port++)
+		{
+			SensorSlot slot = { config->bus[bus].fd, 0, config->mux[m].addr, port };
+			SensorReading scratch;
+
+			if (driverMux(&slot, &scratch) != DRIVER_OK)
+			{
+				printf("Probe: mux %s is not answering\n", config->mux[m].name);
+				break;
+			}
+
+			// Skip the muxes and everything already seen on the bus itself
+
+			bool skip[LAST_ADDR + 1];
+			for (int addr = 0; addr <= LAST_ADDR; addr++)
+			{
+				skip[addr] = isMux[addr] || seen[addr];
+			}
+
+			bool behind[LAST_ADDR + 1];
+			memset(behind, 0, sizeof(behind));
+			scanAddresses(config, bus, m, port, skip, behind);
+		}
+
+		allPortsOff(config, bus);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Tries every address, and works out what each device that answers is.
+
+static void scanAddresses(Config *config, int bus, int mux, int port, const bool *skip, bool *seen)
+{
+	int fd = config->bus[bus].fd;
+
+	for (int addr = FIRST_ADDR; addr <= LAST_ADDR; addr++)
+	{
+		if (skip[addr] || !answers(fd, addr))
+		{
+			continue;
+		}
+
+		seen[addr] = true;
+		if (numFound == MAX_FOUND)
+		{
+			continue;
+		}
+
+		Found *f = &found[numFound++];
+		f->bus = bus;
+		f->mux = mux;
+		f->port = port;
+		f->addr = addr;
+		f->sensor = identify(config, f);
+		f->claimed = false;
+
+		char where[64];
+		describe(config, f, where, sizeof(where));
+		printf("Probe: %s %s\n", where, f->sensor < 0 ? "unknown device" : BoardSensors::NAMES[f->sensor]);
+	}
+}
+
+
+
+
+//****************************************************************************
+// A device is there if it acks its address, the same way i2cdetect checks:
+// a quick write (the address and no data) at most addresses, and a one
+// byte read where a quick write is not safe.  A read is no good as the
+// only check, since an SHT30 with no measurement pending does not ack one.
+
+static bool answers(int fd, int addr)
+{
+	unsigned char data;
+
+	if (READ_PROBE(addr))
+	{
+		return i2cSelect(fd, addr) == 0 && i2cRead(fd, &data, 1) == 1;
+	}
+
+	struct i2c_msg quick = { (unsigned short)addr, 0, 0, &data };
+	return i2cTransfer(fd, &quick, 1) == 1;
+}
+
+
+
+
+//****************************************************************************
+// Works out which sensor a device is.  Whatever the config says is there is
+// tried first, so a device at an address two parts share isn't poked at as
+// the other one.  If it isn't that, the sensors that can be at its address
+// are tried, the better signatures first.  Returns -1 if it is
+// none of them.
+
+static int identify(const Config *config, const Found *f)
+{
+	int fd = config->bus[f->bus].fd;
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (config->enabled[i] && BoardSensors::I2C_OF[i] && configuredAt(config, i, f) &&
+			BoardSensors::identify(i, fd, f->addr))
+		{
+			return i;
+		}
+	}
+
+	for (int strength = 2; strength > 0; strength--)
+	{
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			if (BoardSensors::SIGNATURES[i] == strength && BoardSensors::canBeAt(i, f->addr) &&
+				BoardSensors::identify(i, fd, f->addr))
+			{
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+// Whether the config puts a sensor where a device was found.
+
+static bool configuredAt(const Config *config, int sensor, const Found *f)
+{
+	const SensorSlot *slot = &config->slot[sensor];
+
+	return f->addr == slot->addr && config->bus[f->bus].fd == slot->fd &&
+		(f->mux < 0 ? slot->muxAddr == 0 :
+			config->mux[f->mux].addr == slot->muxAddr && f->port == slot->muxPort);
+}
+
+
+
+
+//****************************************************************************
+// Turns every port of every mux on a bus off.
+
+static void allPortsOff(const Config *config, int bus)
+{
+	static const unsigned char off = 0x00;
+
+	for (int m = 0; m < config->muxes; m++)
+	{
+		if (config->mux[m].bus == bus)
+		{
+			SensorReading scratch;
+			driverCommand(config->bus[bus].fd, config->mux[m].addr, &off, 1, &scratch);
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Describes where a device is, like "main 0x37" or "main tank:2 0x44".
+
+static void describe(const Config *config, const Found *f, char *text, int size)
+{
+	if (f->mux < 0)
+	{
+		snprintf(text, size, "%s 0x%02X", config->bus[f->bus].name, f->addr);
+	}
+	else
+	{
+		snprintf(text, size, "%s %s:%d 0x%02X", config->bus[f->bus].name,
+			config->mux[f->mux].name, f->port, f->addr);
+	}
+}
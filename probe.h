@@ -0,0 +1,25 @@
+//****************************************************************************
+// Finding the sensors.
+//
+// probeSensors() runs when the config is loaded.  It scans every open bus,
+// first with all mux ports off and then one mux port at a time, and checks
+// each device that answers against the sensor types this board knows,
+// using the identify() signature reads in drivers.h.  Then the schedule is
+// fixed up to match:
+//
+//  - a sensor found where the config says stays there
+//  - a sensor found somewhere else is read from there instead
+//  - a sensor that is nowhere to be found is not read at all
+//
+// Everything found is printed, unknown devices included, which makes it a
+// handy way to see what is on the bus.  A sensor that goes missing later
+// on is dealt with by health.h.
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "config.h"
+
+int probeSensors(Config *config);
+
+#endif	// PROBE_H
@@ -0,0 +1,86 @@
+//****************************************************************************
+// Prints percentiles for one channel over a window of time, using the
+// sketches Monitor saves with its rollups.  The sketches of every bucket in
+// the window are merged, so this never has to look at the raw report.
+//
+// Usage: quantiles <sketch file> <channel> [start epoch [end epoch]]
+//
+//    quantiles /home/pi/Jason/report_1h.sketch pH 1700000000 1700086400
+//
+// Use the 1h file for windows of hours to days, the 1d file for anything
+// longer and the 1m file for short windows.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "sketch.h"
+
+
+
+
+//****************************************************************************
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printf("Usage: %s <sketch file> <channel> [start epoch [end epoch]]\n", argv[0]);
+		exit(1);
+	}
+
+	const char *filename = argv[1];
+	const char *channel = argv[2];
+	long long start = argc > 3 ? atoll(argv[3]) : 0;
+	long long end = argc > 4 ? atoll(argv[4]) : 0x7FFFFFFFFFFFFFFFLL;
+
+	FILE *in = fopen(filename, "rb");
+	if (in == NULL)
+	{
+		printf("Error opening sketch file %s: %s\n", filename, strerror(errno));
+		exit(1);
+	}
+
+	// Merge every bucket that starts inside the window.
+
+	Sketch total;
+	sketchClear(&total);
+	int buckets = 0;
+
+	SketchRecord record;
+	while (fread(&record, SKETCH_RECORD_HEADER, 1, in) == 1)
+	{
+		// The header says how many centroids follow.
+
+		if (record.magic != SKETCH_RECORD_MAGIC ||
+			record.sketch.used > SKETCH_CENTROIDS ||
+			fread(record.sketch.centroid, sizeof(Centroid), record.sketch.used, in) != record.sketch.used)
+		{
+			printf("%s is not a sketch file or is damaged\n", filename);
+			exit(1);
+		}
+
+		if (record.start >= start && record.start < end &&
+			strcmp(record.channel, channel) == 0)
+		{
+			sketchMerge(&total, &record.sketch);
+			buckets++;
+		}
+	}
+	fclose(in);
+
+	if (total.count == 0)
+	{
+		printf("No samples for %s in that window\n", channel);
+		exit(1);
+	}
+
+	printf("%s: %u samples in %d buckets, min %1.2f, p5 %1.2f, p50 %1.2f, p95 %1.2f, max %1.2f\n",
+		channel, total.count, buckets, total.min,
+		sketchQuantile(&total, 0.05),
+		sketchQuantile(&total, 0.50),
+		sketchQuantile(&total, 0.95),
+		total.max);
+
+	exit(0);
+}
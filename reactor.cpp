@@ -0,0 +1,414 @@
+//****************************************************************************
+// Monitor's event loop.  See reactor.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "reactor.h"
+
+// epoll data values past the watches
+
+#define EVENT_TIMER	REACTOR_MAX_WATCHES
+#define EVENT_SIGNAL	(REACTOR_MAX_WATCHES + 1)
+
+#define MAX_SIGNAL	32
+
+struct Watch
+{
+	int fd;				// -1 when the slot is free
+	void (*ready)(void *arg, unsigned events);
+	void *arg;
+};
+
+struct Timer
+{
+	bool armed;
+	bool due;			// armed and due when this pass of runTimers() started
+	struct timespec when;
+	void (*fire)(void *arg);
+	void *arg;
+};
+
+static int epollfd = -1;
+static int timerfd = -1;
+static int sigfd = -1;
+static Watch watch[REACTOR_MAX_WATCHES];
+static Timer timer[REACTOR_MAX_TIMERS];
+static sigset_t signals;
+static void (*signalHandler[MAX_SIGNAL])(void);
+
+static int findWatch(int fd);
+static void rearm(void);
+static void runTimers(void);
+static void takeSignals(void);
+static bool before(const struct timespec *a, const struct timespec *b);
+
+
+
+
+//****************************************************************************
+// Sets up the epoll set and the timerfd.  Returns false after printing an
+// error if that can't be done.
+
+bool reactorInit(void)
+{
+	for (int i = 0; i < REACTOR_MAX_WATCHES; i++)
+	{
+		watch[i].fd = -1;
+	}
+	sigemptyset(&signals);
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u32 = EVENT_TIMER;
+	if (epollfd < 0 || timerfd < 0 || epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &event) < 0)
+	{
+		printf("Error setting up the event loop: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Calls ready(arg, events) whenever fd has any of the given EPOLL events.
+
+bool reactorWatch(int fd, unsigned events, void (*ready)(void *arg, unsigned events), void *arg)
+{
+	int slot = findWatch(-1);
+	if (slot < 0)
+	{
+		printf("Too many fds for the event loop\n");
+		return false;
+	}
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.u32 = slot;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		printf("Error adding to the event loop: %s\n", strerror(errno));
+		return false;
+	}
+
+	watch[slot].fd = fd;
+	watch[slot].ready = ready;
+	watch[slot].arg = arg;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Changes which events a watched fd is waited for.
+
+bool reactorChange(int fd, unsigned events)
+{
+	int slot = findWatch(fd);
+	if (slot < 0)
+	{
+		return false;
+	}
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.u32 = slot;
+	return epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+
+
+
+//****************************************************************************
+// Stops watching an fd.  Call this before closing it.
+
+void reactorForget(int fd)
+{
+	int slot = findWatch(fd);
+	if (slot >= 0)
+	{
+		epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+		watch[slot].fd = -1;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Calls fire(arg) once at the given CLOCK_MONOTONIC time (right away if it
+// has passed).  Returns the timer, for reactorCancel(), or -1 if there are
+// too many.
+
+int reactorAt(const struct timespec *when, void (*fire)(void *arg), void *arg)
+{
+	for (int i = 0; i < REACTOR_MAX_TIMERS; i++)
+	{
+		if (!timer[i].armed)
+		{
+			timer[i].armed = true;
+			timer[i].due = false;
+			timer[i].when = *when;
+			timer[i].fire = fire;
+			timer[i].arg = arg;
+			rearm();
+			return i;
+		}
+	}
+
+	printf("Too many timers for the event loop\n");
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+// Calls fire(arg) once, this many seconds from now.
+
+int reactorAfter(int seconds, void (*fire)(void *arg), void *arg)
+{
+	struct timespec when;
+	clock_gettime(CLOCK_MONOTONIC, &when);
+	when.tv_sec += seconds > 0 ? seconds : 0;
+
+	return reactorAt(&when, fire, arg);
+}
+
+
+
+
+//****************************************************************************
+// Stops a timer that has not gone off yet.
+
+void reactorCancel(int t)
+{
+	if (t >= 0 && t < REACTOR_MAX_TIMERS)
+	{
+		timer[t].armed = false;
+		rearm();
+	}
+}
+
+
+
+
+//****************************************************************************
+// Calls handler() from the loop whenever the signal comes in.  The signal
+// is blocked and read from a signalfd, so the handler can do anything.
+
+bool reactorSignal(int sig, void (*handler)(void))
+{
+	if (sig <= 0 || sig >= MAX_SIGNAL)
+	{
+		return false;
+	}
+
+	sigaddset(&signals, sig);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+	signalHandler[sig] = handler;
+
+	if (sigfd >= 0)
+	{
+		return signalfd(sigfd, &signals, 0) >= 0;
+	}
+
+	sigfd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u32 = EVENT_SIGNAL;
+	if (sigfd < 0 || epoll_ctl(epollfd, EPOLL_CTL_ADD, sigfd, &event) < 0)
+	{
+		printf("Error watching for signals: %s\n", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Waits for things to happen and calls whatever is waiting for them.
+// Never returns.
+
+void reactorRun(void)
+{
+	for (;;)
+	{
+		struct epoll_event events[REACTOR_MAX_WATCHES + 2];
+		int n = epoll_wait(epollfd, events, REACTOR_MAX_WATCHES + 2, -1);
+		if (n < 0)
+		{
+			if (errno != EINTR)
+			{
+				printf("Error waiting for events: %s\n", strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			unsigned slot = events[i].data.u32;
+
+			if (slot == EVENT_TIMER)
+			{
+				runTimers();
+			}
+			else if (slot == EVENT_SIGNAL)
+			{
+				takeSignals();
+			}
+			else if (watch[slot].fd >= 0)	// not forgotten by an earlier callback
+			{
+				watch[slot].ready(watch[slot].arg, events[i].events);
+			}
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Returns the watch slot for an fd, or -1.  findWatch(-1) finds a free one.
+
+static int findWatch(int fd)
+{
+	for (int i = 0; i < REACTOR_MAX_WATCHES; i++)
+	{
+		if (watch[i].fd == fd)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+//****************************************************************************
+// Sets the timerfd for the soonest timer, or turns it off if there are
+// none.
+
+static void rearm(void)
+{
+	struct itimerspec setting;
+	memset(&setting, 0, sizeof(setting));
+
+	bool any = false;
+	for (int i = 0; i < REACTOR_MAX_TIMERS; i++)
+	{
+		if (timer[i].armed && (!any || before(&timer[i].when, &setting.it_value)))
+		{
+			setting.it_value = timer[i].when;
+			any = true;
+		}
+	}
+
+	// A zero time would turn it off rather than fire right away
+
+	if (any && setting.it_value.tv_sec == 0 && setting.it_value.tv_nsec == 0)
+	{
+		setting.it_value.tv_nsec = 1;
+	}
+
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &setting, NULL);
+}
+
+
+
+
+//****************************************************************************
+// Fires every timer whose time had come when the pass started, soonest
+// first.  A timer set by one of them waits for the next pass even if it is
+// already due, so the loop gets back to epoll in between and a callback
+// that keeps setting itself again right away can't shut everything else
+// out.
+
+static void runTimers(void)
+{
+	unsigned long long expirations;
+	if (read(timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+	{
+		printf("Error reading the event loop timer: %s\n", strerror(errno));
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int i = 0; i < REACTOR_MAX_TIMERS; i++)
+	{
+		timer[i].due = timer[i].armed && !before(&now, &timer[i].when);
+	}
+
+	for (;;)
+	{
+		int soonest = -1;
+		for (int i = 0; i < REACTOR_MAX_TIMERS; i++)
+		{
+			if (timer[i].armed && timer[i].due &&
+				(soonest < 0 || before(&timer[i].when, &timer[soonest].when)))
+			{
+				soonest = i;
+			}
+		}
+
+		if (soonest < 0)
+		{
+			break;
+		}
+
+		timer[soonest].armed = false;
+		timer[soonest].fire(timer[soonest].arg);
+	}
+
+	rearm();
+}
+
+
+
+
+//****************************************************************************
+// Reads the signals that came in and calls their handlers.
+
+static void takeSignals(void)
+{
+	struct signalfd_siginfo info;
+
+	while (read(sigfd, &info, sizeof(info)) == sizeof(info))
+	{
+		if (info.ssi_signo < MAX_SIGNAL && signalHandler[info.ssi_signo] != NULL)
+		{
+			signalHandler[info.ssi_signo]();
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Whether time a is before time b.
+
+static bool before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
@@ -0,0 +1,41 @@
+//****************************************************************************
+// Monitor's event loop.  Everything Monitor does happens on one thread,
+// from reactorRun(), in answer to one of:
+//
+//  - an fd becoming readable or writable (the metrics and broker sockets)
+//  - a timer running out (the next sample, a sensor's conversion being
+//    done)
+//  - a signal (SIGUSR1 for the I2C stats, SIGHUP to reload the config,
+//    SIGTERM and SIGINT to stop, which saves the rollups, switches the
+//    dosing pump off and syncs the open segment first)
+//
+// It is one epoll set, with a timerfd armed for the soonest timer and a
+// signalfd for the signals, so nothing ever sleeps.  A sensor that takes
+// 15ms to convert just has a timer for when it will be done, and scrapes,
+// broker requests and other sensors carry on in the meantime.
+//
+// Callbacks must not block.  Timers are one shot and on CLOCK_MONOTONIC;
+// they and the watches come from fixed size tables.  A timer set from a
+// callback never fires inside it, even one due right away: it waits for
+// the next time round the loop, so the fds get their turn in between.
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <time.h>
+#include <sys/epoll.h>
+
+#define REACTOR_MAX_WATCHES	48
+#define REACTOR_MAX_TIMERS	16
+
+bool reactorInit(void);
+bool reactorWatch(int fd, unsigned events, void (*ready)(void *arg, unsigned events), void *arg);
+bool reactorChange(int fd, unsigned events);
+void reactorForget(int fd);
+int reactorAt(const struct timespec *when, void (*fire)(void *arg), void *arg);
+int reactorAfter(int seconds, void (*fire)(void *arg), void *arg);
+void reactorCancel(int timer);
+bool reactorSignal(int signal, void (*handler)(void));
+void reactorRun(void);
+
+#endif	// REACTOR_H
@@ -0,0 +1,51 @@
+//****************************************************************************
+// Prints a report with every gap filled in, so tools that expect a value in
+// every column can read a report written in deadband or adaptive mode.  A
+// channel that has not had a value yet stays empty.
+//
+// Usage: reconstruct <report file>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "reportreader.h"
+
+
+
+
+//****************************************************************************
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		printf("Usage: %s <report file>\n", argv[0]);
+		exit(1);
+	}
+
+	ReportReader reader;
+	if (!reportOpen(&reader, argv[1]))
+	{
+		exit(1);
+	}
+
+	printf("Date,Time,epoch");
+	for (int ch = 0; ch < reader.channels; ch++)
+	{
+		printf(",%s", reader.names[ch]);
+	}
+	printf("\n");
+
+	ReportRow row;
+	while (reportNext(&reader, &row))
+	{
+		printf("%s,%s,%lld", row.date, row.time, row.epoch);
+		for (int ch = 0; ch < reader.channels; ch++)
+		{
+			printf(",%s", row.known[ch] ? row.text[ch] : "");
+		}
+		printf("\n");
+	}
+
+	reportClose(&reader);
+	exit(0);
+}
@@ -0,0 +1,88 @@
+//****************************************************************************
+// Writing samples out as text or binary.  See record.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "record.h"
+#include "sensors.h"
+
+
+
+
+//****************************************************************************
+// Fills in a binary record from a sample.
+
+void recordEncode(const Sample *sample, Record *record)
+{
+	record->when = sample->when.tv_sec * 1000000000LL + sample->when.tv_nsec;
+	record->channels = sample->channels;
+	record->magic = RECORD_MAGIC & 0xFFFF;
+	record->valid = 0;
+
+	for (int ch = 0; ch < sample->channels; ch++)
+	{
+		if (sample->valid[ch])
+		{
+			record->valid |= 1 << ch;
+		}
+	}
+
+	memcpy(record->value, sample->value, sizeof(record->value));
+	memcpy(record->status, sample->status, sizeof(record->status));
+}
+
+
+
+
+//****************************************************************************
+// Turns a binary record back into a sample.
+
+void recordDecode(const Record *record, Sample *sample)
+{
+	memset(sample, 0, sizeof(*sample));
+	sample->when.tv_sec = record->when / 1000000000LL;
+	sample->when.tv_nsec = record->when % 1000000000LL;
+	sample->channels = record->channels <= NUM_CHANNELS ? record->channels : NUM_CHANNELS;
+
+	for (int ch = 0; ch < sample->channels; ch++)
+	{
+		sample->valid[ch] = (record->valid & (1 << ch)) != 0;
+		sample->value[ch] = record->value[ch];
+		sample->status[ch] = record->status[ch];
+	}
+}
+
+
+
+
+//****************************************************************************
+// Writes one line of the report.  Every row has every column: a channel that
+// was not read is left empty and one that failed is written as NaN (see
+// record.h).
+
+void writeRow(FILE *report, const Sample *sample)
+{
+	time_t now = sample->when.tv_sec;
+	struct tm *tp = localtime(&now);	// convert to local time
+
+	fprintf(report, "%02d/%02d/%04d,%02d:%02d:%02d,%lu",
+		tp->tm_mon + 1, tp->tm_mday, tp->tm_year + 1900,
+		tp->tm_hour, tp->tm_min, tp->tm_sec,
+		now);
+
+	for (int ch = 0; ch < sample->channels; ch++)
+	{
+		fprintf(report, ",");		// comma between fields
+		if (sample->valid[ch])
+		{
+			fprintf(report, channelFormats[ch], sample->value[ch]);
+		}
+		else if (sample->status[ch] > CHANNEL_OK)
+		{
+			fputs(MISSING_TEXT, report);
+		}
+	}
+	fprintf(report, "\n");
+}
@@ -0,0 +1,49 @@
+//****************************************************************************
+// The two ways a sample gets written out: as a line of text in the report
+// (CSV), or as a fixed size binary record.  A record is a plain struct, so
+// encoding one is a copy, and a file of them can be read back with a
+// single fread or just mapped into memory.  It holds exactly the channels
+// this board's sensor list (sensors.h) has, so its size is fixed at compile
+// time too, and every channel has a status (CHANNEL_ in sample.h) whether
+// it was read or not.
+//
+// In the text report every row has every column.  A field is:
+//
+//    a number        the channel was read
+//    empty           not read this time (not due, or unchanged in deadband
+//                    mode); the last value still stands
+//    NaN             the sensor was read and failed, or the value was
+//                    impossible; there is no current value
+//
+// so a parser never has to guess which.
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+
+#include "sample.h"
+#include "sensors.h"
+
+// Bumped whenever the layout of a record changes, NUM_CHANNELS included, so
+// a reader can tell a file of old records from a file of new ones.
+
+#define RECORD_MAGIC	0x48524333	// "HRC3"
+
+#define MISSING_TEXT	"NaN"
+
+struct Record
+{
+	long long when;			// nanoseconds since the epoch
+	unsigned valid;			// bit n set if channel n was read
+	unsigned short channels;	// number of channels in use
+	unsigned short magic;		// low 16 bits of RECORD_MAGIC
+	float value[NUM_CHANNELS];
+	unsigned char status[NUM_CHANNELS];
+};
+
+void recordEncode(const Sample *sample, Record *record);
+void recordDecode(const Record *record, Sample *sample);
+void writeRow(FILE *report, const Sample *sample);
+
+#endif	// RECORD_H
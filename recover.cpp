@@ -0,0 +1,153 @@
+//****************************************************************************
+// I2C bus recovery.  See recover.h.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "recover.h"
+
+// GPIO register offsets, in 32 bit words
+
+#define GPFSEL0		0
+#define GPCLR0		10
+#define GPLEV0		13
+
+#define GPIO_INPUT	0
+#define GPIO_OUTPUT	1
+
+#define GPIO_MAP_SIZE	4096
+#define RECOVER_CLOCKS	9
+#define HALF_CLOCK_NS	5000		// 100 kHz, give or take sleep overhead
+#define STRETCH_NS	1000000		// how long a device may hold SCL low
+
+static volatile uint32_t *gpio;
+
+static int getFunction(int pin);
+static void setFunction(int pin, int function);
+static bool level(int pin);
+static void halfClock(void);
+
+
+
+
+//****************************************************************************
+// Clocks a stuck bus free.  Returns true if SDA is high (the bus is free)
+// afterwards, false if it is still stuck or the pins could not be had.
+
+bool busRecover(int scl, int sda)
+{
+	if (gpio == NULL)
+	{
+		int fd = open(GPIO_MEMORY, O_RDWR | O_SYNC);
+		if (fd < 0)
+		{
+			printf("Error opening %s: %s\n", GPIO_MEMORY, strerror(errno));
+			return false;
+		}
+
+		void *map = mmap(NULL, GPIO_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+		{
+			printf("Error mapping %s: %s\n", GPIO_MEMORY, strerror(errno));
+			return false;
+		}
+		gpio = (volatile uint32_t *)map;
+	}
+
+	int sclFunction = getFunction(scl);
+	int sdaFunction = getFunction(sda);
+
+	// Both released, so the pull ups decide the levels.  A pin is only
+	// ever driven low, by making it an output with the latch cleared, so
+	// this is open drain just like the real thing.
+
+	gpio[GPCLR0] = (1u << scl) | (1u << sda);
+	setFunction(scl, GPIO_INPUT);
+	setFunction(sda, GPIO_INPUT);
+	halfClock();
+
+	for (int clock = 0; clock < RECOVER_CLOCKS && !level(sda); clock++)
+	{
+		setFunction(scl, GPIO_OUTPUT);
+		halfClock();
+		setFunction(scl, GPIO_INPUT);
+
+		// A device may stretch the clock, give it a moment
+
+		for (long waited = 0; !level(scl) && waited < STRETCH_NS; waited += HALF_CLOCK_NS)
+		{
+			halfClock();
+		}
+		halfClock();
+	}
+
+	// STOP: SDA goes from low to high while SCL is high
+
+	setFunction(scl, GPIO_OUTPUT);
+	halfClock();
+	setFunction(sda, GPIO_OUTPUT);
+	halfClock();
+	setFunction(scl, GPIO_INPUT);
+	halfClock();
+	setFunction(sda, GPIO_INPUT);
+	halfClock();
+
+	bool free = level(sda) && level(scl);
+
+	setFunction(scl, sclFunction);
+	setFunction(sda, sdaFunction);
+
+	return free;
+}
+
+
+
+
+//****************************************************************************
+// Each pin has a 3 bit function field, ten pins to a register.
+
+static int getFunction(int pin)
+{
+	return (gpio[GPFSEL0 + pin / 10] >> ((pin % 10) * 3)) & 7;
+}
+
+
+
+
+//****************************************************************************
+
+static void setFunction(int pin, int function)
+{
+	int shift = (pin % 10) * 3;
+	volatile uint32_t *reg = &gpio[GPFSEL0 + pin / 10];
+
+	*reg = (*reg & ~(7u << shift)) | ((uint32_t)function << shift);
+}
+
+
+
+
+//****************************************************************************
+
+static bool level(int pin)
+{
+	return (gpio[GPLEV0] >> pin) & 1;
+}
+
+
+
+
+//****************************************************************************
+
+static void halfClock(void)
+{
+	struct timespec delay = { 0, HALF_CLOCK_NS };
+	nanosleep(&delay, NULL);
+}
@@ -0,0 +1,22 @@
+//****************************************************************************
+// Unsticking an I2C bus.  If a device is reset or glitched in the middle of
+// a read it can be left holding SDA low, waiting for clocks that will never
+// come, and then nothing else on the bus can be talked to.  The cure is the
+// one in the I2C spec: clock SCL by hand until the device lets go of SDA
+// (nine clocks at most), then send a STOP.
+//
+// The I2C controller owns the pins, so this borrows them through the GPIO
+// registers (/dev/gpiomem, BCM283x/BCM2711 layout) and puts their functions
+// back exactly as they were when done.  The pins are BCM GPIO numbers; the
+// Pi's /dev/i2c-1 is SCL 3 and SDA 2.
+
+#ifndef RECOVER_H
+#define RECOVER_H
+
+#define GPIO_MEMORY		"/dev/gpiomem"
+#define DEFAULT_SCL_PIN		3
+#define DEFAULT_SDA_PIN		2
+
+bool busRecover(int scl, int sda);
+
+#endif	// RECOVER_H
@@ -0,0 +1,393 @@
+//****************************************************************************
+// Loading a report into columns.  See reportload.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "reportload.h"
+
+#define FIXED_COLUMNS	3		// Date,Time,epoch
+#define MAX_FIELDS	(FIXED_COLUMNS + MAX_CHANNELS + 1)
+#define MAX_HEADER	1024
+#define MAX_NUMBER	32		// longest field handed to strtof
+#define BLOCK		16		// bytes scanned at a time
+
+static bool readHeader(const char *data, const char *end, ReportColumns *columns, const char **body);
+static bool allocate(ReportColumns *columns, long rows);
+static unsigned delimiters(const char *p);
+static void addRow(ReportColumns *columns, const char **starts, const char *lineEnd);
+static long long parseEpoch(const char *p, const char *end);
+static float parseNumber(const char *p, const char *end);
+
+
+
+
+//****************************************************************************
+// Loads a report.  Returns false after printing an error if the file can
+// not be used.
+
+bool reportLoad(const char *filename, ReportColumns *columns)
+{
+	memset(columns, 0, sizeof(*columns));
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Error opening report file %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || info.st_size == 0)
+	{
+		printf("%s does not look like a report file\n", filename);
+		close(fd);
+		return false;
+	}
+
+	size_t size = info.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		printf("Error mapping report file %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	const char *data = (const char *)map;
+	const char *end = data + size;
+	const char *body;
+
+	if (!readHeader(data, end, columns, &body))
+	{
+		printf("%s does not look like a report file\n", filename);
+		munmap(map, size);
+		return false;
+	}
+
+	// One row per line at most, so count the lines first and never have
+	// to grow the columns.
+
+	long lines = 1;
+	for (const char *p = body; (p = (const char *)memchr(p, '\n', end - p)) != NULL; p++)
+	{
+		lines++;
+	}
+
+	if (!allocate(columns, lines))
+	{
+		munmap(map, size);
+		reportFree(columns);
+		return false;
+	}
+
+	// Each delimiter found ends a field; a newline ends the row too.
+
+	int expected = FIXED_COLUMNS + columns->channels;
+	const char *starts[MAX_FIELDS];
+	int fields = 1;
+	starts[0] = body;
+
+	long length = end - body;
+	for (long offset = 0; offset < length; offset += BLOCK)
+	{
+		unsigned mask;
+		if (offset + BLOCK <= length)
+		{
+			mask = delimiters(body + offset);
+		}
+		else
+		{
+			char tail[BLOCK];
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, body + offset, length - offset);
+			mask = delimiters(tail);
+		}
+
+		while (mask != 0)
+		{
+			const char *at = body + offset + __builtin_ctz(mask);
+			mask &= mask - 1;
+
+			if (*at == '\n')
+			{
+				if (fields == expected)
+				{
+					addRow(columns, starts, at);
+				}
+				fields = 0;
+			}
+
+			if (fields < MAX_FIELDS)
+			{
+				starts[fields] = at + 1;
+			}
+			fields++;
+		}
+	}
+
+	// The last line may not have a newline
+
+	if (fields == expected)
+	{
+		addRow(columns, starts, end);
+	}
+
+	munmap(map, size);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Frees the columns.
+
+void reportFree(ReportColumns *columns)
+{
+	free(columns->epoch);
+	free(columns->written);
+	for (int ch = 0; ch < MAX_CHANNELS; ch++)
+	{
+		free(columns->value[ch]);
+	}
+
+	memset(columns, 0, sizeof(*columns));
+}
+
+
+
+
+//****************************************************************************
+// Takes the channel names from the first line, and points body at the line
+// after it.
+
+static bool readHeader(const char *data, const char *end, ReportColumns *columns, const char **body)
+{
+	const char *newline = (const char *)memchr(data, '\n', end - data);
+	if (newline == NULL || newline - data >= MAX_HEADER)
+	{
+		return false;
+	}
+
+	char line[MAX_HEADER];
+	memcpy(line, data, newline - data);
+	line[newline - data] = '\0';
+	line[strcspn(line, "\r")] = '\0';
+
+	char *p = line;
+	char *field;
+	int count = 0;
+
+	while ((field = strsep(&p, ",")) != NULL)
+	{
+		if (count == 0 && strcmp(field, "Date") != 0)
+		{
+			return false;
+		}
+		if (count >= FIXED_COLUMNS + MAX_CHANNELS)
+		{
+			return false;
+		}
+		if (count >= FIXED_COLUMNS)
+		{
+			snprintf(columns->names[count - FIXED_COLUMNS], REPORT_FIELD_SIZE, "%s", field);
+		}
+		count++;
+	}
+
+	columns->channels = count - FIXED_COLUMNS;
+	*body = newline + 1;
+	return columns->channels > 0;
+}
+
+
+
+
+//****************************************************************************
+
+static bool allocate(ReportColumns *columns, long rows)
+{
+	columns->epoch = (long long *)malloc(rows * sizeof(long long));
+	columns->written = (unsigned *)malloc(rows * sizeof(unsigned));
+	bool good = columns->epoch != NULL && columns->written != NULL;
+
+	for (int ch = 0; ch < columns->channels; ch++)
+	{
+		columns->value[ch] = (float *)malloc(rows * sizeof(float));
+		good = good && columns->value[ch] != NULL;
+	}
+
+	if (!good)
+	{
+		printf("Out of memory loading %ld rows\n", rows);
+	}
+	return good;
+}
+
+
+
+
+//****************************************************************************
+// Finds the commas and newlines in 16 bytes.  Returns a mask with bit n set
+// if byte n is one.
+
+static unsigned delimiters(const char *p)
+{
+#if defined(__SSE2__)
+	__m128i block = _mm_loadu_si128((const __m128i *)p);
+	__m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(',')),
+		_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+	return _mm_movemask_epi8(hits);
+#elif defined(__ARM_NEON)
+	// NEON has no movemask, so give each byte its bit and add them up
+
+	static const uint8_t weights[BLOCK] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t block = vld1q_u8((const uint8_t *)p);
+	uint8x16_t hits = vorrq_u8(vceqq_u8(block, vdupq_n_u8(',')), vceqq_u8(block, vdupq_n_u8('\n')));
+	uint8x16_t bits = vandq_u8(hits, vld1q_u8(weights));
+	uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+	sum = vpadd_u8(sum, sum);
+	sum = vpadd_u8(sum, sum);
+	return vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < BLOCK; i++)
+	{
+		if (p[i] == ',' || p[i] == '\n')
+		{
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+
+
+
+//****************************************************************************
+// Adds one complete row.  starts[] points at each field, and each field
+// ends one before the next starts; the last one ends at lineEnd.
+
+static void addRow(ReportColumns *columns, const char **starts, const char *lineEnd)
+{
+	long row = columns->rows++;
+	int last = FIXED_COLUMNS + columns->channels - 1;
+	unsigned written = 0;
+
+	columns->epoch[row] = parseEpoch(starts[2], starts[3] - 1);
+
+	for (int ch = 0; ch < columns->channels; ch++)
+	{
+		int f = FIXED_COLUMNS + ch;
+		const char *start = starts[f];
+		const char *finish = f == last ? lineEnd : starts[f + 1] - 1;
+
+		if (finish > start && finish[-1] == '\r')
+		{
+			finish--;
+		}
+
+		float *value = columns->value[ch];
+		if (finish == start)
+		{
+			value[row] = row > 0 ? value[row - 1] : NAN;
+		}
+		else
+		{
+			value[row] = parseNumber(start, finish);
+			written |= 1u << ch;
+		}
+	}
+
+	columns->written[row] = written;
+}
+
+
+
+
+//****************************************************************************
+
+static long long parseEpoch(const char *p, const char *end)
+{
+	long long epoch = 0;
+
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		epoch = epoch * 10 + (*p++ - '0');
+	}
+
+	return epoch;
+}
+
+
+
+
+//****************************************************************************
+// Parses a field.  Everything Monitor writes is an optional minus, a few
+// digits, one or two decimal places and maybe a %, so that is done by hand.
+// Anything else (NaN, more decimals, an exponent) goes to strtof.
+
+static float parseNumber(const char *p, const char *end)
+{
+	static const unsigned scale[] = { 1, 10, 100 };
+
+	const char *start = p;
+	bool negative = *p == '-';
+	if (negative)
+	{
+		p++;
+	}
+
+	const char *digits = p;
+	unsigned whole = 0;
+	while (p < end && (unsigned)(*p - '0') < 10)
+	{
+		whole = whole * 10 + (*p++ - '0');
+	}
+	int wholeDigits = p - digits;
+
+	unsigned fraction = 0;
+	int places = 0;
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && (unsigned)(*p - '0') < 10 && places < 3)
+		{
+			fraction = fraction * 10 + (*p++ - '0');
+			places++;
+		}
+	}
+
+	if (p < end && *p == '%')
+	{
+		p++;
+	}
+
+	if (p == end && wholeDigits > 0 && wholeDigits <= 6 && places <= 2)
+	{
+		float value = (double)(whole * scale[places] + fraction) / scale[places];
+		return negative ? -value : value;
+	}
+
+	char text[MAX_NUMBER];
+	int length = end - start < MAX_NUMBER - 1 ? end - start : MAX_NUMBER - 1;
+	memcpy(text, start, length);
+	text[length] = '\0';
+	return strtof(text, NULL);
+}
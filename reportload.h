@@ -0,0 +1,42 @@
+//****************************************************************************
+// Loads a whole report file into columns, fast.  This is for going through
+// years of history; ReportReader is simpler for a row at a time.
+//
+// The file is mapped rather than read, the commas and newlines are found 16
+// bytes at a time with SIMD compares (SSE2 on x86-64, NEON where the
+// compiler has it, a plain loop otherwise), and the numbers are parsed by
+// a routine that only knows the formats Monitor writes (-12.34, 56.78%)
+// and hands anything else to strtof.
+//
+// The columns follow the same rules as ReportReader: an empty field takes
+// the value above it (NaN if there is none yet), a NaN field is NaN, and
+// written has bit ch set for the fields that had something in them.  Rows
+// with the wrong number of fields are skipped.
+//
+//    ReportColumns columns;
+//    if (reportLoad("report.csv", &columns))
+//    {
+//        ... columns.epoch[row], columns.value[ch][row] ...
+//        reportFree(&columns);
+//    }
+
+#ifndef REPORTLOAD_H
+#define REPORTLOAD_H
+
+#include "sample.h"
+#include "reportreader.h"
+
+struct ReportColumns
+{
+	long rows;
+	int channels;				// columns after Date,Time,epoch
+	char names[MAX_CHANNELS][REPORT_FIELD_SIZE];
+	long long *epoch;
+	float *value[MAX_CHANNELS];
+	unsigned *written;			// bit ch set if the field was not empty
+};
+
+bool reportLoad(const char *filename, ReportColumns *columns);
+void reportFree(ReportColumns *columns);
+
+#endif	// REPORTLOAD_H
@@ -0,0 +1,151 @@
+//****************************************************************************
+// Report reader with gap filling.  See reportreader.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "reportreader.h"
+
+#define MAX_LINE	1024
+
+// The fixed columns at the start of every row.
+
+#define FIXED_COLUMNS	3		// Date,Time,epoch
+
+static int splitFields(char *line, char **fields, int maxFields);
+
+
+
+
+//****************************************************************************
+// Opens a report and reads its header.  Returns false after printing an
+// error if the file can not be used.
+
+bool reportOpen(ReportReader *reader, const char *filename)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->in = fopen(filename, "r");
+	if (reader->in == NULL)
+	{
+		printf("Error opening report file %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	char line[MAX_LINE];
+	char *fields[FIXED_COLUMNS + MAX_CHANNELS + 1];
+	int count;
+
+	if (fgets(line, sizeof(line), reader->in) == NULL ||
+		(count = splitFields(line, fields, FIXED_COLUMNS + MAX_CHANNELS + 1)) <= FIXED_COLUMNS ||
+		count > FIXED_COLUMNS + MAX_CHANNELS ||
+		strcmp(fields[0], "Date") != 0)
+	{
+		printf("%s does not look like a report file\n", filename);
+		fclose(reader->in);
+		reader->in = NULL;
+		return false;
+	}
+
+	reader->channels = count - FIXED_COLUMNS;
+	for (int ch = 0; ch < reader->channels; ch++)
+	{
+		snprintf(reader->names[ch], REPORT_FIELD_SIZE, "%s", fields[FIXED_COLUMNS + ch]);
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Reads the next row, filling any empty fields from earlier rows.  Returns
+// false at the end of the file.  Rows that can not be parsed are skipped.
+
+bool reportNext(ReportReader *reader, ReportRow *row)
+{
+	char line[MAX_LINE];
+	char *fields[FIXED_COLUMNS + MAX_CHANNELS + 1];
+	ReportRow *last = &reader->last;
+
+	while (fgets(line, sizeof(line), reader->in) != NULL)
+	{
+		int count = splitFields(line, fields, FIXED_COLUMNS + MAX_CHANNELS + 1);
+		if (count != FIXED_COLUMNS + reader->channels)
+		{
+			continue;		// ragged or damaged row
+		}
+
+		snprintf(last->date, REPORT_FIELD_SIZE, "%s", fields[0]);
+		snprintf(last->time, REPORT_FIELD_SIZE, "%s", fields[1]);
+		last->epoch = atoll(fields[2]);
+
+		for (int ch = 0; ch < reader->channels; ch++)
+		{
+			char *field = fields[FIXED_COLUMNS + ch];
+			if (*field == '\0')
+			{
+				// Nothing written, carry the last value forward.
+
+				last->filled[ch] = last->known[ch];
+				continue;
+			}
+
+			last->value[ch] = strtof(field, NULL);	// stops at a trailing %
+			snprintf(last->text[ch], REPORT_FIELD_SIZE, "%s", field);
+			last->known[ch] = true;
+			last->filled[ch] = false;
+		}
+
+		*row = *last;
+		return true;
+	}
+
+	return false;
+}
+
+
+
+
+//****************************************************************************
+// Closes the report.
+
+void reportClose(ReportReader *reader)
+{
+	if (reader->in != NULL)
+	{
+		fclose(reader->in);
+		reader->in = NULL;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Splits a line at the commas, in place.  Empty fields are kept.  Returns
+// the number of fields, which may be more than maxFields if the line has
+// too many.
+
+static int splitFields(char *line, char **fields, int maxFields)
+{
+	line[strcspn(line, "\r\n")] = '\0';
+
+	int count = 0;
+	char *p = line;
+	char *field;
+
+	while ((field = strsep(&p, ",")) != NULL)
+	{
+		if (count < maxFields)
+		{
+			fields[count] = field;
+		}
+		count++;
+	}
+
+	return count;
+}
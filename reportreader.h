@@ -0,0 +1,49 @@
+//****************************************************************************
+// Reads a report file written by Monitor, one row at a time.  Empty fields
+// (left by deadband mode or adaptive sampling) are filled in with the last
+// value seen for that channel, so every row comes back complete.  A NaN
+// field (the sensor failed, see record.h) comes back as NaN, and is what
+// gets carried forward until the channel is read again.
+//
+//    ReportReader reader;
+//    ReportRow row;
+//    if (reportOpen(&reader, "report.csv"))
+//    {
+//        while (reportNext(&reader, &row))
+//            ... row.epoch, row.value[ch], row.filled[ch] ...
+//        reportClose(&reader);
+//    }
+
+#ifndef REPORTREADER_H
+#define REPORTREADER_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+#define REPORT_FIELD_SIZE	16
+
+struct ReportRow
+{
+	char date[REPORT_FIELD_SIZE];		// MM/DD/YYYY as written
+	char time[REPORT_FIELD_SIZE];		// HH:MM:SS as written
+	long long epoch;
+	float value[MAX_CHANNELS];
+	char text[MAX_CHANNELS][REPORT_FIELD_SIZE];	// the field as written
+	bool known[MAX_CHANNELS];		// false until a channel has a value
+	bool filled[MAX_CHANNELS];		// true if carried over from an earlier row
+};
+
+struct ReportReader
+{
+	FILE *in;
+	int channels;				// columns after Date,Time,epoch
+	char names[MAX_CHANNELS][REPORT_FIELD_SIZE];
+	ReportRow last;				// the values being carried forward
+};
+
+bool reportOpen(ReportReader *reader, const char *filename);
+bool reportNext(ReportReader *reader, ReportRow *row);
+void reportClose(ReportReader *reader);
+
+#endif	// REPORTREADER_H
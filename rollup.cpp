@@ -0,0 +1,391 @@
+//****************************************************************************
+// Maintains the 1 minute, 1 hour and 1 day rollups of the report.  See
+// rollup.h for the big picture.
+//
+// Each sample only touches the current bucket of each tier, so the cost per
+// sample is fixed no matter how long Monitor has been running.  When a
+// sample lands in a new bucket the old one is appended to the tier file and
+// the accumulators are cleared.
+//
+// Each bucket also carries a t-digest sketch per channel.  The p5, p50 and
+// p95 go into the tier file, and the sketch itself is appended to a
+// matching .sketch file so percentiles over any window can be had by
+// merging a handful of sketches (see quantiles.cpp).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "rollup.h"
+#include "sketch.h"
+
+// Bumped whenever the layout of the state file changes so an old state file
+// is ignored rather than misread.
+
+#define STATE_MAGIC	0x524F4C32	// "ROL2"
+
+#define NUM_TIERS	3
+
+static const struct
+{
+	const char *suffix;		// added to the report name
+	int seconds;			// length of one bucket
+} tiers[NUM_TIERS] =
+{
+	{ "1m", 60 },
+	{ "1h", 60 * 60 },
+	{ "1d", 24 * 60 * 60 },
+};
+
+// The running totals for one channel in one bucket.
+
+struct Bucket
+{
+	double sum;
+	float min;
+	float max;
+	float last;
+	unsigned count;
+	Sketch sketch;			// for the percentiles
+};
+
+struct Tier
+{
+	time_t start;			// start of the current bucket, 0 if none
+	Bucket bucket[MAX_CHANNELS];
+};
+
+// This is exactly what is saved in the state file.
+
+struct RollupState
+{
+	unsigned magic;
+	int channels;
+	unsigned namesHash;		// catches a change in the channel list
+	Tier tier[NUM_TIERS];
+};
+
+static RollupState state;
+static const char **channelNames;
+static bool enabled = false;
+static time_t saved;			// sample time of the last save
+
+static char tierFilename[NUM_TIERS][256];
+static char sketchFilename[NUM_TIERS][256];
+static char stateFilename[256];
+static char stateTempFilename[256];
+
+static unsigned hashNames(int channels, const char **names);
+static time_t bucketStart(time_t when, int seconds);
+static void flushTier(int t);
+static void loadState(void);
+static void saveState(void);
+
+
+
+
+//****************************************************************************
+// Sets up the rollup files based on the name of the report file.  Returns
+// false if rollups can not be kept; Monitor still runs, just without them.
+
+bool rollupInit(const char *reportFilename, int channels, const char **names)
+{
+	if (channels > MAX_CHANNELS)
+	{
+		printf("Too many channels for rollups: %d\n", channels);
+		return false;
+	}
+
+	// Strip the extension off the report name and use what is left as the
+	// base for all of the rollup files.
+
+	char base[200];
+	snprintf(base, sizeof(base), "%s", reportFilename);
+	char *dot = strrchr(base, '.');
+	char *slash = strrchr(base, '/');
+	if (dot != NULL && (slash == NULL || dot > slash))
+	{
+		*dot = '\0';
+	}
+
+	for (int t = 0; t < NUM_TIERS; t++)
+	{
+		snprintf(tierFilename[t], sizeof(tierFilename[t]), "%s_%s.csv", base, tiers[t].suffix);
+		snprintf(sketchFilename[t], sizeof(sketchFilename[t]), "%s_%s.sketch", base, tiers[t].suffix);
+	}
+	snprintf(stateFilename, sizeof(stateFilename), "%s_rollup.state", base);
+	snprintf(stateTempFilename, sizeof(stateTempFilename), "%s_rollup.tmp", base);
+
+	channelNames = names;
+	memset(&state, 0, sizeof(state));
+	state.magic = STATE_MAGIC;
+	state.channels = channels;
+	state.namesHash = hashNames(channels, names);
+
+	loadState();
+	enabled = true;
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Adds one sample to every tier.  Only valid channels are counted.
+
+void rollupSample(const Sample *sample)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	time_t now = sample->when.tv_sec;
+	bool closed = false;
+
+	for (int t = 0; t < NUM_TIERS; t++)
+	{
+		Tier *tier = &state.tier[t];
+		time_t start = bucketStart(now, tiers[t].seconds);
+
+		// A sample in a different bucket closes out the current one.  This
+		// also catches a bucket left over from before a restart.
+
+		if (tier->start != start)
+		{
+			closed |= tier->start != 0;
+			flushTier(t);
+			tier->start = start;
+		}
+
+		for (int ch = 0; ch < state.channels && ch < sample->channels; ch++)
+		{
+			if (!sample->valid[ch])
+			{
+				continue;
+			}
+
+			float value = sample->value[ch];
+			Bucket *b = &tier->bucket[ch];
+			if (b->count == 0 || value < b->min)
+			{
+				b->min = value;
+			}
+			if (b->count == 0 || value > b->max)
+			{
+				b->max = value;
+			}
+			b->sum += value;
+			b->last = value;
+			b->count++;
+			sketchAdd(&b->sketch, value);
+		}
+	}
+
+	// A closed bucket is in the tier files now, so the state has to go
+	// with it or a restart would write it again.  The 1 minute tier closes
+	// one every minute samples are coming in, so that is about how often
+	// this is; the time check is only a backstop.  Either way a crash loses
+	// at most the last minute or so of the open buckets.
+
+	if (closed || now - saved >= ROLLUP_SAVE_SECONDS)
+	{
+		saveState();
+		saved = now;
+	}
+}
+
+
+
+
+//****************************************************************************
+// Saves the open buckets, for when Monitor is stopping.
+
+void rollupFinish(void)
+{
+	if (enabled)
+	{
+		saveState();
+	}
+}
+
+
+
+
+//****************************************************************************
+// Simple string hash of the channel names, just to notice if they change.
+
+static unsigned hashNames(int channels, const char **names)
+{
+	unsigned hash = 5381;
+
+	for (int ch = 0; ch < channels; ch++)
+	{
+		for (const char *p = names[ch]; *p; p++)
+		{
+			hash = hash * 33 + (unsigned char)*p;
+		}
+		hash = hash * 33 + ',';
+	}
+
+	return hash;
+}
+
+
+
+
+//****************************************************************************
+// Returns the start of the bucket that contains the given time.  Buckets are
+// lined up on local time so the daily rollup runs midnight to midnight.
+
+static time_t bucketStart(time_t when, int seconds)
+{
+	struct tm local;
+	localtime_r(&when, &local);
+
+	long long shifted = (long long)when + local.tm_gmtoff;
+	return when - (time_t)(shifted % seconds);
+}
+
+
+
+
+//****************************************************************************
+// Appends the current bucket of a tier to its file, one row per channel that
+// had at least one sample, and then clears the bucket.
+
+static void flushTier(int t)
+{
+	Tier *tier = &state.tier[t];
+
+	if (tier->start != 0)
+	{
+		FILE *out = fopen(tierFilename[t], "a");
+		if (out == NULL)
+		{
+			printf("Error opening rollup file %s: %s\n", tierFilename[t], strerror(errno));
+		}
+		else
+		{
+			if (ftell(out) == 0)		// zero means empty file
+			{
+				fprintf(out, "Date,Time,epoch,Channel,Min,Max,Mean,Count,Last,P5,P50,P95\n");
+			}
+
+			struct tm *tp = localtime(&tier->start);
+
+			for (int ch = 0; ch < state.channels; ch++)
+			{
+				Bucket *b = &tier->bucket[ch];
+				if (b->count == 0)
+				{
+					continue;
+				}
+
+				fprintf(out, "%02d/%02d/%04d,%02d:%02d:%02d,%lu,%s,%1.2f,%1.2f,%1.2f,%u,%1.2f,%1.2f,%1.2f,%1.2f\n",
+					tp->tm_mon + 1, tp->tm_mday, tp->tm_year + 1900,
+					tp->tm_hour, tp->tm_min, tp->tm_sec,
+					tier->start, channelNames[ch],
+					b->min, b->max, b->sum / b->count, b->count, b->last,
+					sketchQuantile(&b->sketch, 0.05),
+					sketchQuantile(&b->sketch, 0.50),
+					sketchQuantile(&b->sketch, 0.95));
+			}
+			fclose(out);
+		}
+
+		// Now the sketches, one fixed size record per channel.
+
+		FILE *sketches = fopen(sketchFilename[t], "ab");
+		if (sketches == NULL)
+		{
+			printf("Error opening sketch file %s: %s\n", sketchFilename[t], strerror(errno));
+		}
+		else
+		{
+			for (int ch = 0; ch < state.channels; ch++)
+			{
+				Bucket *b = &tier->bucket[ch];
+				if (b->count == 0)
+				{
+					continue;
+				}
+
+				SketchRecord record;
+				memset(&record, 0, sizeof(record));
+				record.magic = SKETCH_RECORD_MAGIC;
+				record.start = tier->start;
+				snprintf(record.channel, sizeof(record.channel), "%s", channelNames[ch]);
+				record.sketch = b->sketch;
+				sketchQuantile(&record.sketch, 0.5);	// compresses it
+				fwrite(&record, SKETCH_RECORD_SIZE(&record), 1, sketches);
+			}
+			fclose(sketches);
+		}
+	}
+
+	tier->start = 0;
+	memset(tier->bucket, 0, sizeof(tier->bucket));
+}
+
+
+
+
+//****************************************************************************
+// Reads back the partially filled buckets saved by a previous run.  Anything
+// that does not match the current channel list is thrown away.
+
+static void loadState(void)
+{
+	FILE *in = fopen(stateFilename, "rb");
+	if (in == NULL)
+	{
+		return;			// first run, nothing to pick up
+	}
+
+	RollupState saved;
+	size_t got = fread(&saved, sizeof(saved), 1, in);
+	fclose(in);
+
+	if (got != 1 || saved.magic != STATE_MAGIC ||
+		saved.channels != state.channels || saved.namesHash != state.namesHash)
+	{
+		printf("Ignoring stale rollup state file %s\n", stateFilename);
+		return;
+	}
+
+	state = saved;
+}
+
+
+
+
+//****************************************************************************
+// Saves the partially filled buckets.  The state is written to a temporary
+// file and renamed over the old one so a power failure never leaves a half
+// written state file behind.
+
+static void saveState(void)
+{
+	FILE *out = fopen(stateTempFilename, "wb");
+	if (out == NULL)
+	{
+		printf("Error opening rollup state file %s: %s\n", stateTempFilename, strerror(errno));
+		return;
+	}
+
+	size_t put = fwrite(&state, sizeof(state), 1, out);
+	if (fclose(out) != 0 || put != 1)
+	{
+		printf("Error writing rollup state file %s: %s\n", stateTempFilename, strerror(errno));
+		return;
+	}
+
+	if (rename(stateTempFilename, stateFilename) != 0)
+	{
+		printf("Error renaming rollup state file %s: %s\n", stateFilename, strerror(errno));
+	}
+}
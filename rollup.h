@@ -0,0 +1,25 @@
+//****************************************************************************
+// Rollups are pre-aggregated copies of the report at coarser time steps so
+// that long range charts do not have to chew through every raw sample.
+//
+// For every channel and every bucket (1 minute, 1 hour and 1 day) this keeps
+// the min, max, mean, count and last value.  Each tier is written to its own
+// file next to the report, e.g. report.csv gets report_1m.csv, report_1h.csv
+// and report_1d.csv.  The partially filled buckets are saved in a state
+// file whenever a bucket closes, every ROLLUP_SAVE_SECONDS in between and
+// at shutdown (rollupFinish()), so a restart picks up where it left off.
+// The state carries a sketch per bucket, tens of KB, which is too much to
+// write to the SD card after every sample.
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "sample.h"
+
+#define ROLLUP_SAVE_SECONDS	60
+
+bool rollupInit(const char *reportFilename, int channels, const char **names);
+void rollupSample(const Sample *sample);
+void rollupFinish(void);
+
+#endif	// ROLLUP_H
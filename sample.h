@@ -0,0 +1,40 @@
+//****************************************************************************
+// A sample is one set of readings taken from all of the sensors during a
+// single reporting interval.  Each value written to the report is called a
+// channel; Monitor decides which channel is which, the other modules just
+// see an array of values.
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <time.h>
+
+// The most channels any sample can have.  Keeps everything fixed size.
+
+#define MAX_CHANNELS	16
+
+// Why a channel does or does not have a value.  A sample starts out zeroed,
+// so everything is CHANNEL_NOT_READ until a sensor says otherwise.
+
+enum
+{
+	CHANNEL_NOT_READ,	// not due, or held back by the deadband
+	CHANNEL_OK,
+	CHANNEL_TIMEOUT,	// the sensor did not answer in time
+	CHANNEL_BUS,		// any other I2C error
+	CHANNEL_CRC,		// the data came back damaged
+	CHANNEL_RANGE,		// read fine, but not a possible value
+	CHANNEL_FAILED		// failed, why is not known (a DS18B20 probe, or read
+				// back from a report)
+};
+
+struct Sample
+{
+	struct timespec when;		// when the sample was taken
+	int channels;			// number of channels in use
+	float value[MAX_CHANNELS];	// the reading for each channel
+	bool valid[MAX_CHANNELS];	// true when status is CHANNEL_OK
+	unsigned char status[MAX_CHANNELS];
+};
+
+#endif	// SAMPLE_H
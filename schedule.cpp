@@ -0,0 +1,283 @@
+//****************************************************************************
+// The sensor schedule.  See schedule.h.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "schedule.h"
+
+struct SensorRate
+{
+	int period;			// seconds, zero if not read
+	time_t since;			// when counting started
+	unsigned long reads;		// good reads since then
+	unsigned long missed;		// reads a whole period late
+	double busUs;			// bus time per read
+};
+
+static SensorRate rate[NUM_SENSORS];
+
+// The last config's figures, for the stats
+
+static int numBuses;
+static char busName[MAX_BUSES][CONFIG_NAME_SIZE];
+static double busUtilization[MAX_BUSES];
+static double busTime[MAX_BUSES];	// us, every sensor read once
+
+static double readUs(const Config *config, int i);
+
+
+
+
+//****************************************************************************
+// Checks that a config's schedule fits on its buses.  Prints what it finds
+// and returns false if it does not fit.
+
+bool scheduleCheck(const Config *config)
+{
+	bool fits = true;
+	double utilizations[MAX_BUSES];
+	double busTimes[MAX_BUSES];
+
+	for (int b = 0; b < config->buses; b++)
+	{
+		double utilization = 0;
+		double busUs = 0;
+		int longestReadyUs = 0;
+		int shortest = 0;
+
+		for (int i = 0; i < NUM_SENSORS; i++)
+		{
+			if (!config->enabled[i] || !BoardSensors::I2C_OF[i] || config->sensorBus[i] != b)
+			{
+				continue;
+			}
+
+			double us = readUs(config, i);
+			utilization += us / (config->every[i] * 1e6);
+			busUs += us;
+			if (BoardSensors::READY_US_OF[i] > longestReadyUs)
+			{
+				longestReadyUs = BoardSensors::READY_US_OF[i];
+			}
+			if (shortest == 0 || config->every[i] < shortest)
+			{
+				shortest = config->every[i];
+			}
+		}
+
+		utilizations[b] = utilization;
+		busTimes[b] = busUs;
+		if (shortest == 0)
+		{
+			continue;	// nothing on this bus
+		}
+
+		double worstUs = busUs + longestReadyUs;
+		double percent = utilization * 100;
+		double worstPercent = worstUs / (shortest * 1e4);
+		const char *name = config->bus[b].name;
+
+		if (percent > 100 || worstPercent > 100)
+		{
+			printf("Bus %s can't keep up: %.1f%% used at %d kHz, and with everything due at once a cycle takes %.1f ms, %.0f%% of the shortest interval (%d s)\n",
+				name, percent, config->bus[b].khz, worstUs / 1000, worstPercent, shortest);
+			fits = false;
+		}
+		else if (percent > SCHEDULE_WARN_PERCENT || worstPercent > SCHEDULE_WARN_PERCENT)
+		{
+			printf("Bus %s is busy: %.1f%% used at %d kHz, a cycle with everything due takes %.0f%% of the shortest interval\n",
+				name, percent, config->bus[b].khz, worstPercent);
+		}
+	}
+
+	if (!fits)
+	{
+		return false;
+	}
+
+	numBuses = config->buses;
+	for (int b = 0; b < config->buses; b++)
+	{
+		snprintf(busName[b], sizeof(busName[b]), "%s", config->bus[b].name);
+		busUtilization[b] = utilizations[b];
+		busTime[b] = busTimes[b];
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Takes on a config's schedule.  A sensor whose interval changed starts
+// counting afresh.
+
+void scheduleStart(const Config *config, time_t now)
+{
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		int period = config->enabled[i] ? config->every[i] : 0;
+		if (period != rate[i].period)
+		{
+			rate[i].period = period;
+			rate[i].since = now;
+			rate[i].reads = 0;
+			rate[i].missed = 0;
+		}
+		rate[i].busUs = readUs(config, i);
+	}
+}
+
+
+
+
+//****************************************************************************
+// Counts a cycle's reads.  due[] is when each sensor was due; failed has
+// bit i set if sensor i failed.
+
+void scheduleResults(const bool *polled, unsigned failed, const time_t *due, time_t now)
+{
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (!polled[i] || rate[i].period == 0)
+		{
+			continue;
+		}
+
+		if ((failed & (1u << i)) == 0)
+		{
+			rate[i].reads++;
+		}
+		if (due[i] != 0 && now >= due[i] + rate[i].period)	// 0 is right away
+		{
+			rate[i].missed++;
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// The cycle's deadline: the soonest that any sensor due by now is due
+// again.  Zero if none are due.
+
+time_t scheduleDeadline(const Config *config, const time_t *due, time_t now)
+{
+	time_t deadline = 0;
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (config->enabled[i] && due[i] <= now &&
+			(deadline == 0 || due[i] + config->every[i] < deadline))
+		{
+			deadline = due[i] + config->every[i];
+		}
+	}
+
+	return deadline;
+}
+
+
+
+
+//****************************************************************************
+// The expected and achieved rate of each channel, and its missed reads.
+// A schedule being kept reads once at the start and once per period after
+// that, so the period still to come is counted too: right after a read the
+// achieved rate is then the expected rate, and it dips until the next.
+
+void scheduleRates(double *expectedHz, double *achievedHz, unsigned long *missed)
+{
+	time_t now = time(NULL);
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		double expected = rate[i].period > 0 ? 1.0 / rate[i].period : 0;
+		double achieved = rate[i].period > 0 ? rate[i].reads / (double)(now - rate[i].since + rate[i].period) : 0;
+
+		for (int ch = BoardSensors::FIRST[i]; ch < BoardSensors::FIRST[i] + BoardSensors::VALUES_OF[i]; ch++)
+		{
+			expectedHz[ch] = expected;
+			achievedHz[ch] = achieved;
+			missed[ch] = rate[i].missed;
+		}
+	}
+}
+
+
+
+
+//****************************************************************************
+// Writes out the schedule and how well it is being kept.
+
+void scheduleDump(FILE *out)
+{
+	fprintf(out, "\nSchedule\n");
+	for (int b = 0; b < numBuses; b++)
+	{
+		fprintf(out, "  bus %-10s %6.3f%% used, %.2f ms of bus time with everything due\n",
+			busName[b], busUtilization[b] * 100, busTime[b] / 1000);
+	}
+
+	double expected[NUM_CHANNELS];
+	double achieved[NUM_CHANNELS];
+	unsigned long missed[NUM_CHANNELS];
+	scheduleRates(expected, achieved, missed);
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (rate[i].period == 0)
+		{
+			fprintf(out, "  %-10s off\n", BoardSensors::NAMES[i]);
+			continue;
+		}
+
+		int ch = BoardSensors::FIRST[i];
+		fprintf(out, "  %-10s every %d s, %.0f us of bus per read, expected %.5f/s, achieved %.5f/s, %lu late\n",
+			BoardSensors::NAMES[i], rate[i].period, rate[i].busUs, expected[ch], achieved[ch], missed[ch]);
+	}
+}
+
+
+
+
+//****************************************************************************
+// The bus time one read of a sensor takes, in microseconds.  None for one
+// that isn't on I2C.
+
+static double readUs(const Config *config, int i)
+{
+	if (!BoardSensors::I2C_OF[i])
+	{
+		return 0;
+	}
+
+	double clockUs = 1000.0 / config->bus[config->sensorBus[i]].khz;
+	int messages = BoardSensors::MESSAGES_OF[i];
+	int bytes = BoardSensors::BYTES_OF[i];
+	int calls = BoardSensors::READY_US_OF[i] > 0 ? 1 : 0;	// the fetch after the wait
+
+	// The pH read is as long as the config's settle makes it; BYTES is for
+	// the default
+
+	if (i == SENSOR_PH)
+	{
+		bytes += config->phSettle - DEFAULT_PH_SETTLE;
+	}
+
+	// A mux switch before each step, and each one is sent on its own
+
+	if (config->slot[i].muxAddr != 0)
+	{
+		messages += 2;
+		bytes += 2;
+		calls += 2;
+	}
+
+	// Each message is a start, the address byte, its bytes and a stop
+
+	return ((messages + bytes) * 9 + messages * 2) * clockUs + calls * SCHEDULE_CALL_US;
+}
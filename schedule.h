@@ -0,0 +1,57 @@
+//****************************************************************************
+// Whether the sensor schedule fits on the buses, and how well it is being
+// kept.
+//
+// Each read has a cost on its bus, worked out from what the driver sends
+// (MESSAGES and BYTES in drivers.h), the mux switches if the sensor is
+// behind one, and the bus speed from the config: every byte is 9 clocks,
+// every message adds a start and a stop, and every I2C_RDWR call costs
+// SCHEDULE_CALL_US on top.  The conversion wait (READY_US) keeps the sensor
+// busy but not the bus.
+//
+// When a config is loaded it is checked, bus by bus:
+//
+//  - utilization: the bus time each sensor needs per second of its
+//    interval, added up.  Over 100% can never be kept up with.
+//  - the worst cycle: every sensor on the bus due at once takes all of
+//    their bus times plus the longest conversion.  That has to fit in the
+//    shortest interval on the bus, or a sensor is due again before the
+//    cycle that reads it is done.
+//
+// A config that fails either is refused (at startup Monitor won't run, on
+// a reload the old config stays).  Over SCHEDULE_WARN_PERCENT it is taken
+// with a warning.  Burst mode (burst.h) is not counted; it only ever gets
+// what is left over.
+//
+// While Monitor runs, the cycles pass their results here.  The expected
+// rate of each channel (one per interval), the rate it is actually read at
+// and how many reads came a whole interval late go to the metrics and the
+// SIGUSR1 stats.
+//
+// When the cycle and the broker both want the bus, the one with the
+// earliest deadline goes first (see Monitor.cpp): the cycle's is when the
+// soonest of its sensors is due again, scheduleDeadline() works that out.
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "config.h"
+
+// What an I2C_RDWR costs besides the clocks on the wire, about what a Pi
+// shows in the i2c.stats for a short transfer.
+
+#define SCHEDULE_CALL_US	100
+
+#define SCHEDULE_WARN_PERCENT	50
+
+bool scheduleCheck(const Config *config);
+void scheduleStart(const Config *config, time_t now);
+void scheduleResults(const bool *polled, unsigned failed, const time_t *due, time_t now);
+time_t scheduleDeadline(const Config *config, const time_t *due, time_t now);
+void scheduleRates(double *expectedHz, double *achievedHz, unsigned long *missed);
+void scheduleDump(FILE *out);
+
+#endif	// SCHEDULE_H
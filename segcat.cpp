@@ -0,0 +1,89 @@
+//****************************************************************************
+// Prints a segment (see segment.h) as a report, with the same columns and
+// fields Monitor writes.  With -f it keeps going, printing records as
+// Monitor adds them, until the segment is full.  Watching for them is just
+// looking at the mapped header now and then, no reads.
+//
+// Usage: segcat [-f] <segment file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "segment.h"
+#include "record.h"
+#include "sensors.h"
+
+#define FOLLOW_US	(250 * 1000)
+
+static void usage(const char *name);
+
+
+
+
+//****************************************************************************
+int main(int argc, char **argv)
+{
+	bool follow = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "f")) != -1)
+	{
+		switch (option)
+		{
+			case 'f':
+				follow = true;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+	}
+
+	SegmentReader reader;
+	if (!segmentOpen(&reader, argv[optind]))
+	{
+		exit(1);
+	}
+
+	writeHeaders(stdout);
+
+	unsigned long long next = 0;
+	for (;;)
+	{
+		unsigned long long committed = segmentCommitted(&reader);
+		for (; next < committed; next++)
+		{
+			Sample sample;
+			recordDecode(&reader.records[next], &sample);
+			writeRow(stdout, &sample);
+		}
+
+		if (!follow || committed == reader.header->capacity)
+		{
+			break;
+		}
+		fflush(stdout);
+		usleep(FOLLOW_US);
+	}
+
+	segmentClose(&reader);
+	exit(0);
+}
+
+
+
+
+//****************************************************************************
+// Explains the command line and exits.
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-f] <segment file>\n", name);
+	printf("   -f  keep printing records as they are added\n");
+	exit(1);
+}
@@ -0,0 +1,379 @@
+//****************************************************************************
+// Memory mapped segment files.  See segment.h.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "segment.h"
+
+static bool enabled = false;
+static char dir[256];
+static int capacity;
+static int syncEvery;			// records, zero to leave it to the kernel
+
+// The segment being written
+
+static int fd = -1;
+static size_t length;
+static SegmentHeader *header = NULL;
+static Record *records;
+static unsigned long long synced;	// records msync'd so far
+
+static bool resume(void);
+static bool start(void);
+static bool map(int file, size_t size, bool writable, void **memory);
+static bool valid(const SegmentHeader *h, size_t size);
+static void syncRecords(void);
+static size_t segmentSize(unsigned long long records);
+
+
+
+
+//****************************************************************************
+// Turns segments on: they go in the given directory, made if it isn't
+// there, with room for records samples each, msync'd every syncEvery.
+// Returns false after printing an error if there is nowhere to put them.
+
+bool segmentInit(const char *segmentDir, int records, int everyRecords)
+{
+	snprintf(dir, sizeof(dir), "%s", segmentDir);
+	capacity = records;
+	syncEvery = everyRecords;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		printf("Error making segment directory %s: %s\n", dir, strerror(errno));
+		return false;
+	}
+
+	enabled = resume() || start();
+	return enabled;
+}
+
+
+
+
+//****************************************************************************
+// Adds a sample to the segment, starting a new one if it is full.
+
+void segmentSample(const Sample *sample)
+{
+	if (!enabled)
+	{
+		return;
+	}
+	if (header == NULL || header->committed == header->capacity)
+	{
+		segmentFinish();
+		if (!start())
+		{
+			return;		// try again next time
+		}
+	}
+
+	unsigned long long n = header->committed;
+	recordEncode(sample, &records[n]);
+	__atomic_store_n(&header->committed, n + 1, __ATOMIC_RELEASE);
+
+	if (syncEvery > 0 && n + 1 - synced >= (unsigned)syncEvery)
+	{
+		syncRecords();
+	}
+}
+
+
+
+
+//****************************************************************************
+// Syncs the segment and lets it go.
+
+void segmentFinish(void)
+{
+	if (header == NULL)
+	{
+		return;
+	}
+
+	syncRecords();
+	munmap(header, length);
+	close(fd);
+	header = NULL;
+	fd = -1;
+}
+
+
+
+
+//****************************************************************************
+// Maps a segment to read.  Returns false after printing an error if it
+// can't be, or isn't one this board's records fit.
+
+bool segmentOpen(SegmentReader *reader, const char *path)
+{
+	reader->fd = open(path, O_RDONLY);
+	if (reader->fd < 0)
+	{
+		printf("Error opening segment %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat info;
+	void *memory;
+	if (fstat(reader->fd, &info) < 0 || !map(reader->fd, info.st_size, false, &memory))
+	{
+		printf("Error mapping segment %s: %s\n", path, strerror(errno));
+		close(reader->fd);
+		return false;
+	}
+
+	reader->length = info.st_size;
+	reader->header = (const SegmentHeader *)memory;
+	reader->records = (const Record *)((const char *)memory + SEGMENT_HEADER_SIZE);
+
+	if (!valid(reader->header, reader->length))
+	{
+		printf("%s is not a segment of this board's records\n", path);
+		segmentClose(reader);
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// How many records there are to read so far.
+
+unsigned long long segmentCommitted(const SegmentReader *reader)
+{
+	return __atomic_load_n(&reader->header->committed, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+//****************************************************************************
+
+void segmentClose(SegmentReader *reader)
+{
+	munmap((void *)reader->header, reader->length);
+	close(reader->fd);
+}
+
+
+
+
+//****************************************************************************
+// Carries on with the newest segment in the directory, if it has room and
+// was written by this board.  Returns false if there isn't one.
+
+static bool resume(void)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL)
+	{
+		return false;
+	}
+
+	// The names are times, so the newest sorts last.  "_" sorts after ".",
+	// so a segment with a sequence number comes after the one without.
+
+	char newest[256] = "";
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL)
+	{
+		size_t n = strlen(entry->d_name);
+		if (n > strlen(SEGMENT_SUFFIX) && n < sizeof(newest) &&
+			strcmp(entry->d_name + n - strlen(SEGMENT_SUFFIX), SEGMENT_SUFFIX) == 0 &&
+			strcmp(entry->d_name, newest) > 0)
+		{
+			strcpy(newest, entry->d_name);
+		}
+	}
+	closedir(d);
+
+	if (newest[0] == '\0')
+	{
+		return false;
+	}
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", dir, newest);
+
+	fd = open(path, O_RDWR);
+	struct stat info;
+	void *memory;
+	if (fd < 0 || fstat(fd, &info) < 0 || !map(fd, info.st_size, true, &memory))
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+		return false;
+	}
+
+	header = (SegmentHeader *)memory;
+	length = info.st_size;
+	if (!valid(header, length) || header->committed == header->capacity)
+	{
+		segmentFinish();
+		return false;
+	}
+
+	records = (Record *)((char *)memory + SEGMENT_HEADER_SIZE);
+	synced = header->committed;
+	printf("Carrying on with segment %s at record %llu\n", path, header->committed);
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Starts a new segment: allocates the whole file, maps it and writes the
+// header.  Returns false after printing an error if it can't.
+
+static bool start(void)
+{
+	time_t now = time(NULL);
+	struct tm local;
+	localtime_r(&now, &local);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+	// One started within the same second gets a sequence number, which
+	// still sorts after the ones before it (see resume())
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s%s", dir, stamp, SEGMENT_SUFFIX);
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	for (int n = 1; fd < 0 && errno == EEXIST && n <= MAX_SEGMENT_SEQUENCE; n++)
+	{
+		snprintf(path, sizeof(path), "%s/%s_%03d%s", dir, stamp, n, SEGMENT_SUFFIX);
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd < 0)
+	{
+		printf("Error creating segment %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	// Allocating the blocks now means the disk can't fill up under the
+	// mapping later, which would be a SIGBUS rather than an error.  A file
+	// system that can't do that gets a sparse file instead.
+
+	length = segmentSize(capacity);
+	int allocated = fallocate(fd, 0, 0, length);
+	if (allocated < 0 && errno == EOPNOTSUPP)
+	{
+		allocated = ftruncate(fd, length);
+	}
+
+	void *memory;
+	if (allocated < 0 || !map(fd, length, true, &memory))
+	{
+		printf("Error allocating segment %s: %s\n", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		fd = -1;
+		return false;
+	}
+
+	header = (SegmentHeader *)memory;
+	records = (Record *)((char *)memory + SEGMENT_HEADER_SIZE);
+	synced = 0;
+
+	struct timespec created;
+	clock_gettime(CLOCK_REALTIME, &created);
+
+	header->recordSize = sizeof(Record);
+	header->capacity = capacity;
+	header->committed = 0;
+	header->created = created.tv_sec * 1000000000LL + created.tv_nsec;
+	__atomic_store_n(&header->magic, SEGMENT_MAGIC, __ATOMIC_RELEASE);	// last, so it is complete
+
+	return true;
+}
+
+
+
+
+//****************************************************************************
+// Maps a file, shared so readers see the writes.  Returns false with errno
+// set if it can't.
+
+static bool map(int file, size_t size, bool writable, void **memory)
+{
+	if (size < SEGMENT_HEADER_SIZE)
+	{
+		errno = EINVAL;
+		return false;
+	}
+
+	*memory = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+	return *memory != MAP_FAILED;
+}
+
+
+
+
+//****************************************************************************
+// Whether a header is a segment of this board's records that fits in a
+// file of the given size.
+
+static bool valid(const SegmentHeader *h, size_t size)
+{
+	return h->magic == SEGMENT_MAGIC && h->recordSize == sizeof(Record) &&
+		segmentSize(h->capacity) <= size && h->committed <= h->capacity;
+}
+
+
+
+
+//****************************************************************************
+// Writes out the records added since the last sync, then the header that
+// counts them.
+
+static void syncRecords(void)
+{
+	unsigned long long committed = header->committed;
+	if (committed == synced)
+	{
+		return;
+	}
+
+	long page = sysconf(_SC_PAGESIZE);
+	size_t from = (SEGMENT_HEADER_SIZE + synced * sizeof(Record)) / page * page;
+	size_t to = SEGMENT_HEADER_SIZE + committed * sizeof(Record);
+
+	if (msync((char *)header + from, to - from, MS_SYNC) < 0 ||
+		msync(header, SEGMENT_HEADER_SIZE, MS_SYNC) < 0)
+	{
+		printf("Error syncing segment: %s\n", strerror(errno));
+		return;
+	}
+
+	synced = committed;
+}
+
+
+
+
+//****************************************************************************
+// The size of a segment file with room for so many records.
+
+static size_t segmentSize(unsigned long long count)
+{
+	return SEGMENT_HEADER_SIZE + count * sizeof(Record);
+}
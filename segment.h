@@ -0,0 +1,81 @@
+//****************************************************************************
+// Sample records in memory mapped segment files.  With segments turned on,
+// Monitor writes every sample as a binary record (see record.h) into a
+// segment as well as the report, in
+//
+//    <segments dir>/<YYYYMMDD-HHMMSS>.seg
+//
+// named for when the segment was started.  One started in the same second
+// as the one before it (small segments, or burst rate samples) gets a
+// sequence number too, <YYYYMMDD-HHMMSS>_001.seg and so on.  A segment is a SegmentHeader
+// padded to SEGMENT_HEADER_SIZE, then room for capacity records.  The whole
+// file is allocated up front and mapped, so adding a record is filling in
+// the next slot in memory and bumping committed: no system call, no stdio.
+// When a segment is full the next one is started.  At startup Monitor
+// carries on with the newest segment if it still has room.
+//
+// committed is only ever bumped after its record is complete, with a
+// release store, so a program that maps the segment too (segmentOpen())
+// and loads it with an acquire (segmentCommitted()) sees whole records,
+// and sees new ones as they come without any system calls.  segcat does
+// that.
+//
+// What is on the card is another matter: the kernel writes the pages out
+// when it likes.  Every "sync" records the new ones are msync'd, records
+// first and then the header, so after a crash the file holds at least the
+// records up to the last sync.  The header can get written out on its own
+// in between, so committed may run ahead of what made it to the card; such
+// records don't have RECORD_MAGIC in them.
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stddef.h>
+
+#include "record.h"
+#include "sample.h"
+
+#define SEGMENT_MAGIC		0x48534731	// "HSG1"
+#define SEGMENT_HEADER_SIZE	4096
+#define SEGMENT_SUFFIX		".seg"
+
+// 64K records is a few MB, a couple of months of samples a minute apart.
+
+#define DEFAULT_SEGMENT_RECORDS	65536
+#define MIN_SEGMENT_RECORDS	64
+#define DEFAULT_SEGMENT_SYNC	16
+
+// The most segments that can be started in one second
+
+#define MAX_SEGMENT_SEQUENCE	999
+
+struct SegmentHeader
+{
+	unsigned magic;			// SEGMENT_MAGIC
+	unsigned recordSize;		// sizeof(Record) of the board that wrote it
+	unsigned long long capacity;	// records there is room for
+	unsigned long long committed;	// records written, see above
+	long long created;		// nanoseconds since the epoch
+};
+
+struct SegmentReader
+{
+	int fd;
+	size_t length;
+	const SegmentHeader *header;
+	const Record *records;
+};
+
+// Monitor's side
+
+bool segmentInit(const char *dir, int records, int syncEvery);
+void segmentSample(const Sample *sample);
+void segmentFinish(void);
+
+// A reader's side
+
+bool segmentOpen(SegmentReader *reader, const char *path);
+unsigned long long segmentCommitted(const SegmentReader *reader);
+void segmentClose(SegmentReader *reader);
+
+#endif	// SEGMENT_H
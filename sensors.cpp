@@ -0,0 +1,148 @@
+//****************************************************************************
+// The sensors Monitor reads.  See sensors.h.
+
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#include "sensors.h"
+#include "metrics.h"
+
+const char *channelNames[NUM_CHANNELS] =
+{
+	"PCT_C", "PCT_F", "pH", "TempC", "TempF", "Humidity", "Probe1_C", "Probe2_C"
+};
+
+// How each channel is printed in the report.
+
+const char *channelFormats[NUM_CHANNELS] =
+{
+	"%1.1f", "%1.1f", "%1.1f", "%1.2f", "%1.2f", "%1.2f%%", "%1.2f", "%1.2f"
+};
+
+// The lowest and highest value each channel can really have, from the
+// sensor data sheets.  Anything outside is marked CHANNEL_RANGE.
+
+const float channelLimits[NUM_CHANNELS][2] =
+{
+	{ -55, 125 }, { -67, 257 }, { 0, 14 }, { -40, 125 }, { -40, 257 }, { 0, 100 },
+	{ -55, 125 }, { -55, 125 }
+};
+
+static int channelStatus(const SensorReading *reading);
+
+
+
+
+//****************************************************************************
+// Writes the column headers of the report.
+
+void writeHeaders(FILE *report)
+{
+	fputs(BoardSensors::HEADER.data(), report);
+}
+
+
+
+
+//****************************************************************************
+// Reads every sensor that is due into the sample.  They are all started
+// together, so their conversion times overlap.  Errors are reported and
+// counted here, and every channel of a due sensor gets a status saying how
+// the read went; only CHANNEL_OK ones are valid.  Returns a mask of the
+// sensors that failed, bit i for sensor i (a value out of range does not
+// count, the sensor answered).  The raw readings are left in readings[],
+// NUM_SENSORS of them.
+
+unsigned pollSensors(const SensorSlot *slots, Sample *sample, const bool *due, SensorReading *readings)
+{
+	BoardSensors::poll(slots, sample, due, readings);
+	return pollResults(sample, due, readings);
+}
+
+
+
+
+//****************************************************************************
+// The second half of pollSensors(), for when the sensors were read a step
+// at a time (see poller.h): sets the channel statuses from the readings,
+// reports and counts the errors and returns the mask of failed sensors.
+
+unsigned pollResults(Sample *sample, const bool *due, const SensorReading *readings)
+{
+	unsigned failed = 0;
+
+	for (int i = 0; i < NUM_SENSORS; i++)
+	{
+		if (!due[i])
+		{
+			continue;
+		}
+
+		int first = BoardSensors::FIRST[i];
+		int last = first + BoardSensors::VALUES_OF[i];
+		int status = channelStatus(&readings[i]);
+
+		for (int ch = first; ch < last; ch++)
+		{
+			sample->status[ch] = status;
+
+			// A DS18B20 probe that is missing or could not be read (w1.cpp
+			// throws out the 85C power on value too).  The probe was due,
+			// so this is a failure, not a channel that was skipped.
+
+			if (status == CHANNEL_OK && isnan(sample->value[ch]))
+			{
+				sample->status[ch] = CHANNEL_FAILED;
+				sample->valid[ch] = false;
+			}
+			else if (status == CHANNEL_OK &&
+				(sample->value[ch] < channelLimits[ch][0] || sample->value[ch] > channelLimits[ch][1]))
+			{
+				printf("%s: %s of %g is out of range\n", BoardSensors::NAMES[i],
+					channelNames[ch], sample->value[ch]);
+				sample->status[ch] = CHANNEL_RANGE;
+				sample->valid[ch] = false;
+			}
+		}
+
+		if (status == CHANNEL_OK)
+		{
+			continue;
+		}
+
+		failed |= 1u << i;
+		printf("%s: %s\n", BoardSensors::NAMES[i], driverError(&readings[i]));
+		if (readings[i].status == DRIVER_CRC_ERROR)
+		{
+			counters.crcErrors++;
+		}
+		else
+		{
+			counters.i2cErrors++;
+		}
+	}
+
+	return failed;
+}
+
+
+
+
+//****************************************************************************
+// What a driver status means for the channels of the sensor.
+
+static int channelStatus(const SensorReading *reading)
+{
+	switch (reading->status)
+	{
+		case DRIVER_OK:
+			return CHANNEL_OK;
+
+		case DRIVER_CRC_ERROR:
+			return CHANNEL_CRC;
+
+		default:
+			return reading->error == ETIMEDOUT ? CHANNEL_TIMEOUT : CHANNEL_BUS;
+	}
+}
@@ -0,0 +1,64 @@
+//****************************************************************************
+// The sensors Monitor reads and the channels they fill in.  Each value
+// written to the report is a channel; each sensor fills in one or more of
+// them.
+//
+// The list of sensors is fixed at compile time (sensortable.h); that is
+// what decides the channels, the order they are read in and the report's
+// header.  The channel names below have to agree with it, which the
+// static_asserts check.
+
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <stdio.h>
+
+#include "sample.h"
+#include "sensortable.h"
+
+// The sensors on this board, in the order their columns appear in the
+// report.  Each sensor is read when its channels are due.
+
+typedef SensorList<Pct2075, Ph, Sht30, Ds18b20> BoardSensors;
+
+enum
+{
+	SENSOR_PCT2075,
+	SENSOR_PH,
+	SENSOR_SHT30,
+	SENSOR_DS18B20,
+	NUM_SENSORS
+};
+
+// Each value written to the report is a channel.  These are the indexes
+// into the sample that the sensors fill in.
+
+enum
+{
+	CH_PCT_C,
+	CH_PCT_F,
+	CH_PH,
+	CH_SHT_C,
+	CH_SHT_F,
+	CH_HUMIDITY,
+	CH_PROBE1_C,
+	CH_PROBE2_C,
+	NUM_CHANNELS
+};
+
+extern const char *channelNames[NUM_CHANNELS];
+extern const char *channelFormats[NUM_CHANNELS];
+extern const float channelLimits[NUM_CHANNELS][2];
+
+static_assert(NUM_SENSORS == BoardSensors::COUNT, "sensor enum does not match BoardSensors");
+static_assert(NUM_CHANNELS == BoardSensors::VALUES, "channel enum does not match BoardSensors");
+static_assert(BoardSensors::FIRST[SENSOR_PCT2075] == CH_PCT_C &&
+	BoardSensors::FIRST[SENSOR_PH] == CH_PH &&
+	BoardSensors::FIRST[SENSOR_SHT30] == CH_SHT_C &&
+	BoardSensors::FIRST[SENSOR_DS18B20] == CH_PROBE1_C, "channels out of order");
+
+void writeHeaders(FILE *report);
+unsigned pollSensors(const SensorSlot *slots, Sample *sample, const bool *due, SensorReading *readings);
+unsigned pollResults(Sample *sample, const bool *due, const SensorReading *readings);
+
+#endif	// SENSORS_H
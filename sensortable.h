@@ -0,0 +1,366 @@
+//****************************************************************************
+// A list of sensors fixed at compile time.  Give SensorList the driver
+// types (drivers.h) in the order their columns appear in the report:
+//
+//    typedef SensorList<Pct2075, Ph, Sht30> BoardSensors;
+//
+// and everything that follows from that list is worked out by the compiler:
+//
+//    COUNT, VALUES      number of sensors, and of values (channels) overall
+//    VALUES_OF[i]       values sensor i fills in
+//    FIRST[i]           the channel sensor i's values start at
+//    ORDER[n]           the sensor to fetch n'th, soonest ready first
+//    READY_US_OF[i]     how long sensor i takes to convert
+//    MESSAGES_OF[i]     I2C messages and bytes one read of sensor i takes
+//    BYTES_OF[i]
+//    I2C_OF[i]          whether sensor i is on an I2C bus at all
+//    HEADER             the report's header line, newline included
+//    NAMES[i]           sensor names, for error messages and config files
+//    ADDRS[i]           the address each sensor usually has
+//    SIGNATURES[i]      how well identify() recognizes each sensor
+//    canBeAt(i, addr)   whether sensor i can be strapped to addr
+//    identify(i, ...)   whether sensor i is what answers at an address
+//
+// poll() starts every due sensor, waits for each in ORDER and decodes its
+// values straight into the sample.  The same thing can be done without
+// sitting through the waits: start() begins every due sensor, collect()
+// fetches whichever ones are ready and says when the next one will be, and
+// finish() decodes them all once nothing is left waiting.  Monitor does
+// that from its event loop (see poller.h).
+//
+// The transfers are queued (see drivers.h), so a cycle is one I2C_RDWR for
+// the starts and the fetches that need no wait, then one per wait.  It is
+// all unrolled per sensor, so each driver's steps are called directly (and
+// inlined) with no tables of function pointers and no looking up of names
+// or columns at run time.  Only where each sensor is (bus, address, mux
+// port) comes in at run time, as a SensorSlot per sensor.  A board with
+// other sensors just changes the list.
+
+#ifndef SENSORTABLE_H
+#define SENSORTABLE_H
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "drivers.h"
+#include "sample.h"
+
+#define REPORT_HEADER_START	"Date,Time,epoch"
+
+
+//****************************************************************************
+// Where each sensor's values start, given how many each one has.
+
+template <size_t N>
+constexpr std::array<int, N> sensorOffsets(std::array<int, N> values)
+{
+	std::array<int, N> first = {};
+	int next = 0;
+
+	for (size_t i = 0; i < N; i++)
+	{
+		first[i] = next;
+		next += values[i];
+	}
+
+	return first;
+}
+
+//****************************************************************************
+// The order to fetch sensors in: soonest ready first, and in list order
+// when they tie.
+
+template <size_t N>
+constexpr std::array<int, N> sensorOrder(std::array<int, N> readyUs)
+{
+	std::array<int, N> order = {};
+
+	for (size_t i = 0; i < N; i++)
+	{
+		size_t j = i;
+		while (j > 0 && readyUs[order[j - 1]] > readyUs[i])
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	return order;
+}
+
+//****************************************************************************
+// The header line: the fixed columns, then each sensor's.
+
+template <size_t LENGTH, size_t N>
+constexpr std::array<char, LENGTH> sensorHeader(std::array<const char *, N> columns)
+{
+	std::array<char, LENGTH> header = {};
+	size_t n = 0;
+
+	for (const char *c = REPORT_HEADER_START; *c != '\0'; c++)
+	{
+		header[n++] = *c;
+	}
+
+	for (size_t i = 0; i < N; i++)
+	{
+		header[n++] = ',';
+		for (const char *c = columns[i]; *c != '\0'; c++)
+		{
+			header[n++] = *c;
+		}
+	}
+
+	header[n++] = '\n';
+	header[n] = '\0';
+	return header;
+}
+
+//****************************************************************************
+
+template <typename... Sensors>
+struct SensorList
+{
+	template <size_t I>
+	using Sensor = typename std::tuple_element<I, std::tuple<Sensors...> >::type;
+
+	static constexpr int COUNT = sizeof...(Sensors);
+	static constexpr int VALUES = (0 + ... + Sensors::VALUES);
+
+	static constexpr std::array<int, COUNT> VALUES_OF = { { Sensors::VALUES... } };
+	static constexpr std::array<int, COUNT> FIRST = sensorOffsets<COUNT>(VALUES_OF);
+	static constexpr std::array<int, COUNT> ORDER = sensorOrder<COUNT>({ { Sensors::READY_US... } });
+	static constexpr std::array<int, COUNT> READY_US_OF = { { Sensors::READY_US... } };
+	static constexpr std::array<int, COUNT> MESSAGES_OF = { { Sensors::MESSAGES... } };
+	static constexpr std::array<int, COUNT> BYTES_OF = { { Sensors::BYTES... } };
+	static constexpr std::array<bool, COUNT> I2C_OF = { { Sensors::I2C... } };
+	static constexpr std::array<const char *, COUNT> NAMES = { { Sensors::NAME... } };
+	static constexpr std::array<int, COUNT> ADDRS = { { Sensors::ADDR... } };
+	static constexpr std::array<int, COUNT> SIGNATURES = { { Sensors::SIGNATURE... } };
+
+	// The header's length counts the comma before each sensor's columns,
+	// the newline and the terminating nul.
+
+	static constexpr size_t HEADER_SIZE =
+		sizeof(REPORT_HEADER_START) + (0 + ... + sizeof(Sensors::COLUMNS)) + 1;
+	static constexpr std::array<char, HEADER_SIZE> HEADER =
+		sensorHeader<HEADER_SIZE, COUNT>({ { Sensors::COLUMNS... } });
+
+	static_assert(VALUES <= MAX_CHANNELS, "more values than MAX_CHANNELS");
+
+	//************************************************************************
+	// Reads every due sensor into the sample.  The status of each is left
+	// in readings[] (sensors that were not due are left alone) for the
+	// caller to report.
+
+	static void poll(const SensorSlot *slots, Sample *sample, const bool *due, SensorReading *readings)
+	{
+		bool waiting[COUNT];
+		struct timespec next;
+
+		start(slots, due, readings, waiting);
+		while (collect(slots, readings, waiting, &next))
+		{
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			{
+			}
+		}
+		finish(sample, due, readings);
+	}
+
+	//************************************************************************
+	// The steps of poll().  start() begins every due sensor and fetches the
+	// ones that need no wait; waiting[i] is left true for each one still to
+	// be fetched.  Each reading's fetched time is set once its transfers
+	// have been sent.
+
+	static void start(const SensorSlot *slots, const bool *due, SensorReading *readings, bool *waiting)
+	{
+		bool before[COUNT];
+
+		driverQueue(true);
+		beginAll(slots, due, readings, waiting, std::make_index_sequence<COUNT>());
+		memcpy(before, waiting, sizeof(before));
+		fetchReady(slots, readings, waiting);
+		driverQueue(false);
+		stamp(readings, before, waiting);
+	}
+
+	// Fetches every waiting sensor whose time has come.  Returns false once
+	// none are left, otherwise true with next set to when the soonest of
+	// them will be ready (CLOCK_MONOTONIC).
+
+	static bool collect(const SensorSlot *slots, SensorReading *readings, bool *waiting, struct timespec *next)
+	{
+		bool before[COUNT];
+		memcpy(before, waiting, sizeof(before));
+
+		driverQueue(true);
+		fetchReady(slots, readings, waiting);
+		driverQueue(false);
+		stamp(readings, before, waiting);
+
+		bool any = false;
+		for (int i = 0; i < COUNT; i++)
+		{
+			if (waiting[i] && (!any || readings[i].ready.tv_sec < next->tv_sec ||
+				(readings[i].ready.tv_sec == next->tv_sec && readings[i].ready.tv_nsec < next->tv_nsec)))
+			{
+				*next = readings[i].ready;
+				any = true;
+			}
+		}
+
+		return any;
+	}
+
+	// Checks and decodes what was fetched into the sample.
+
+	static void finish(Sample *sample, const bool *due, SensorReading *readings)
+	{
+		finishAll(sample, due, readings, std::make_index_sequence<COUNT>());
+	}
+
+	//************************************************************************
+	// Probing, done at startup, so a table of function pointers is fine.
+
+	static bool canBeAt(int i, int addr)
+	{
+		static constexpr bool (*check[])(int) = { candidate<Sensors>... };
+		return check[i](addr);
+	}
+
+	static bool identify(int i, int fd, int addr)
+	{
+		static constexpr bool (*check[])(int, int) = { Sensors::identify... };
+		return check[i](fd, addr);
+	}
+
+private:
+	template <typename S>
+	static bool candidate(int addr)
+	{
+		for (unsigned char a : S::CANDIDATES)
+		{
+			if (a == addr)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <size_t... I>
+	static void beginAll(const SensorSlot *slots, const bool *due, SensorReading *readings,
+		bool *waiting, std::index_sequence<I...>)
+	{
+		(begin<I>(&slots[I], due, &readings[I], &waiting[I]), ...);
+	}
+
+	// In ORDER, so of the ones ready at once the quickest go first.
+
+	static void fetchReady(const SensorSlot *slots, SensorReading *readings, bool *waiting)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		fetchAll(slots, readings, waiting, &now, std::make_index_sequence<COUNT>());
+	}
+
+	// Sets the fetched time of the readings that were just fetched.
+
+	static void stamp(SensorReading *readings, const bool *before, const bool *waiting)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (int i = 0; i < COUNT; i++)
+		{
+			if (before[i] && !waiting[i])
+			{
+				readings[i].fetched = now;
+			}
+		}
+	}
+
+	template <size_t... I>
+	static void fetchAll(const SensorSlot *slots, SensorReading *readings, bool *waiting,
+		const struct timespec *now, std::index_sequence<I...>)
+	{
+		(fetch<ORDER[I]>(&slots[ORDER[I]], &readings[ORDER[I]], &waiting[ORDER[I]], now), ...);
+	}
+
+	template <size_t... I>
+	static void finishAll(Sample *sample, const bool *due, SensorReading *readings, std::index_sequence<I...>)
+	{
+		(finishOne<I>(sample, due, &readings[I]), ...);
+	}
+
+	template <size_t I>
+	static void begin(const SensorSlot *slot, const bool *due, SensorReading *reading, bool *waiting)
+	{
+		*waiting = due[I];
+		if (due[I])
+		{
+			reading->addr = slot->addr;
+			reading->status = DRIVER_OK;
+			reading->status = driverMux(slot, reading);
+			if (reading->status == DRIVER_OK)
+			{
+				reading->status = Sensor<I>::begin(slot->fd, reading);
+			}
+			driverReadyAt(reading, Sensor<I>::READY_US);
+		}
+	}
+
+	// A sensor whose start failed is not fetched.  With queueing that is
+	// only known once the start has been sent, which it has by the time
+	// anything with a wait comes up.
+
+	template <size_t I>
+	static void fetch(const SensorSlot *slot, SensorReading *reading, bool *waiting,
+		const struct timespec *now)
+	{
+		if (!*waiting || reading->ready.tv_sec > now->tv_sec ||
+			(reading->ready.tv_sec == now->tv_sec && reading->ready.tv_nsec > now->tv_nsec))
+		{
+			return;
+		}
+
+		*waiting = false;
+		if (reading->status != DRIVER_OK)
+		{
+			return;
+		}
+
+		reading->status = driverMux(slot, reading);
+		if (reading->status == DRIVER_OK)
+		{
+			reading->status = Sensor<I>::fetch(slot->fd, reading);
+		}
+	}
+
+	template <size_t I>
+	static void finishOne(Sample *sample, const bool *due, SensorReading *reading)
+	{
+		if (!due[I] || reading->status != DRIVER_OK)
+		{
+			return;
+		}
+
+		reading->status = Sensor<I>::check(&reading->raw);
+		if (reading->status == DRIVER_OK)
+		{
+			Sensor<I>::decode(&reading->raw, &sample->value[FIRST[I]]);
+			for (int v = 0; v < Sensor<I>::VALUES; v++)
+			{
+				sample->valid[FIRST[I] + v] = true;
+			}
+		}
+	}
+};
+
+#endif	// SENSORTABLE_H
@@ -13,13 +13,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
+
+#include "drivers.h"
+#include "i2cbus.h"
+#include "broker.h"
 
 // Initially I thought of using multiple of these SHT30 devices so I added
 // Sparkfun I2C MUX (multiplexer) https://www.adafruit.com/product/4704.
@@ -30,14 +30,16 @@
 #define FIRST_PORT	0
 #define LAST_PORT	3
 
-// Hard coded I2C addresses that should not be changed unless the address
-// jumpers on each board are also modified.
+// Hard coded I2C address of the MUX that should not be changed unless the
+// address jumpers on the board are also modified.  The SHT30 address is in
+// drivers.h.
 
-#define SHT30_ADDR	0x44
 #define MUX_ADDR	0x70
 
 static int selectMUXport(int fd, int port);
 static int pollSHT30(int fd);
+static void showSHT30(const SensorReading *reading);
+static void usage(const char *name);
 
 
 
@@ -45,6 +47,30 @@ static int pollSHT30(int fd);
 //****************************************************************************
 int main(int argc, char **argv)
 {
+	const char *socketPath = DEFAULT_BROKER_SOCKET;
+	int maxAge = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "a:s:")) != -1)
+	{
+		switch (option)
+		{
+			case 'a':
+				maxAge = atoi(optarg);
+				break;
+
+			case 's':
+				socketPath = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+#ifdef USE_MUX
+	// Monitor only knows about the one SHT30, so this goes to the bus
+
 	int i2cfd = open("/dev/i2c-1", O_RDWR);
 	if (i2cfd <= 0)
 	{
@@ -52,7 +78,6 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-#ifdef USE_MUX
 	// Loop through all the sensors.  Select the port, then get
 	// the data from the sensor.
 
@@ -65,7 +90,14 @@ int main(int argc, char **argv)
 		}
 	}
 #else	// USE_MUX
-	pollSHT30(i2cfd);		// no need to select a port
+	// Through Monitor if it is running, otherwise straight off the bus
+
+	SensorReading reading;
+	if (!brokerReadSensor(socketPath, maxAge * 1000, &sht30Driver, &reading))
+	{
+		exit(1);
+	}
+	showSHT30(&reading);
 #endif	// USE_MUX
 
 	exit(0);
@@ -81,7 +113,7 @@ int main(int argc, char **argv)
 
 static int selectMUXport(int fd, int port)
 {
-	if (ioctl(fd, I2C_SLAVE, MUX_ADDR) < 0)
+	if (i2cSelect(fd, MUX_ADDR) < 0)
 	{
 		printf("Error acquiring MUX device: %s\n", strerror(errno));
 		return -1;
@@ -89,7 +121,7 @@ static int selectMUXport(int fd, int port)
 
 	unsigned char data;
 	data = 1 << port;
-	if (write(fd, &data, 1) != 1)
+	if (i2cWrite(fd, &data, 1) != 1)
 	{
 		printf("Error writing command to MUX: %s\n", strerror(errno));
 		return -1;
@@ -108,40 +140,41 @@ static int selectMUXport(int fd, int port)
 
 static int pollSHT30(int fd)
 {
-
-	if (ioctl(fd, I2C_SLAVE, SHT30_ADDR) < 0)
+	SensorReading reading;
+	if (driverRead(fd, &sht30Driver, &reading) != DRIVER_OK)
 	{
-		printf("Error acquiring sensor: %s\n", strerror(errno));
+		printf("%s\n", driverError(&reading));
 		return -1;
 	}
 
-	unsigned char buffer[2];
-	buffer[0] = 0x2c;
-	buffer[1] = 0x06;
-	if (write(fd, buffer, 2) != 2)
-	{
-		printf("Error writing sensor command: %s\n", strerror(errno));
-		return -1;
-	}
+	showSHT30(&reading);
+	return 0;
+}
 
-	int got;
 
-	if ((got = read(fd, buffer, 6)) != 6)
-	{
-		printf("Got %d as a return code\n", got);
-		perror("Reading sensor data");
-		return -1;
-	}
 
-	float temp = buffer[0] * 256 + buffer[1];
-	float cTemp = -45 + (175 * temp / 65536.0);
-	float fTemp = -49 + (315 * temp / 65536.0);
-	float humidity = 100 * (buffer[3] * 256 + buffer[4]) / 65536.0;
 
-//	printf("Temp: %f C, %f F, humidity %f%%\n", cTemp, fTemp, humidity);
-	printf("Temp: %1.2f C, %1.2f F, humidity %1.2f%%\n", cTemp, fTemp, humidity);
+//****************************************************************************
+// Displays the temp and humidity from a good reading.
 
-	return 0;
+static void showSHT30(const SensorReading *reading)
+{
+	float values[DRIVER_MAX_VALUES];
+	sht30Driver.decode(&reading->raw, values);
+	printf("Temp: %1.2f C, %1.2f F, humidity %1.2f%%\n", values[0], values[1], values[2]);
 }
 
 
+
+
+//****************************************************************************
+// Explains the command line and exits.
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-a seconds] [-s socket]\n", name);
+	printf("   -a  a reading Monitor already has will do if it is no older\n");
+	printf("       than this, default 0 (a fresh one)\n");
+	printf("   -s  Monitor's broker socket, default %s\n", DEFAULT_BROKER_SOCKET);
+	exit(1);
+}
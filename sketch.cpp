@@ -0,0 +1,223 @@
+//****************************************************************************
+// Fixed size t-digest.  See sketch.h.
+//
+// New values are simply appended as centroids of weight 1.  When the array
+// fills up, the centroids are sorted and neighbours are merged as long as
+// the merged centroid stays within the size limit given by the t-digest
+// scale function.  That function keeps centroids near the median big and
+// centroids near the tails small, which is where p5 and p95 live.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sketch.h"
+
+static void compress(Sketch *s);
+static int compareCentroids(const void *a, const void *b);
+static double scale(double q);
+
+
+
+
+//****************************************************************************
+// Empties a sketch.
+
+void sketchClear(Sketch *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+
+
+
+//****************************************************************************
+// Adds one value to a sketch.
+
+void sketchAdd(Sketch *s, float value)
+{
+	if (s->used == SKETCH_CENTROIDS)
+	{
+		compress(s);
+	}
+
+	if (s->count == 0 || value < s->min)
+	{
+		s->min = value;
+	}
+	if (s->count == 0 || value > s->max)
+	{
+		s->max = value;
+	}
+
+	s->centroid[s->used].mean = value;
+	s->centroid[s->used].weight = 1;
+	s->used++;
+	s->count++;
+}
+
+
+
+
+//****************************************************************************
+// Folds one sketch into another.  The result is as if every value added to
+// "from" had also been added to "into".
+
+void sketchMerge(Sketch *into, const Sketch *from)
+{
+	if (from->count == 0)
+	{
+		return;
+	}
+
+	if (into->count == 0 || from->min < into->min)
+	{
+		into->min = from->min;
+	}
+	if (into->count == 0 || from->max > into->max)
+	{
+		into->max = from->max;
+	}
+
+	for (unsigned i = 0; i < from->used; i++)
+	{
+		if (into->used == SKETCH_CENTROIDS)
+		{
+			compress(into);
+		}
+		into->centroid[into->used++] = from->centroid[i];
+	}
+
+	into->count += from->count;
+}
+
+
+
+
+//****************************************************************************
+// Returns the estimated value at quantile q (0.0 to 1.0), or NAN if the
+// sketch is empty.
+
+float sketchQuantile(Sketch *s, float q)
+{
+	if (s->count == 0)
+	{
+		return NAN;
+	}
+
+	compress(s);		// also leaves the centroids sorted
+
+	if (s->used == 1 || q <= 0)
+	{
+		return q <= 0 ? s->min : s->centroid[0].mean;
+	}
+	if (q >= 1)
+	{
+		return s->max;
+	}
+
+	// Each centroid is treated as sitting at the middle of its weight.
+	// Find the pair of centroids the target falls between and interpolate.
+
+	double target = q * s->count;
+	double left = 0;		// weight before the current centroid
+	double prevCenter = 0;
+	double prevMean = s->min;
+
+	for (unsigned i = 0; i < s->used; i++)
+	{
+		Centroid *c = &s->centroid[i];
+		double center = left + c->weight / 2;
+
+		if (target < center)
+		{
+			double span = center - prevCenter;
+			double frac = span > 0 ? (target - prevCenter) / span : 0;
+			return prevMean + frac * (c->mean - prevMean);
+		}
+
+		prevCenter = center;
+		prevMean = c->mean;
+		left += c->weight;
+	}
+
+	// Past the middle of the last centroid; interpolate towards the max.
+
+	double span = s->count - prevCenter;
+	double frac = span > 0 ? (target - prevCenter) / span : 0;
+	return prevMean + frac * (s->max - prevMean);
+}
+
+
+
+
+//****************************************************************************
+// Sorts the centroids and merges neighbours that fit within the size limit.
+
+static void compress(Sketch *s)
+{
+	if (s->used < 2)
+	{
+		return;
+	}
+
+	qsort(s->centroid, s->used, sizeof(Centroid), compareCentroids);
+
+	double total = 0;
+	for (unsigned i = 0; i < s->used; i++)
+	{
+		total += s->centroid[i].weight;
+	}
+
+	unsigned out = 0;		// index of the centroid being built
+	double before = 0;		// weight of the finished centroids
+	double limit = scale(0) + 1;
+
+	for (unsigned i = 1; i < s->used; i++)
+	{
+		Centroid *cur = &s->centroid[out];
+		Centroid *next = &s->centroid[i];
+		double weight = cur->weight + next->weight;
+
+		if (scale((before + weight) / total) <= limit)
+		{
+			cur->mean += (next->mean - cur->mean) * next->weight / weight;
+			cur->weight = weight;
+		}
+		else
+		{
+			before += cur->weight;
+			limit = scale(before / total) + 1;
+			s->centroid[++out] = *next;
+		}
+	}
+
+	s->used = out + 1;
+}
+
+
+
+
+//****************************************************************************
+// qsort helper, orders centroids by mean.
+
+static int compareCentroids(const void *a, const void *b)
+{
+	float ma = ((const Centroid *)a)->mean;
+	float mb = ((const Centroid *)b)->mean;
+
+	return (ma > mb) - (ma < mb);
+}
+
+
+
+
+//****************************************************************************
+// The t-digest "k1" scale function.  A centroid may span at most 1 unit of
+// this scale, which allows wide centroids in the middle and narrow ones at
+// the ends.
+
+static double scale(double q)
+{
+	return SKETCH_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
@@ -0,0 +1,57 @@
+//****************************************************************************
+// A small fixed size t-digest for estimating percentiles (p5, p50, p95...)
+// without keeping every sample around.  Two sketches can be merged, so the
+// percentiles for any window come from merging the sketches of the buckets
+// that make up the window.
+//
+// A sketch is a plain struct with no pointers so it can be written straight
+// to a file and read back.
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+// Room for this many centroids.  Once full the sketch is compressed down to
+// roughly SKETCH_COMPRESSION centroids, so accuracy is best near the tails.
+
+#define SKETCH_CENTROIDS	64
+#define SKETCH_COMPRESSION	20
+
+struct Centroid
+{
+	float mean;
+	float weight;
+};
+
+struct Sketch
+{
+	unsigned count;			// number of samples added
+	unsigned used;			// number of centroids in use
+	float min;
+	float max;
+	Centroid centroid[SKETCH_CENTROIDS];
+};
+
+// This is one record in a .sketch file, written when a rollup bucket closes.
+// Only the centroids in use are written, so a record is SKETCH_RECORD_SIZE()
+// bytes long rather than sizeof(SketchRecord).
+
+#define SKETCH_RECORD_MAGIC	0x534B5431	// "SKT1"
+
+struct SketchRecord
+{
+	unsigned magic;
+	unsigned pad;
+	long long start;		// epoch of the start of the bucket
+	char channel[16];		// channel name, nul terminated
+	Sketch sketch;
+};
+
+#define SKETCH_RECORD_HEADER	(sizeof(SketchRecord) - sizeof(Centroid) * SKETCH_CENTROIDS)
+#define SKETCH_RECORD_SIZE(r)	(SKETCH_RECORD_HEADER + sizeof(Centroid) * (r)->sketch.used)
+
+void sketchClear(Sketch *s);
+void sketchAdd(Sketch *s, float value);
+void sketchMerge(Sketch *into, const Sketch *from);
+float sketchQuantile(Sketch *s, float q);
+
+#endif	// SKETCH_H
@@ -0,0 +1,223 @@
+//****************************************************************************
+// DS18B20 temperature probes, through the kernel's w1 driver.  See the
+// Ds18b20 driver in drivers.h.
+//
+// Reading a probe's w1_slave or temperature file on its own starts a
+// conversion and sits through it, 750ms a probe.  Instead, writing
+// "trigger" to a bus master's therm_bulk_read (Linux 5.10 on) tells every
+// probe on that bus to convert at once and returns straight away, as long
+// as the probes are powered rather than parasitic.  Once the conversion
+// time is up, reading each probe's temperature file just fetches the
+// result: a few ms of 1-Wire traffic, no waiting.
+//
+// Everything is found under w1Root, so pointing it at a directory with
+// w1_bus_master1/therm_bulk_read and 28-xxxxxxxxxxxx/temperature files in
+// it is enough to try this out without any probes.  bench does just that.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "drivers.h"
+
+#define MASTER_PREFIX	"w1_bus_master"
+#define DS18B20_PREFIX	"28-"		// the DS18B20's family code
+
+// What a DS18B20 reads before it has ever converted.  Getting it means the
+// probe missed the conversion (it was reset, or lost power), not that it
+// really is 85C.
+
+#define POWER_ON_MILLIC	85000
+
+#define NAME_SIZE	32
+
+char w1Root[W1_PATH_SIZE] = DEFAULT_W1_ROOT;
+
+static int findProbes(char names[][NAME_SIZE]);
+static bool readTemperature(const char *name, int *milliC);
+
+
+
+
+//****************************************************************************
+// Starts a conversion on every probe on every bus master.  Returns a
+// DRIVER_ status.
+
+int w1Trigger(SensorReading *reading)
+{
+	DIR *dir = opendir(w1Root);
+	if (dir == NULL)
+	{
+		reading->error = errno;
+		return DRIVER_WRITE_ERROR;
+	}
+
+	int triggered = 0;
+	reading->error = ENODEV;		// unless there is a master
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, MASTER_PREFIX, strlen(MASTER_PREFIX)) != 0 ||
+			strlen(entry->d_name) >= NAME_SIZE)
+		{
+			continue;
+		}
+
+		char path[W1_PATH_SIZE + NAME_SIZE + 32];
+		snprintf(path, sizeof(path), "%s/%s/therm_bulk_read", w1Root, entry->d_name);
+
+		int fd = open(path, O_WRONLY);
+		if (fd < 0)
+		{
+			reading->error = errno;
+			continue;
+		}
+		if (write(fd, "trigger\n", 8) == 8)
+		{
+			triggered++;
+		}
+		else
+		{
+			reading->error = errno;
+		}
+		close(fd);
+	}
+	closedir(dir);
+
+	return triggered > 0 ? DRIVER_OK : DRIVER_WRITE_ERROR;
+}
+
+
+
+
+//****************************************************************************
+// Collects the probes' temperatures.  A probe that can't be read is left
+// out of raw->present; it is only an error if none can be.
+
+int w1Fetch(Ds18b20Raw *raw, SensorReading *reading)
+{
+	char names[DS18B20_PROBES][NAME_SIZE];
+	int count = findProbes(names);
+
+	raw->present = 0;
+	reading->error = ENODEV;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (readTemperature(names[i], &raw->milliC[i]))
+		{
+			raw->present |= 1 << i;
+		}
+		else
+		{
+			reading->error = errno;
+		}
+	}
+
+	return raw->present != 0 ? DRIVER_OK : DRIVER_READ_ERROR;
+}
+
+
+
+
+//****************************************************************************
+// Whether there are any DS18B20s, for probing.
+
+bool w1Found(void)
+{
+	char names[DS18B20_PROBES][NAME_SIZE];
+	return findProbes(names) > 0;
+}
+
+
+
+
+//****************************************************************************
+// Finds the first DS18B20_PROBES probes in ROM id order.  Returns how many
+// there are.
+
+static int findProbes(char names[][NAME_SIZE])
+{
+	DIR *dir = opendir(w1Root);
+	if (dir == NULL)
+	{
+		return 0;
+	}
+
+	int count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strncmp(entry->d_name, DS18B20_PREFIX, strlen(DS18B20_PREFIX)) != 0 ||
+			strlen(entry->d_name) >= NAME_SIZE)
+		{
+			continue;
+		}
+
+		// Insert in order, dropping whatever falls off the end
+
+		int i = count < DS18B20_PROBES ? count++ : DS18B20_PROBES;
+		while (i > 0 && strcmp(entry->d_name, names[i - 1]) < 0)
+		{
+			if (i < DS18B20_PROBES)
+			{
+				strcpy(names[i], names[i - 1]);
+			}
+			i--;
+		}
+		if (i < DS18B20_PROBES)
+		{
+			strcpy(names[i], entry->d_name);
+		}
+	}
+	closedir(dir);
+
+	return count;
+}
+
+
+
+
+//****************************************************************************
+// Reads one probe's temperature file.  Returns false, with errno set, if
+// it isn't there or doesn't hold a temperature.
+
+static bool readTemperature(const char *name, int *milliC)
+{
+	char path[W1_PATH_SIZE + NAME_SIZE + 32];
+	snprintf(path, sizeof(path), "%s/%s/temperature", w1Root, name);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	char text[16];
+	int got = read(fd, text, sizeof(text) - 1);
+	int saved = errno;
+	close(fd);
+
+	if (got <= 0)
+	{
+		errno = got < 0 ? saved : EIO;
+		return false;
+	}
+	text[got] = '\0';
+
+	char *end;
+	long value = strtol(text, &end, 10);
+	if (end == text || (*end != '\0' && *end != '\n') || value == POWER_ON_MILLIC)
+	{
+		errno = EIO;
+		return false;
+	}
+
+	*milliC = value;
+	return true;
+}